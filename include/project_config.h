@@ -49,7 +49,99 @@
 #define ADXL_SAVE_LIMIT 20
 #define MAX6675_SAVE_LIMIT 20
 
-#define MQTT_BROKER_URI "mqtt://10.99.249.41:1883"
+/* --- Storage backend --- */
+// STORAGE_BACKEND_RAW, _SPIFFS or _LITTLEFS (storage_backend.h); LittleFS
+// comes from joltwallet/littlefs in main/idf_component.yml. Switching formats the log.
+#define STORAGE_BACKEND STORAGE_BACKEND_RAW
+
+/* --- Storage writer config --- */
+#define STORAGE_QUEUE_LENGTH 64          // samples buffered between sensor tasks and the writer
+#define STORAGE_WRITER_STACK_SIZE 4096   // writer task; `stats` shows how much of it is never used
+#define STORAGE_FLUSH_COUNT 64           // seal the open block after this many samples...
+#define STORAGE_FLUSH_AGE_MS (10 * 1000) // ...or when its oldest sample is this old
+#define STORAGE_COMPRESS_SERIES 1        // bit-pack samples (delta-of-delta timestamps); 0 = plain varint records
+#define STORAGE_QUEUE_RESERVE 8          // last free queue slots, taken only by STORAGE_PRIO_HIGH samples
+#define STORAGE_RAW_CODES 1              // MAX6675/ADXL345 tasks store driver codes, converted to units on read
+#define STORAGE_CALIB_HISTORY 4          // calibrations kept per sensor to convert older codes with
+
+/* --- Storage rollup tiers --- */
+// Raw samples have no retention: they stay until uploaded (the ack frees
+// them) or until the ring wraps. Rollups are never uploaded and can be
+// released by age instead, 0 keeping them until the ring wraps.
+#define STORAGE_MINUTE_SEGMENTS 16                   // 16 KB segments reserved for 1-minute rollups
+#define STORAGE_HOUR_SEGMENTS 8                      // 16 KB segments reserved for 1-hour rollups
+#define STORAGE_MINUTE_RETENTION_S 0
+#define STORAGE_HOUR_RETENTION_S 0
+#define STORAGE_ROLLUP_FLUSH_AGE_MS (15 * 60 * 1000) // commit a partially filled rollup block after this long
+
+/* --- Storage quotas --- */
+// When the raw log runs low, sensors holding more than their share of it
+// are decimated (STORAGE_PRIO_NORMAL) or not stored (STORAGE_PRIO_LOW);
+// STORAGE_PRIO_HIGH is never shed. See storage_quota.c.
+#define STORAGE_QUOTA_PRESSURE_PCT 20                         // quotas apply once less than this much of the raw log is free
+#define STORAGE_QUOTA_DECIMATE 4                              // STORAGE_PRIO_NORMAL sensors over quota keep one sample in this many
+#define STORAGE_SESSION_SENSOR STORAGE_SENSOR_MAX6675_PROFILE // its active sessions are never reclaimed...
+#define STORAGE_SESSION_IDLE_S 30                             // ...and a session ends this long after its last sample
+#define STORAGE_POLICY_BMP280 STORAGE_PRIO_NORMAL, 10         // priority, quota in % of the stored samples
+#define STORAGE_POLICY_VEML7700 STORAGE_PRIO_NORMAL, 10
+#define STORAGE_POLICY_MAX6675_NORMAL STORAGE_PRIO_NORMAL, 15
+#define STORAGE_POLICY_MAX6675_PROFILE STORAGE_PRIO_HIGH, 40
+#define STORAGE_POLICY_HCSR04 STORAGE_PRIO_LOW, 10
+#define STORAGE_POLICY_ADXL345 STORAGE_PRIO_LOW, 15
+
+/* --- Storage SD card archive --- */
+// Sealed raw segments are copied from flash to the SD card (CS_SD_CARD_PIN)
+// in the background. Without a card the log simply stays flash only.
+#define STORAGE_ARCHIVE_ENABLED 1
+#define STORAGE_ARCHIVE_MOUNT "/sdcard"
+#define STORAGE_ARCHIVE_CHUNK_SIZE 4096          // bytes per SPI bus hold, x512 and dividing the 16 KB segment
+#define STORAGE_ARCHIVE_FILE_SEGMENTS 64         // segments per archive file (1 MB)
+#define STORAGE_ARCHIVE_INTERVAL_MS (60 * 1000)  // how often sealed segments are looked for
+#define STORAGE_ARCHIVE_RETRY_MS (5 * 60 * 1000) // probe for a card this often while none is mounted
+#define STORAGE_ARCHIVE_SD_FREQ_KHZ 20000        // SPI clock after card init (probing runs at 400 kHz)...
+#define STORAGE_ARCHIVE_SD_SAFE_FREQ_KHZ 1000    // ...and the fallback when the card fails at that speed
+
+#define MQTT_BROKER_URI "mqtt://10.99.249.41:1883"  // mqtts://host:8883 connects over TLS (mqtt_tls.h)
+#define MQTT_TLS_SESSION_RTC 0                     // keep the TLS session in RTC memory across restarts
+#define MQTT_TLS_RTC_SESSION_MAX 1024              // RTC bytes for it; larger sessions stay in RAM only
+#define MQTT_UPLOAD_ACK_TIMEOUT_MS (10 * 1000)     // PUBACKs for a checkpoint must arrive within this time
+#define MQTT_UPLOAD_MAX_INFLIGHT 48                // QoS 1 window: messages sent before waiting for all PUBACKs
+#define MQTT_UPLOAD_ACK_BLOCKS 8                   // storage blocks between upload checkpoints
+#define MQTT_UPLOAD_OUTBOX_MAX_BYTES (16 * 1024)   // publishing pauses while the esp-mqtt outbox holds more
+#define MQTT_OUTBOX_LIMIT_BYTES (24 * 1024)        // RAM ceiling of the esp-mqtt outbox; publishes past it fail
+#define MQTT_BATCH_MAX_BYTES 1024                  // payload of one batched message ("ts;value" lines)...
+#define MQTT_BATCH_MAX_SPAN_S 300                  // ...and the time span its samples may cover
+#define MQTT_PAYLOAD_FORMAT MQTT_PAYLOAD_BINARY   // backlog payloads, MQTT_PAYLOAD_TEXT for "ts;value" lines
+#define MQTT_BULK_MIN_SEGMENTS 2                   // sealed segments waiting before the upload sends whole segments
+#define MQTT_BULK_CHUNK_SIZE 4096                  // segment bytes per bulk message, LZSS compressed
+#define MQTT_BULK_ACK_SEGMENTS 4                   // bulk segments between upload checkpoints
+#define MQTT_METRICS_INTERVAL_MS (60 * 1000)       // how often device metrics are published
+#define MQTT_UPLOAD_INTERVAL_MS (60 * 1000)        // backlog drain while connected, besides every reconnect
+#define MQTT_TOPIC_ALIASES 1                       // MQTT 5 topic aliases; needs CONFIG_MQTT_PROTOCOL_5
+#define MQTT_QUERY_QUEUE_LEN 4                     // query requests waiting to be served
+#define MQTT_TASK_STACK_SIZE (8 * 1024)            // task that uploads, answers queries and publishes
+#define MQTT_CLIENT_STACK_SIZE (8 * 1024)          // esp-mqtt's own task, which runs the TLS handshake
+
+// Live stream: the latest sample of a sensor is published at most once per
+// interval; 0 keeps the sensor off the live stream
+#define MQTT_LIVE_INTERVAL_BMP280_MS (10 * 1000)
+#define MQTT_LIVE_INTERVAL_VEML7700_MS (10 * 1000)
+#define MQTT_LIVE_INTERVAL_MAX6675_NORMAL_MS (5 * 1000)
+#define MQTT_LIVE_INTERVAL_MAX6675_PROFILE_MS 1000
+#define MQTT_LIVE_INTERVAL_HCSR04_MS 1000
+#define MQTT_LIVE_INTERVAL_ADXL345_MS 1000
+
+// Device state: a section is published again once a field moves past its
+// deadband from what the broker holds
+#define MQTT_STATE_INTERVAL_MS 1000                // how often the state is compared
+#define MQTT_STATE_HEARTBEAT_S (10 * 60)           // a sensor's timestamp is refreshed at least this often
+#define MQTT_STATE_STALE_INTERVALS 3               // missed measurements before a sensor reports "stale"
+#define MQTT_STATE_FILL_DEADBAND_PCT 1.0f
+#define MQTT_STATE_DEADBAND_BMP280 0.2f            // °C
+#define MQTT_STATE_DEADBAND_VEML7700 20.0f         // lx
+#define MQTT_STATE_DEADBAND_MAX6675 1.0f           // °C, both modes
+#define MQTT_STATE_DEADBAND_HCSR04 2.0f            // cm
+#define MQTT_STATE_DEADBAND_ADXL345 0.5f           // m/s²
 
 #ifndef BUILD_TIMESTAMP
 #define BUILD_TIMESTAMP 0
@@ -36,6 +36,7 @@
 #include "status_led.h"
 #include "http_client.h"
 #include "mqtt_client_app.h"
+#include "mqtt_tls.h"
 
 #include "buzzer.h"
 
@@ -51,6 +52,20 @@ typedef struct
 } sensor_data_t;
 
 
+static bool print_record(const storage_record_t *record, void *ctx)
+{
+  char line[96];
+  storage_record_to_csv(record, line, sizeof(line));
+  printf("%s\n", line);
+  return true;
+}
+
+static bool print_rollup(const storage_record_t *record, void *ctx)
+{
+  printf("%s;%lu;n=%lu;min=%.3f;avg=%.3f;max=%.3f\n", storage_sensor_name(record->sensor_id),
+         (unsigned long)record->timestamp, (unsigned long)record->count, record->min, record->value, record->max);
+  return true;
+}
 
 i2c_master_bus_handle_t i2c_initialize_master(int sda, int scl)
 {
@@ -135,6 +150,40 @@ void configure_device_defaults(void)
   ESP_LOGI(TAG, "Devices configured with default settings.");
 }
 
+// Raw codes in the log are converted with these; a calibration that
+// differs from the stored one starts a new entry from now on. These are
+// the drivers' constants and do not need the I2C buses.
+static void register_sensor_calibrations(void)
+{
+  uint32_t now = get_timestamp();
+
+  storage_calib_t veml = {
+      .sensor_id = STORAGE_SENSOR_VEML7700,
+      .since = now,
+      .veml7700 = { .conf = CONF_DEFAULT, .lux_per_count = LUX_RESOLUTION },
+  };
+  storage_set_calibration(&veml);
+
+  storage_calib_t adxl = {
+      .sensor_id = STORAGE_SENSOR_ADXL345,
+      .since = now,
+      .adxl345 = {
+          .ms2_per_lsb = ADXL345_LSB_TO_MS2,
+          .offset = { ADXL345_OX_MS2, ADXL345_OY_MS2, ADXL345_OZ_MS2 },
+          .scale = { ADXL345_SX, ADXL345_SY, ADXL345_SZ },
+      },
+  };
+  storage_set_calibration(&adxl);
+}
+
+// BMP280 trimming is read from the chip by bmp280_configure()
+static void register_bmp280_calibration(void)
+{
+  storage_calib_t bmp = { .sensor_id = STORAGE_SENSOR_BMP280, .since = get_timestamp() };
+  bmp280_get_temp_trimming(&bmp.bmp280.t1, &bmp.bmp280.t2, &bmp.bmp280.t3);
+  storage_set_calibration(&bmp);
+}
+
 static void init_nvs(void)
 {
   esp_err_t ret = nvs_flash_init();
@@ -191,12 +240,15 @@ void app_main(void)
 
   init_nvs();
   sntp_client_init();
+  storage_set_clock(get_timestamp);
   storage_init();
+  register_sensor_calibrations();
 
   if (i2c_bus_0 != NULL && i2c_bus_1 != NULL)
   {
     initialize_devices_test(i2c_bus_0, i2c_bus_1);
     configure_device_defaults();
+    register_bmp280_calibration();
   }
 
 
@@ -233,12 +285,24 @@ void app_main(void)
 
     if (strcmp(input_line, "read") == 0)
     {
-      // Używamy funkcji z modułu
-      char *content = storage_read_all();
-      if (content)
+      static storage_cursor_t cursor;
+      char line[96];
+      int lines = 0;
+
+      storage_cursor_open(&cursor);
+      while (storage_cursor_next_line(&cursor, line, sizeof(line)) >= 0)
+      {
+        if (lines++ == 0)
+        {
+          printf("\n--- NOTATKI ---\n");
+        }
+        printf("%s\n", line);
+      }
+      storage_cursor_close(&cursor);
+
+      if (lines > 0)
       {
-        printf("\n--- NOTATKI ---\n%s\n---------------\n", content);
-        free(content);
+        printf("---------------\n");
       }
       else
       {
@@ -249,6 +313,182 @@ void app_main(void)
     {
       printf(">> Wolne: %zu bajtów\n", storage_get_free_space());
     }
+    else if (strncmp(input_line, "query ", 6) == 0)
+    {
+      // query <SENSOR|*> <od> <do>
+      char name[24];
+      unsigned long from = 0, to = 0;
+      int id = STORAGE_SENSOR_ANY;
+
+      if (sscanf(input_line + 6, "%23s %lu %lu", name, &from, &to) != 3 ||
+          (strcmp(name, "*") != 0 && (id = storage_sensor_from_name(name)) < 0))
+      {
+        printf(">> Użycie: query <SENSOR|*> <od> <do>\n");
+      }
+      else
+      {
+        storage_query_stats_t stats;
+        storage_query(id, from, to, print_record, NULL, &stats);
+        printf(">> Rekordów: %lu, segmenty: %lu pominięte / %lu czytane, bloki: %lu pominięte / %lu czytane\n",
+               stats.records, stats.segments_skipped, stats.segments_read, stats.blocks_skipped, stats.blocks_read);
+      }
+    }
+    else if (strncmp(input_line, "scan ", 5) == 0)
+    {
+      // scan <SENSOR|*> <'>'|'<'> <próg>
+      char name[24];
+      char op = 0;
+      float threshold = 0;
+      int id = STORAGE_SENSOR_ANY;
+
+      if (sscanf(input_line + 5, "%23s %c %f", name, &op, &threshold) != 3 || (op != '>' && op != '<') ||
+          (strcmp(name, "*") != 0 && (id = storage_sensor_from_name(name)) < 0))
+      {
+        printf(">> Użycie: scan <SENSOR|*> <'>'|'<'> <próg>\n");
+      }
+      else
+      {
+        storage_predicate_t pred = {
+            .sensor_id = id,
+            .t_from = 0,
+            .t_to = UINT32_MAX,
+            .match = op == '>' ? STORAGE_MATCH_ABOVE : STORAGE_MATCH_BELOW,
+            .threshold = threshold,
+        };
+        storage_query_stats_t stats;
+        storage_scan(&pred, print_record, NULL, &stats);
+        printf(">> Rekordów: %lu, bloki: %lu pominięte / %lu czytane\n",
+               stats.records, stats.blocks_skipped, stats.blocks_read);
+      }
+    }
+    else if (strncmp(input_line, "rollup ", 7) == 0)
+    {
+      // rollup <SENSOR|*> <m|h> <od> <do>
+      char name[24];
+      char res = 0;
+      unsigned long from = 0, to = 0;
+      int id = STORAGE_SENSOR_ANY;
+
+      if (sscanf(input_line + 7, "%23s %c %lu %lu", name, &res, &from, &to) != 4 || (res != 'm' && res != 'h') ||
+          (strcmp(name, "*") != 0 && (id = storage_sensor_from_name(name)) < 0))
+      {
+        printf(">> Użycie: rollup <SENSOR|*> <m|h> <od> <do>\n");
+      }
+      else
+      {
+        storage_predicate_t pred = {
+            .sensor_id = id,
+            .t_from = from,
+            .t_to = to,
+            .match = STORAGE_MATCH_ANY,
+            .tier = res == 'm' ? STORAGE_TIER_MINUTE : STORAGE_TIER_HOUR,
+        };
+        storage_query_stats_t stats;
+        if (storage_scan(&pred, print_rollup, NULL, &stats) == ESP_ERR_NOT_SUPPORTED)
+        {
+          printf(">> Agregaty niedostępne\n");
+        }
+        else
+        {
+          printf(">> Rekordów: %lu, bloki: %lu pominięte / %lu czytane\n",
+                 stats.records, stats.blocks_skipped, stats.blocks_read);
+        }
+      }
+    }
+    else if (strcmp(input_line, "stats") == 0)
+    {
+      storage_writer_stats_t stats;
+      storage_get_writer_stats(&stats);
+      printf(">> Kolejka: %lu (max %lu), zapisane: %lu, odrzucone: %lu, błędy: %lu\n",
+             stats.queue_depth, stats.queue_high_water, stats.written, stats.dropped, stats.write_errors);
+      printf(">> Flush: %lu, ostatni %lu us, max %lu us, średnio %lu us\n",
+             stats.flushes, stats.last_flush_us, stats.max_flush_us,
+             stats.flushes ? (uint32_t)(stats.total_flush_us / stats.flushes) : 0);
+      printf(">> Stos zadania zapisu: %lu z %d B nigdy nieużyte\n", stats.stack_free_min, STORAGE_WRITER_STACK_SIZE);
+    }
+    else if (strcmp(input_line, "quota") == 0)
+    {
+      static const char *priorities[] = {"niski", "normalny", "wysoki"};
+      storage_quota_stats_t stats;
+      storage_get_quota_stats(&stats);
+      printf(">> Limity: %s, sesja %s: ", stats.pressure ? "aktywne (mało miejsca)" : "nieaktywne",
+             storage_sensor_name(STORAGE_SESSION_SENSOR));
+      if (stats.session_active)
+      {
+        printf("trwa od segmentu #%lu\n", stats.session_seq);
+      }
+      else
+      {
+        printf("brak\n");
+      }
+      printf(">> %-16s %-9s %5s %8s %10s %9s %9s\n", "Czujnik", "Priorytet", "Limit", "W logu", "Odrzucone",
+             "Pominięte", "Nadpisane");
+      for (int i = 0; i < STORAGE_SENSOR_COUNT; i++)
+      {
+        const storage_sensor_stats_t *s = &stats.sensors[i];
+        printf(">> %-16s %-9s %4u%% %8lu %10lu %9lu %9lu\n", storage_sensor_name(i), priorities[s->priority],
+               s->quota_pct, s->stored, s->dropped, s->shed, s->evicted);
+      }
+    }
+    else if (strcmp(input_line, "archive") == 0 || strcmp(input_line, "archive now") == 0)
+    {
+      static const char *states[] = {"wyłączone", "brak karty", "gotowe", "kopiowanie"};
+      storage_archive_stats_t stats;
+
+      if (strcmp(input_line, "archive now") == 0)
+      {
+        storage_archive_request();
+      }
+      storage_get_archive_stats(&stats);
+      printf(">> Archiwum SD: %s, karta %llu MB, %lu kHz\n", states[stats.state], stats.card_bytes / (1024 * 1024),
+             stats.freq_khz);
+      printf(">> Segmenty: skopiowane %lu (%llu KB), oczekujące %lu od #%lu, utracone %lu, błędy %lu\n",
+             stats.segments, stats.bytes / 1024, stats.pending, stats.next_seq, stats.missed, stats.errors);
+      printf(">> Magistrala SPI: %lu blokad, max %lu us, średnio %lu us, montowanie %lu us\n",
+             stats.bus_holds, stats.max_hold_us,
+             stats.bus_holds ? (uint32_t)(stats.total_hold_us / stats.bus_holds) : 0, stats.mount_us);
+    }
+    else if (strcmp(input_line, "mqtt") == 0)
+    {
+      mqtt_client_stats_t stats;
+      mqtt_client_get_stats(&stats);
+      printf(">> QoS 1: wysłane %lu, potwierdzone %lu, ponowione %lu, wygasłe %lu\n", stats.published,
+             stats.acked, stats.resent, stats.expired);
+      printf(">> W locie max %lu, outbox %lu B (max %lu B, limit %d B)\n", stats.inflight_high_water,
+             stats.outbox_bytes, stats.outbox_high_water, MQTT_OUTBOX_LIMIT_BYTES);
+      printf(">> Stos zadania MQTT: %lu z %d B nigdy nieużyte\n", stats.stack_free_min, MQTT_TASK_STACK_SIZE);
+
+      mqtt_tls_stats_t tls;
+      mqtt_tls_get_stats(&tls);
+      const mqtt_tls_handshake_stats_t *kinds[] = { &tls.full, &tls.resumed };
+      for (int i = 0; i < 2; i++)
+      {
+        const mqtt_tls_handshake_stats_t *h = kinds[i];
+        printf(">> TLS %-10s %lu (błędy %lu), ostatni %lu ms, max %lu ms, średnio %lu ms, sterta max %lu B\n",
+               i == 0 ? "pełne:" : "wznowione:", h->handshakes, h->failures, h->last_ms, h->max_ms,
+               h->handshakes ? (uint32_t)(h->total_ms / h->handshakes) : 0, h->heap_peak);
+      }
+      printf(">> Sesja TLS: %s, odrzucona przez brokera %lu razy\n",
+             !tls.session_cached ? "brak" : tls.session_from_rtc ? "z pamięci RTC" : "w RAM", tls.sessions_refused);
+      printf(">> Stos zadania esp-mqtt po handshake: %lu z %d B nigdy nieużyte\n", tls.stack_free_min,
+             MQTT_CLIENT_STACK_SIZE);
+    }
+    else if (strcmp(input_line, "bench") == 0)
+    {
+      storage_bench_format(2000);
+    }
+    else if (strcmp(input_line, "bench scan") == 0)
+    {
+      storage_bench_scan();
+    }
+    else if (strcmp(input_line, "bench backend") == 0)
+    {
+      storage_bench_backend();
+    }
+    else if (strcmp(input_line, "bench sd") == 0)
+    {
+      storage_bench_sd();
+    }
     else if (strcmp(input_line, "clear") == 0)
     {
       storage_clear_all();
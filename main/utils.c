@@ -3,6 +3,7 @@
 #include "project_config.h"
 #include "esp_timer.h"
 #include "sntp_client.h"
+#include "mqtt_client_app.h"
 #include <time.h>
 
 
@@ -23,14 +24,48 @@ void print_sensor(const char *name, float value, const char *unit)
     printf("%s: %.3f %s\n", name, value, unit);
 }
 
-void save_sensor_to_storage(const char *name, float value)
+void save_sensor_to_storage(storage_sensor_id_t sensor, float value)
 {
-    char line[128];
-    snprintf(line, sizeof(line), "%s;%lu;%.3f", name, get_timestamp(), value);
-    if (!storage_write_line(line))
+    uint32_t ts = get_timestamp();
+
+    mqtt_client_live_sample(sensor, ts, value);
+    if (!storage_enqueue_sample(sensor, ts, value))
+    {
+        ESP_LOGW("APP_MAIN", "Storage queue full, dropped %s sample", storage_sensor_name(sensor));
+    }
+}
+
+
+// With STORAGE_RAW_CODES the driver's code goes into the log; value feeds
+// the live stream and the fallback to converted storage
+void save_raw_to_storage(storage_sensor_id_t sensor, int32_t code, float value)
+{
+#if STORAGE_RAW_CODES
+    uint32_t ts = get_timestamp();
+
+    mqtt_client_live_sample(sensor, ts, value);
+    if (!storage_enqueue_raw(sensor, ts, code))
+    {
+        ESP_LOGW("APP_MAIN", "Storage queue full, dropped %s sample", storage_sensor_name(sensor));
+    }
+#else
+    save_sensor_to_storage(sensor, value);
+#endif
+}
+
+void save_axes_to_storage(storage_sensor_id_t sensor, const int16_t axes[3], float value)
+{
+#if STORAGE_RAW_CODES
+    uint32_t ts = get_timestamp();
+
+    mqtt_client_live_sample(sensor, ts, value);
+    if (!storage_enqueue_axes(sensor, ts, axes))
     {
-        ESP_LOGW("APP_MAIN", "Failed to save: %s", line);
+        ESP_LOGW("APP_MAIN", "Storage queue full, dropped %s sample", storage_sensor_name(sensor));
     }
+#else
+    save_sensor_to_storage(sensor, value);
+#endif
 }
 
 
@@ -45,9 +80,9 @@ void print_all_sensors(float bmp, float lux, float eng, float dist, float accel)
 
 void save_all_sensors(float bmp, float lux, float eng, float dist, float accel)
 {
-    save_sensor_to_storage("BMP280", bmp);
-    save_sensor_to_storage("VEML7700", lux);
-    save_sensor_to_storage("MAX6675_NORMAL", eng);
-    save_sensor_to_storage("HC-SR04", dist);
-    save_sensor_to_storage("ADXL345", accel);
+    save_sensor_to_storage(STORAGE_SENSOR_BMP280, bmp);
+    save_sensor_to_storage(STORAGE_SENSOR_VEML7700, lux);
+    save_sensor_to_storage(STORAGE_SENSOR_MAX6675_NORMAL, eng);
+    save_sensor_to_storage(STORAGE_SENSOR_HCSR04, dist);
+    save_sensor_to_storage(STORAGE_SENSOR_ADXL345, accel);
 }
@@ -9,7 +9,11 @@ uint32_t get_timestamp(void);
 
 void print_sensor(const char *name, float value, const char *unit);
 
-void save_sensor_to_storage(const char *name, float value);
+void save_sensor_to_storage(storage_sensor_id_t sensor, float value);
+
+void save_raw_to_storage(storage_sensor_id_t sensor, int32_t code, float value);
+
+void save_axes_to_storage(storage_sensor_id_t sensor, const int16_t axes[3], float value);
 
 void print_all_sensors(float bmp, float lux, float eng, float dist, float accel);
 
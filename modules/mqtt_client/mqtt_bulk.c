@@ -0,0 +1,203 @@
+#include "mqtt_bulk.h"
+#include <string.h>
+#include "storage_format.h"
+
+// Candidates tried per position; bounds the time per chunk
+#define LZSS_MAX_CHAIN 32
+
+_Static_assert(MQTT_BULK_CHUNK_MAX <= 4096, "distances are 12 bits");
+
+static uint32_t lzss_hash(const uint8_t *p)
+{
+    return ((p[0] << 8 ^ p[1] << 4 ^ p[2]) * 2654435761u) >> (32 - MQTT_BULK_HASH_BITS);
+}
+
+static void lzss_insert(mqtt_bulk_lzss_t *lz, const uint8_t *in, size_t len, size_t pos)
+{
+    if (pos + MQTT_BULK_MIN_MATCH <= len) {
+        uint32_t h = lzss_hash(&in[pos]);
+        lz->prev[pos] = lz->head[h];
+        lz->head[h] = pos;
+    }
+}
+
+static size_t lzss_longest(const mqtt_bulk_lzss_t *lz, const uint8_t *in, size_t len, size_t pos,
+                           size_t *distance)
+{
+    size_t max = len - pos < MQTT_BULK_MAX_MATCH ? len - pos : MQTT_BULK_MAX_MATCH;
+    size_t best = 0;
+
+    if (max < MQTT_BULK_MIN_MATCH) {
+        return 0;
+    }
+    int32_t cand = lz->head[lzss_hash(&in[pos])];
+    for (int chain = 0; cand >= 0 && chain < LZSS_MAX_CHAIN; chain++) {
+        size_t n = 0;
+        while (n < max && in[cand + n] == in[pos + n]) {
+            n++;
+        }
+        if (n > best) {
+            best = n;
+            *distance = pos - cand;
+            if (n == max) {
+                break;
+            }
+        }
+        cand = lz->prev[cand];
+    }
+    return best;
+}
+
+// Returns 0 when the output would not fit in cap
+static size_t lzss_compress(mqtt_bulk_lzss_t *lz, const uint8_t *in, size_t len, uint8_t *out, size_t cap)
+{
+    size_t o = 0, flags = 0, pos = 0;
+    int bit = 8;
+
+    memset(lz->head, 0xFF, sizeof(lz->head));
+    while (pos < len) {
+        size_t distance = 0;
+        size_t match = lzss_longest(lz, in, len, pos, &distance);
+
+        if (bit == 8) {
+            if (o == cap) {
+                return 0;
+            }
+            flags = o++;
+            out[flags] = 0;
+            bit = 0;
+        }
+        if (match >= MQTT_BULK_MIN_MATCH) {
+            size_t code = match - MQTT_BULK_MIN_MATCH;
+            uint16_t token = (distance - 1) | (code < 15 ? code : 15) << 12;
+            if (o + 2 + (code >= 15) > cap) {
+                return 0;
+            }
+            out[o++] = token;
+            out[o++] = token >> 8;
+            if (code >= 15) {
+                out[o++] = code - 15;
+            }
+        } else {
+            if (o == cap) {
+                return 0;
+            }
+            match = 1;
+            out[flags] |= 1 << bit;
+            out[o++] = in[pos];
+        }
+        bit++;
+        for (size_t end = pos + match; pos < end; pos++) {
+            lzss_insert(lz, in, len, pos);
+        }
+    }
+    return o;
+}
+
+static esp_err_t lzss_expand(const uint8_t *in, size_t len, uint8_t *out, size_t cap, size_t *out_len)
+{
+    size_t i = 0, o = 0;
+
+    while (i < len) {
+        uint8_t flags = in[i++];
+        for (int bit = 0; bit < 8 && i < len; bit++) {
+            if (flags & (1 << bit)) {
+                if (o == cap) {
+                    return ESP_ERR_INVALID_SIZE;
+                }
+                out[o++] = in[i++];
+                continue;
+            }
+            if (i + 2 > len) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            uint16_t token = in[i] | in[i + 1] << 8;
+            size_t distance = (token & 0x0FFF) + 1;
+            size_t n = (token >> 12) + MQTT_BULK_MIN_MATCH;
+            i += 2;
+            if (n == 15 + MQTT_BULK_MIN_MATCH) {
+                if (i == len) {
+                    return ESP_ERR_INVALID_SIZE;
+                }
+                n += in[i++];
+            }
+            if (distance > o || o + n > cap) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            for (; n > 0; n--, o++) {
+                out[o] = out[o - distance];
+            }
+        }
+    }
+    *out_len = o;
+    return ESP_OK;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+size_t mqtt_bulk_encode(mqtt_bulk_lzss_t *lz, uint32_t segment, uint32_t offset, const uint8_t *data,
+                        size_t len, uint8_t *out)
+{
+    uint8_t *payload = &out[MQTT_BULK_HEADER_SIZE];
+    size_t packed = lzss_compress(lz, data, len, payload, len > 0 ? len - 1 : 0);
+
+    out[0] = MQTT_BULK_VERSION;
+    out[1] = packed > 0 ? MQTT_BULK_FLAG_LZSS : 0;
+    out[2] = len;
+    out[3] = len >> 8;
+    put_le32(&out[4], segment);
+    put_le32(&out[8], offset);
+    put_le32(&out[12], storage_crc32(0, data, len));
+    if (packed == 0) {
+        memcpy(payload, data, len);
+        packed = len;
+    }
+    return MQTT_BULK_HEADER_SIZE + packed;
+}
+
+esp_err_t mqtt_bulk_decode(const uint8_t *msg, size_t len, mqtt_bulk_header_t *hdr, uint8_t *out, size_t cap)
+{
+    size_t n = 0;
+
+    if (len < MQTT_BULK_HEADER_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (msg[0] != MQTT_BULK_VERSION) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    hdr->flags = msg[1];
+    hdr->length = msg[2] | msg[3] << 8;
+    hdr->segment = get_le32(&msg[4]);
+    hdr->offset = get_le32(&msg[8]);
+    hdr->crc = get_le32(&msg[12]);
+
+    const uint8_t *data = &msg[MQTT_BULK_HEADER_SIZE];
+    size_t data_len = len - MQTT_BULK_HEADER_SIZE;
+    if (hdr->length > cap) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (hdr->flags & MQTT_BULK_FLAG_LZSS) {
+        esp_err_t err = lzss_expand(data, data_len, out, hdr->length, &n);
+        if (err != ESP_OK) {
+            return err;
+        }
+    } else {
+        n = data_len < hdr->length ? data_len : hdr->length;
+        memcpy(out, data, n);
+    }
+    if (n != hdr->length) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return storage_crc32(0, out, n) == hdr->crc ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Bulk transfer of sealed log segments, published on <user>/<mac>/bulk.
+ *
+ * Each segment is sent as it is stored (storage_log.h), in chunks of
+ * MQTT_BULK_CHUNK_SIZE bytes. Every message carries one chunk behind its
+ * manifest entry; all integers are little-endian.
+ *
+ *  off  size  field
+ *  0    1     version   MQTT_BULK_VERSION
+ *  1    1     flags     MQTT_BULK_FLAG_LZSS if the data is compressed,
+ *                       stored as is otherwise
+ *  2    2     length    segment bytes in the chunk
+ *  4    4     segment   segment sequence number
+ *  8    4     offset    byte offset of the chunk in the segment
+ *  12   4     crc32     of the chunk's segment bytes (IEEE, same as
+ *                       zlib.crc32)
+ *  16   ...   data
+ *
+ * LZSS data is a sequence of groups: a flag byte, then up to 8 items, one
+ * per flag bit from the lowest. A set bit is a literal byte. A clear bit is
+ * a match of 2 bytes, (distance - 1) | (length - 3) << 12, copying length
+ * bytes from distance bytes back in the chunk (the copy may overlap its
+ * output). A length field of 15 is followed by one more byte that adds to
+ * the length, for matches of up to MQTT_BULK_MAX_MATCH bytes. Chunks are
+ * compressed independently.
+ *
+ * A receiver puts every chunk at segment * STORAGE_SEGMENT_SIZE + offset
+ * and can decode complete segments like a partition dump
+ * (tools/mqtt_bulk_receive.py, then tools/storage_decode.py).
+ */
+
+#define MQTT_BULK_VERSION 1
+#define MQTT_BULK_HEADER_SIZE 16
+#define MQTT_BULK_FLAG_LZSS 0x01
+
+#define MQTT_BULK_CHUNK_MAX 4096 // LZSS distances reach back over a whole chunk
+#define MQTT_BULK_MIN_MATCH 3
+#define MQTT_BULK_MAX_MATCH (MQTT_BULK_MIN_MATCH + 15 + 255)
+#define MQTT_BULK_HASH_BITS 10
+
+typedef struct {
+    uint8_t flags;
+    uint16_t length;
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t crc;
+} mqtt_bulk_header_t;
+
+// Compressor state: hash chains over one chunk, the whole RAM it needs
+typedef struct {
+    int16_t head[1 << MQTT_BULK_HASH_BITS];
+    int16_t prev[MQTT_BULK_CHUNK_MAX];
+} mqtt_bulk_lzss_t;
+
+/**
+ * @brief Build the message for one chunk of at most MQTT_BULK_CHUNK_MAX
+ * bytes. out needs MQTT_BULK_HEADER_SIZE + len bytes; chunks that do not
+ * compress are stored.
+ *
+ * @return the message length
+ */
+size_t mqtt_bulk_encode(mqtt_bulk_lzss_t *lz, uint32_t segment, uint32_t offset, const uint8_t *data,
+                        size_t len, uint8_t *out);
+
+/**
+ * @brief Parse a chunk message and expand its data into out.
+ *
+ * @return ESP_ERR_INVALID_SIZE for malformed data or a chunk larger than
+ *         cap, ESP_ERR_INVALID_CRC if the expanded bytes do not match
+ */
+esp_err_t mqtt_bulk_decode(const uint8_t *msg, size_t len, mqtt_bulk_header_t *hdr, uint8_t *out, size_t cap);
@@ -7,12 +7,20 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "esp_timer.h"
+#include "esp_app_desc.h"
 
 #include "storage_manager.h"
+#include "mqtt_payload.h"
+#include "mqtt_bulk.h"
+#include "mqtt_tls.h"
+#include "storage_log.h"
 #include "wifi_station.h"
 #include "ble_internal.h"
 #include "buzzer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -20,45 +28,195 @@
 static volatile bool mqtt_exit_requested = false;
 static const char *user = "user";
 static volatile bool mqtt_connected = false;
+static volatile bool upload_requested = false;
+static QueueHandle_t puback_queue = NULL;
 
+// Sections of the device state, each a retained document on its own topic
+enum {
+    STATE_SENSOR,                                  // + sensor id
+    STATE_STORAGE = STATE_SENSOR + STORAGE_SENSOR_COUNT,
+    STATE_FIRMWARE,
+    STATE_COUNT,
+};
 
+// Topics are built once, when the MAC is known. With MQTT 5 every published
+// topic has a fixed alias, its index + 1, so after the first message of a
+// connection only the 2-byte alias goes on the wire. Busy topics come
+// first, as brokers cap the alias count (mosquitto allows 10 by default).
+enum {
+    TOPIC_BIN,
+    TOPIC_BULK,
+    TOPIC_LIVE,                                      // + sensor id
+    TOPIC_STATE = TOPIC_LIVE + STORAGE_SENSOR_COUNT,  // + state section
+    TOPIC_SENSOR = TOPIC_STATE + STATE_COUNT,         // + sensor id
+    TOPIC_METRICS = TOPIC_SENSOR + STORAGE_SENSOR_COUNT,
+    TOPIC_RESPONSE,
+    TOPIC_ALERTS, // subscribed only
+    TOPIC_QUERY,
+    TOPIC_COUNT,
+};
 
-static void get_mac_str(char *out, size_t len)
+#define TOPIC_MAX_LEN 64
+
+// Aliases need the client to speak MQTT 5 (CONFIG_MQTT_PROTOCOL_5)
+#if MQTT_TOPIC_ALIASES && defined(CONFIG_MQTT_PROTOCOL_5)
+#define USE_TOPIC_ALIASES 1
+#include "mqtt5_client.h"
+#include "esp_transport_tcp.h"
+#include "mqtt_connack.h"
+_Static_assert(TOPIC_COUNT <= 32, "alias bitmaps hold 32 topics");
+#else
+#define USE_TOPIC_ALIASES 0
+#endif
+
+typedef struct {
+    uint32_t messages;
+    uint64_t publish_us;   // time spent in esp_mqtt_client_publish
+    uint64_t topic_bytes;  // topic bytes that went on the wire
+    uint64_t alias_saved;  // topic bytes an established alias replaced
+} publish_stats_t;
+
+static char s_mac[13];
+static char s_topics[TOPIC_COUNT][TOPIC_MAX_LEN];
+static publish_stats_t s_publish_stats;
+static mqtt_client_stats_t s_qos_stats;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+#if USE_TOPIC_ALIASES
+// Per connection: aliases the broker has seen, and its Topic Alias Maximum
+static uint32_t s_alias_sent;
+static uint16_t s_alias_max;
+#endif
+
+static bool state_puback(int msg_id);
+static void query_request(const char *data, int len);
+
+static void topics_init(void)
 {
     uint8_t mac[6];
     esp_read_mac(mac, ESP_MAC_WIFI_STA);
-    snprintf(out, len, "%02x%02x%02x%02x%02x%02x",
+    snprintf(s_mac, sizeof(s_mac), "%02x%02x%02x%02x%02x%02x",
              mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    snprintf(s_topics[TOPIC_BIN], TOPIC_MAX_LEN, "%s/%s/bin", user, s_mac);
+    snprintf(s_topics[TOPIC_BULK], TOPIC_MAX_LEN, "%s/%s/bulk", user, s_mac);
+    for (uint8_t id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        snprintf(s_topics[TOPIC_LIVE + id], TOPIC_MAX_LEN, "%s/%s/live/%s", user, s_mac, storage_sensor_name(id));
+        snprintf(s_topics[TOPIC_SENSOR + id], TOPIC_MAX_LEN, "%s/%s/sensor/%s", user, s_mac,
+                 storage_sensor_name(id));
+        snprintf(s_topics[TOPIC_STATE + STATE_SENSOR + id], TOPIC_MAX_LEN, "%s/%s/state/%s", user, s_mac,
+                 storage_sensor_name(id));
+    }
+    snprintf(s_topics[TOPIC_STATE + STATE_STORAGE], TOPIC_MAX_LEN, "%s/%s/state/storage", user, s_mac);
+    snprintf(s_topics[TOPIC_STATE + STATE_FIRMWARE], TOPIC_MAX_LEN, "%s/%s/state/firmware", user, s_mac);
+    snprintf(s_topics[TOPIC_METRICS], TOPIC_MAX_LEN, "%s/%s/metrics/storage_free", user, s_mac);
+    snprintf(s_topics[TOPIC_RESPONSE], TOPIC_MAX_LEN, "%s/%s/response", user, s_mac);
+    snprintf(s_topics[TOPIC_ALERTS], TOPIC_MAX_LEN, "%s/%s/alerts", user, s_mac);
+    snprintf(s_topics[TOPIC_QUERY], TOPIC_MAX_LEN, "%s/%s/query", user, s_mac);
+}
+
+#if USE_TOPIC_ALIASES
+// Only for topics whose alias is within the broker's Topic Alias Maximum
+static int publish_aliased(esp_mqtt_client_handle_t client, int topic, const void *data, size_t len, int qos,
+                           int retain, bool *aliased)
+{
+    uint32_t bit = 1u << topic;
+    esp_mqtt5_publish_property_config_t property = { .topic_alias = topic + 1 };
+
+    esp_mqtt5_client_set_publish_property(client, &property);
+    int msg_id = esp_mqtt_client_publish(client, s_topics[topic], data, len, qos, retain);
+    property.topic_alias = 0;
+    esp_mqtt5_client_set_publish_property(client, &property);
+
+    if (msg_id >= 0) {
+        *aliased = (s_alias_sent & bit) != 0;
+        s_alias_sent |= bit;
+    }
+    return msg_id;
+}
+#endif
+
+// len 0 publishes data as a string
+static int publish(esp_mqtt_client_handle_t client, int topic, const void *data, size_t len, int qos, int retain)
+{
+    int64_t start_us = esp_timer_get_time();
+    int msg_id = -1;
+    bool aliased = false;
+
+#if USE_TOPIC_ALIASES
+    if (topic + 1 <= s_alias_max) {
+        msg_id = publish_aliased(client, topic, data, len, qos, retain, &aliased);
+    } else {
+        msg_id = esp_mqtt_client_publish(client, s_topics[topic], data, len, qos, retain);
+    }
+#else
+    msg_id = esp_mqtt_client_publish(client, s_topics[topic], data, len, qos, retain);
+#endif
+
+    if (msg_id >= 0) {
+        size_t topic_len = strlen(s_topics[topic]);
+        s_publish_stats.messages++;
+        s_publish_stats.publish_us += esp_timer_get_time() - start_us;
+        s_publish_stats.topic_bytes += aliased ? 0 : topic_len;
+        s_publish_stats.alias_saved += aliased ? topic_len : 0;
+    }
+    return msg_id;
+}
+
+static bool topic_is(esp_mqtt_event_handle_t event, int topic)
+{
+    return (size_t)event->topic_len == strlen(s_topics[topic]) &&
+           strncmp(event->topic, s_topics[topic], event->topic_len) == 0;
 }
 
 static void mqtt_event_handler(void *arg, esp_event_base_t base,
                               int32_t event_id, void *event_data)
 {
     esp_mqtt_event_handle_t event = event_data;
-    char mac_str[13];
-    get_mac_str(mac_str, sizeof(mac_str));
 
     switch (event_id) {
     case MQTT_EVENT_CONNECTED:
         mqtt_connected = true;
+        upload_requested = true;
+#if USE_TOPIC_ALIASES
+        // Aliases only live as long as the network connection
+        s_alias_sent = 0;
+        s_alias_max = mqtt_connack_topic_alias_max();
+        ESP_LOGI(TAG, "MQTT connected, broker allows %u topic aliases", s_alias_max);
+#else
         ESP_LOGI(TAG, "MQTT connected");
-        {
-            char topic[128];
-            snprintf(topic, sizeof(topic), "%s/%s/alerts", user, mac_str);
-            esp_mqtt_client_subscribe(event->client, topic, 0);
-            ESP_LOGI(TAG, "Subscribed to %s", topic);
-        }
+#endif
+        esp_mqtt_client_subscribe(event->client, s_topics[TOPIC_ALERTS], 0);
+        ESP_LOGI(TAG, "Subscribed to %s", s_topics[TOPIC_ALERTS]);
+        esp_mqtt_client_subscribe(event->client, s_topics[TOPIC_QUERY], 1);
+        ESP_LOGI(TAG, "Subscribed to %s", s_topics[TOPIC_QUERY]);
         break;
     case MQTT_EVENT_DISCONNECTED:
         mqtt_connected = false;
         ESP_LOGW(TAG, "MQTT disconnected");
         break;
+    case MQTT_EVENT_PUBLISHED:
+        // State acks stay out of the upload's queue, which has room for
+        // one window only
+        if (!state_puback(event->msg_id)) {
+            xQueueSend(puback_queue, &event->msg_id, 0);
+        }
+        portENTER_CRITICAL(&s_stats_lock);
+        s_qos_stats.acked++;
+        portEXIT_CRITICAL(&s_stats_lock);
+        break;
+    case MQTT_EVENT_DELETED:
+        // Expired unacknowledged; the upload sends it again from the log
+        portENTER_CRITICAL(&s_stats_lock);
+        s_qos_stats.expired++;
+        portEXIT_CRITICAL(&s_stats_lock);
+        break;
     case MQTT_EVENT_DATA:
         if (event->topic_len && event->data_len) {
-            char topic[128];
-            snprintf(topic, sizeof(topic), "%s/%s/alerts", user, mac_str);
+            const char *topic = s_topics[TOPIC_ALERTS];
 
-            if (strncmp(event->topic, topic, event->topic_len) == 0) {
+            if (topic_is(event, TOPIC_QUERY)) {
+                query_request(event->data, event->data_len);
+            } else if (topic_is(event, TOPIC_ALERTS)) {
                 char payload[64];
                 int len = event->data_len < sizeof(payload)-1 ? event->data_len : sizeof(payload)-1;
                 memcpy(payload, event->data, len);
@@ -81,86 +239,840 @@ static void mqtt_event_handler(void *arg, esp_event_base_t base,
     }
 }
 
-static void publish_hello(esp_mqtt_client_handle_t client,
-                          const char *user,
-                          const char *mac,
-                          const char *sensor)
+static void publish_hello(esp_mqtt_client_handle_t client, uint8_t sensor_id)
+{
+    publish(client, TOPIC_SENSOR + sensor_id, "hello", 0, 0, 0);
+    ESP_LOGI(TAG, "Sent hello to %s", s_topics[TOPIC_SENSOR + sensor_id]);
+}
+
+static void publish_metrics(esp_mqtt_client_handle_t client)
+{
+    char payload[16];
+    snprintf(payload, sizeof(payload), "%zu", storage_get_free_space());
+
+    publish(client, TOPIC_METRICS, payload, 0, 0, 0);
+
+    ESP_LOGI(TAG, "MQTT: %lu messages, %llu us/publish, topics %llu B sent, %llu B replaced by aliases",
+             (unsigned long)s_publish_stats.messages,
+             (unsigned long long)(s_publish_stats.publish_us / (s_publish_stats.messages ? s_publish_stats.messages : 1)),
+             (unsigned long long)s_publish_stats.topic_bytes, (unsigned long long)s_publish_stats.alias_saved);
+
+    mqtt_client_stats_t qos;
+    mqtt_client_get_stats(&qos);
+    ESP_LOGI(TAG, "QoS 1: %lu published, %lu acked, %lu resent, %lu expired, in flight max %lu, "
+             "outbox %lu B (max %lu B)",
+             (unsigned long)qos.published, (unsigned long)qos.acked, (unsigned long)qos.resent,
+             (unsigned long)qos.expired, (unsigned long)qos.inflight_high_water,
+             (unsigned long)qos.outbox_bytes, (unsigned long)qos.outbox_high_water);
+    ESP_LOGI(TAG, "Stack: %lu of %d B never used", (unsigned long)qos.stack_free_min, MQTT_TASK_STACK_SIZE);
+}
+
+// Low-water mark of this task's stack, after a query or upload went through
+// storage_query(), the calibration and the payload encoders
+static void stack_sample(void)
 {
-    char topic[128];
-    snprintf(topic, sizeof(topic),
-             "%s/%s/sensor/%s", user, mac, sensor);
+    uint32_t free_min = uxTaskGetStackHighWaterMark(NULL);
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_qos_stats.stack_free_min = free_min;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
 
-    esp_mqtt_client_publish(client, topic, "hello", 0, 0, 0);
-    ESP_LOGI(TAG, "Sent hello to %s", topic);
+void mqtt_client_get_stats(mqtt_client_stats_t *out)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *out = s_qos_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
 }
 
-static void publish_storage_via_mqtt(esp_mqtt_client_handle_t client,
-                                     const char *user,
-                                     const char *mac)
+// Live stream. Sensor tasks hand over every sample; the MQTT task publishes
+// the latest one of each sensor at most once per MQTT_LIVE_INTERVAL_*_MS,
+// QoS 0, on "<user>/<mac>/live/<sensor>". Every sample is in the log as
+// well, so whatever the live stream skips or loses while the broker is
+// unreachable reaches the broker with the backlog upload.
+typedef struct {
+    uint32_t timestamp;
+    float value;
+    bool pending;
+} live_slot_t;
+
+static const uint32_t s_live_interval_ms[STORAGE_SENSOR_COUNT] = {
+    [STORAGE_SENSOR_BMP280] = MQTT_LIVE_INTERVAL_BMP280_MS,
+    [STORAGE_SENSOR_VEML7700] = MQTT_LIVE_INTERVAL_VEML7700_MS,
+    [STORAGE_SENSOR_MAX6675_NORMAL] = MQTT_LIVE_INTERVAL_MAX6675_NORMAL_MS,
+    [STORAGE_SENSOR_MAX6675_PROFILE] = MQTT_LIVE_INTERVAL_MAX6675_PROFILE_MS,
+    [STORAGE_SENSOR_HCSR04] = MQTT_LIVE_INTERVAL_HCSR04_MS,
+    [STORAGE_SENSOR_ADXL345] = MQTT_LIVE_INTERVAL_ADXL345_MS,
+};
+
+// Latest sample of every sensor for the device state, and when it came
+typedef struct {
+    uint32_t timestamp;
+    float value;
+    TickType_t at;
+    bool seen;
+} latest_t;
+
+static live_slot_t s_live[STORAGE_SENSOR_COUNT];
+static latest_t s_latest[STORAGE_SENSOR_COUNT];
+static TickType_t s_live_sent[STORAGE_SENSOR_COUNT];
+static portMUX_TYPE s_live_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void mqtt_client_live_sample(uint8_t sensor_id, uint32_t timestamp, float value)
 {
-    char *data = storage_read_all();
-    if (data == NULL) {
-        ESP_LOGI(TAG, "No stored data to send");
+    if (sensor_id >= STORAGE_SENSOR_COUNT) {
         return;
     }
+    portENTER_CRITICAL(&s_live_lock);
+    s_latest[sensor_id] = (latest_t){ .timestamp = timestamp, .value = value, .at = xTaskGetTickCount(),
+                                      .seen = true };
+    if (s_live_interval_ms[sensor_id] != 0) {
+        s_live[sensor_id] = (live_slot_t){ .timestamp = timestamp, .value = value, .pending = true };
+    }
+    portEXIT_CRITICAL(&s_live_lock);
+}
+
+// Called from the main loop and between backlog messages, so a long upload
+// delays live samples by one message at most
+static void publish_live(esp_mqtt_client_handle_t client)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    if (!mqtt_connected) {
+        return;
+    }
+    for (uint8_t id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        live_slot_t slot;
+
+        if (s_live_interval_ms[id] == 0 || now - s_live_sent[id] < pdMS_TO_TICKS(s_live_interval_ms[id])) {
+            continue;
+        }
+        portENTER_CRITICAL(&s_live_lock);
+        slot = s_live[id];
+        s_live[id].pending = false;
+        portEXIT_CRITICAL(&s_live_lock);
+        if (!slot.pending) {
+            continue;
+        }
+
+        char payload[32];
+        snprintf(payload, sizeof(payload), "%lu;%.3f", (unsigned long)slot.timestamp, slot.value);
+        publish(client, TOPIC_LIVE + id, payload, 0, 0, 0);
+        s_live_sent[id] = now;
+    }
+}
+
+// Device state. Each section (a sensor, storage, firmware) is a small JSON
+// document, published retained with QoS 1 on "<user>/<mac>/state/<name>",
+// so the broker holds the whole state and a dashboard subscribing to
+// state/# has it at once. A section is published again only when it moved
+// past its deadband from the copy the broker acknowledged: a sensor value
+// by MQTT_STATE_DEADBAND_<SENSOR>, its timestamp by MQTT_STATE_HEARTBEAT_S,
+// storage fill by MQTT_STATE_FILL_DEADBAND_PCT, health on any change.
+// Firmware goes out once per boot.
+enum { HEALTH_NONE, HEALTH_OK, HEALTH_STALE };
+
+static const char *s_health_names[] = { "none", "ok", "stale" };
+
+typedef struct {
+    uint32_t timestamp;
+    float value; // sensor value, or storage fill in percent
+    uint8_t health;
+} state_value_t;
+
+typedef struct {
+    state_value_t acked; // what the broker holds, once known
+    state_value_t sent;
+    int msg_id;          // publish waiting for its PUBACK, -1 if none
+    TickType_t sent_at;
+    bool known;
+} state_section_t;
+
+static const float s_state_deadband[STATE_COUNT] = {
+    [STATE_SENSOR + STORAGE_SENSOR_BMP280] = MQTT_STATE_DEADBAND_BMP280,
+    [STATE_SENSOR + STORAGE_SENSOR_VEML7700] = MQTT_STATE_DEADBAND_VEML7700,
+    [STATE_SENSOR + STORAGE_SENSOR_MAX6675_NORMAL] = MQTT_STATE_DEADBAND_MAX6675,
+    [STATE_SENSOR + STORAGE_SENSOR_MAX6675_PROFILE] = MQTT_STATE_DEADBAND_MAX6675,
+    [STATE_SENSOR + STORAGE_SENSOR_HCSR04] = MQTT_STATE_DEADBAND_HCSR04,
+    [STATE_SENSOR + STORAGE_SENSOR_ADXL345] = MQTT_STATE_DEADBAND_ADXL345,
+    [STATE_STORAGE] = MQTT_STATE_FILL_DEADBAND_PCT,
+};
+
+// A sensor is stale once it missed MQTT_STATE_STALE_INTERVALS measurements
+static const uint32_t s_measure_interval_ms[STORAGE_SENSOR_COUNT] = {
+    [STORAGE_SENSOR_BMP280] = (BMP280_MEASUREMENT_INTERVAL_MS),
+    [STORAGE_SENSOR_VEML7700] = (VEML7700_MEASUREMENT_INTERVAL_MS),
+    [STORAGE_SENSOR_MAX6675_NORMAL] = (MAX6675_MEASUREMENT_INTERVAL_MS),
+    [STORAGE_SENSOR_MAX6675_PROFILE] = (MAX6675_PROFILE_INTERVAL_MS),
+    [STORAGE_SENSOR_HCSR04] = (HCSR04_SLOWMODE_INTERVAL_MS),
+    [STORAGE_SENSOR_ADXL345] = (FREQUENT_MEASUREMENT_INTERVAL_MS),
+};
+
+static state_section_t s_state[STATE_COUNT];
+static portMUX_TYPE s_state_lock = portMUX_INITIALIZER_UNLOCKED;
+static TickType_t s_state_checked;
+
+static void state_init(void)
+{
+    for (int i = 0; i < STATE_COUNT; i++) {
+        s_state[i].msg_id = -1;
+    }
+}
+
+// From the event handler; true if the PUBACK was for a state section
+static bool state_puback(int msg_id)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&s_state_lock);
+    for (int i = 0; i < STATE_COUNT && !found; i++) {
+        if (s_state[i].msg_id == msg_id) {
+            s_state[i].acked = s_state[i].sent;
+            s_state[i].known = true;
+            s_state[i].msg_id = -1;
+            found = true;
+        }
+    }
+    portEXIT_CRITICAL(&s_state_lock);
+    return found;
+}
+
+static state_value_t state_current(int section, TickType_t now)
+{
+    state_value_t v = { 0 };
+
+    if (section < STATE_STORAGE) {
+        uint8_t id = section - STATE_SENSOR;
+        latest_t latest;
+
+        portENTER_CRITICAL(&s_live_lock);
+        latest = s_latest[id];
+        portEXIT_CRITICAL(&s_live_lock);
+        if (latest.seen) {
+            v.timestamp = latest.timestamp;
+            v.value = latest.value;
+            v.health = now - latest.at > pdMS_TO_TICKS(MQTT_STATE_STALE_INTERVALS * s_measure_interval_ms[id])
+                           ? HEALTH_STALE
+                           : HEALTH_OK;
+        }
+    } else if (section == STATE_STORAGE) {
+        size_t capacity = storage_get_capacity();
+        v.value = capacity ? 100.0f - storage_get_free_space() * 100.0f / capacity : 0;
+    }
+    return v;
+}
+
+static bool state_changed(int section, const state_value_t *acked, const state_value_t *now)
+{
+    return now->health != acked->health || fabsf(now->value - acked->value) > s_state_deadband[section] ||
+           now->timestamp - acked->timestamp >= MQTT_STATE_HEARTBEAT_S;
+}
+
+static int state_format(int section, const state_value_t *v, char *buf, size_t size)
+{
+    if (section < STATE_STORAGE) {
+        if (v->health == HEALTH_NONE) {
+            return snprintf(buf, size, "{\"health\":\"%s\"}", s_health_names[v->health]);
+        }
+        return snprintf(buf, size, "{\"ts\":%lu,\"value\":%.3f,\"health\":\"%s\"}", (unsigned long)v->timestamp,
+                        v->value, s_health_names[v->health]);
+    }
+    if (section == STATE_STORAGE) {
+        return snprintf(buf, size, "{\"free\":%zu,\"capacity\":%zu,\"fill\":%.1f}", storage_get_free_space(),
+                        storage_get_capacity(), v->value);
+    }
+    const esp_app_desc_t *app = esp_app_get_description();
+    return snprintf(buf, size, "{\"project\":\"%s\",\"version\":\"%s\",\"idf\":\"%s\",\"built\":\"%s %s\"}",
+                    app->project_name, app->version, app->idf_ver, app->date, app->time);
+}
+
+static void publish_state(esp_mqtt_client_handle_t client)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    if (!mqtt_connected || now - s_state_checked < pdMS_TO_TICKS(MQTT_STATE_INTERVAL_MS)) {
+        return;
+    }
+    s_state_checked = now;
+
+    for (int i = 0; i < STATE_COUNT; i++) {
+        state_section_t sec;
+        state_value_t cur = state_current(i, now);
+
+        portENTER_CRITICAL(&s_state_lock);
+        if (s_state[i].msg_id >= 0 && now - s_state[i].sent_at >= pdMS_TO_TICKS(MQTT_UPLOAD_ACK_TIMEOUT_MS)) {
+            s_state[i].msg_id = -1; // lost with the connection; publish again
+        }
+        sec = s_state[i];
+        portEXIT_CRITICAL(&s_state_lock);
+        if (sec.msg_id >= 0 || (sec.known && !state_changed(i, &sec.acked, &cur))) {
+            continue;
+        }
+
+        char payload[192];
+        state_format(i, &cur, payload, sizeof(payload));
+        int msg_id = publish(client, TOPIC_STATE + i, payload, 0, 1, 1);
+        if (msg_id < 0) {
+            break;
+        }
+        // A PUBACK handled before msg_id is set is missed; the section is
+        // then sent again after MQTT_UPLOAD_ACK_TIMEOUT_MS
+        portENTER_CRITICAL(&s_state_lock);
+        s_state[i].sent = cur;
+        s_state[i].sent_at = now;
+        s_state[i].msg_id = msg_id;
+        portEXIT_CRITICAL(&s_state_lock);
+        ESP_LOGD(TAG, "State -> %s : %s", s_topics[TOPIC_STATE + i], payload);
+    }
+}
+
+// Backlog upload. Samples of one sensor are packed into a single message
+// (MQTT_PAYLOAD_FORMAT, see mqtt_payload.h) until MQTT_BATCH_MAX_BYTES or
+// MQTT_BATCH_MAX_SPAN_S is reached. Every MQTT_UPLOAD_ACK_BLOCKS storage
+// blocks all open batches are published and, once the broker acknowledged
+// each message, the upload position moves past those blocks.
+//
+// The log is the store behind the QoS 1 window: nothing is copied aside
+// for a retry. Messages not acknowledged when a connection drops (or the
+// device restarts) are built again from their records, starting at the
+// upload position kept in NVS, so the broker may see some of them twice.
+// esp-mqtt holds only the messages in flight, at most MQTT_UPLOAD_MAX_INFLIGHT
+// of them and MQTT_UPLOAD_OUTBOX_MAX_BYTES before publishing pauses.
+//
+// The summary logged at the end of an upload is the measured throughput;
+// tools/mqtt_payload_bench.c and tools/mqtt_bulk_bench.c only estimate
+// wire bytes and airtime on the host.
+typedef struct {
+    uint8_t buf[MQTT_BATCH_MAX_BYTES];
+    mqtt_payload_t payload;
+} sensor_batch_t;
+
+typedef struct {
+    int msg_ids[MQTT_UPLOAD_MAX_INFLIGHT];
+    size_t count;
+} upload_inflight_t;
+
+typedef struct {
+    uint32_t samples;
+    uint32_t segments;     // sent in bulk
+    uint32_t uncalibrated; // sensor codes without a calibration, left out of a query answer
+    uint32_t messages;
+    uint64_t bytes;
+    const storage_pos_t *at; // log position the next message is built up to, NULL for query answers
+} upload_stats_t;
+
+_Static_assert(MQTT_UPLOAD_OUTBOX_MAX_BYTES + MQTT_BULK_HEADER_SIZE + MQTT_BULK_CHUNK_SIZE + TOPIC_MAX_LEN <
+                   MQTT_OUTBOX_LIMIT_BYTES,
+               "a message past the upload budget must still fit the outbox limit");
+
+static sensor_batch_t s_batches[STORAGE_SENSOR_COUNT];
+static upload_inflight_t s_inflight;
+static storage_pos_t s_sent_high; // furthest log position published since boot
+
+static size_t outbox_sample(esp_mqtt_client_handle_t client)
+{
+    int size = esp_mqtt_client_get_outbox_size(client);
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_qos_stats.outbox_bytes = size;
+    if ((uint32_t)size > s_qos_stats.outbox_high_water) {
+        s_qos_stats.outbox_high_water = size;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+    return size;
+}
+
+static inline bool pos_before(const storage_pos_t *a, const storage_pos_t *b)
+{
+    return a->seq < b->seq || (a->seq == b->seq && a->off < b->off);
+}
+
+// A message built from data before the furthest position already published
+// goes out again: the upload was interrupted and resumed from its last
+// acknowledged position. Several messages leave at that furthest position
+// itself, so those are not counted.
+static void upload_count_resent(const storage_pos_t *at)
+{
+    if (at == NULL) {
+        return;
+    }
+    if (!pos_before(at, &s_sent_high)) {
+        s_sent_high = *at;
+        return;
+    }
+    portENTER_CRITICAL(&s_stats_lock);
+    s_qos_stats.resent++;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+static bool upload_inflight_wait(esp_mqtt_client_handle_t client, upload_inflight_t *inflight)
+{
+    TickType_t start = xTaskGetTickCount();
+    size_t pending = inflight->count;
+
+    while (pending > 0) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        int msg_id;
+
+        if (!mqtt_connected || waited >= pdMS_TO_TICKS(MQTT_UPLOAD_ACK_TIMEOUT_MS)) {
+            ESP_LOGW(TAG, "Upload not acknowledged (%zu of %zu messages pending)", pending, inflight->count);
+            return false;
+        }
+        if (xQueueReceive(puback_queue, &msg_id, pdMS_TO_TICKS(200)) != pdTRUE) {
+            publish_live(client);
+            continue;
+        }
+        for (size_t i = 0; i < inflight->count; i++) {
+            if (inflight->msg_ids[i] == msg_id) {
+                inflight->msg_ids[i] = -1;
+                pending--;
+                break;
+            }
+        }
+    }
+    inflight->count = 0;
+    return true;
+}
 
-    ESP_LOGI(TAG, "Sending stored data via MQTT...");
+// Hold back while the esp-mqtt outbox (QoS 1 messages not acknowledged
+// yet) is over its budget, instead of pacing every publish
+static bool upload_wait_outbox(esp_mqtt_client_handle_t client)
+{
+    TickType_t start = xTaskGetTickCount();
 
-    char *line_ctx = NULL;
-    char *line = strtok_r(data, "\n", &line_ctx);
-    
-    // For each line: TYPE;TIMESTAMP;VALUE
-    while (line) { 
-        char *tok_ctx = NULL;
-        char *type = strtok_r(line, ";", &tok_ctx);
-        char *ts   = strtok_r(NULL, ";", &tok_ctx);
-        char *val  = strtok_r(NULL, ";", &tok_ctx);
+    while (outbox_sample(client) > MQTT_UPLOAD_OUTBOX_MAX_BYTES) {
+        if (!mqtt_connected || xTaskGetTickCount() - start >= pdMS_TO_TICKS(MQTT_UPLOAD_ACK_TIMEOUT_MS)) {
+            ESP_LOGW(TAG, "MQTT outbox not draining");
+            return false;
+        }
+        publish_live(client);
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return true;
+}
 
-        if (type && ts && val) {
-            char topic[128];
-            snprintf(topic, sizeof(topic),
-                     "%s/%s/sensor/%s", user, mac, type);
+// QoS 1 publish of one upload message, tracked until the next checkpoint
+static bool upload_publish(esp_mqtt_client_handle_t client, int topic, const void *data, size_t len,
+                           upload_stats_t *stats)
+{
+    publish_live(client);
+    publish_state(client);
+    if (s_inflight.count == MQTT_UPLOAD_MAX_INFLIGHT && !upload_inflight_wait(client, &s_inflight)) {
+        return false;
+    }
+    if (!upload_wait_outbox(client)) {
+        return false;
+    }
 
-            char payload[64];
-            snprintf(payload, sizeof(payload),
-                     "%s;%s", ts, val);
+    int msg_id = publish(client, topic, data, len, 1, 0); // QoS 1, acknowledged by the broker
+    if (msg_id < 0) {
+        ESP_LOGW(TAG, "Publish to %s failed", s_topics[topic]);
+        return false;
+    }
+    ESP_LOGD(TAG, "MQTT -> %s : %zu bytes", s_topics[topic], len);
+    s_inflight.msg_ids[s_inflight.count++] = msg_id;
+    upload_count_resent(stats->at);
+
+    // PUBACKs still queued are mostly for messages of this window
+    uint32_t acked = uxQueueMessagesWaiting(puback_queue);
+    uint32_t pending = s_inflight.count > acked ? s_inflight.count - acked : 0;
+    portENTER_CRITICAL(&s_stats_lock);
+    s_qos_stats.published++;
+    if (pending > s_qos_stats.inflight_high_water) {
+        s_qos_stats.inflight_high_water = pending;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+    outbox_sample(client);
+
+    stats->messages++;
+    stats->bytes += len;
+    return true;
+}
+
+static bool publish_batch(esp_mqtt_client_handle_t client, uint8_t sensor_id, upload_stats_t *stats)
+{
+    sensor_batch_t *batch = &s_batches[sensor_id];
 
-            esp_mqtt_client_publish( 
-                client,
-                topic,
-                payload,
-                0, // auto length
-                0, // QoS 0
-                0  // no retain
-            );
+    if (batch->payload.count == 0) {
+        return true;
+    }
 
-            ESP_LOGI(TAG, "MQTT -> %s : %s", topic, payload);
+    int topic = MQTT_PAYLOAD_FORMAT == MQTT_PAYLOAD_BINARY ? TOPIC_BIN : TOPIC_SENSOR + sensor_id;
+    size_t len = mqtt_payload_finish(&batch->payload);
+    if (!upload_publish(client, topic, batch->buf, len, stats)) {
+        return false;
+    }
+    stats->samples += batch->payload.count;
+    mqtt_payload_begin(&batch->payload, batch->buf, sizeof(batch->buf), MQTT_PAYLOAD_FORMAT, sensor_id);
+    return true;
+}
+
+static bool batch_add(esp_mqtt_client_handle_t client, const storage_record_t *record, upload_stats_t *stats)
+{
+    mqtt_payload_t *payload = &s_batches[record->sensor_id].payload;
+
+    if (payload->count > 0 && record->timestamp - payload->first_ts <= MQTT_BATCH_MAX_SPAN_S &&
+        mqtt_payload_add(payload, record->timestamp, record->value)) {
+        return true;
+    }
+    if (!publish_batch(client, record->sensor_id, stats)) {
+        return false;
+    }
+    if (!mqtt_payload_add(payload, record->timestamp, record->value)) {
+        ESP_LOGW(TAG, "%s sample does not fit an empty batch", storage_sensor_name(record->sensor_id));
+    }
+    return true;
+}
 
-            vTaskDelay(pdMS_TO_TICKS(20));
+// Publish every open batch and wait until the broker has all of them
+static bool upload_checkpoint(esp_mqtt_client_handle_t client, upload_stats_t *stats)
+{
+    for (uint8_t id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        if (!publish_batch(client, id, stats)) {
+            return false;
         }
+    }
+    return upload_inflight_wait(client, &s_inflight);
+}
+
+// Bulk mode. Once MQTT_BULK_MIN_SEGMENTS sealed segments wait, they go out
+// whole, LZSS compressed in MQTT_BULK_CHUNK_SIZE chunks (mqtt_bulk.h),
+// acknowledged every MQTT_BULK_ACK_SEGMENTS segments. The record upload
+// carries on from there with the head segment.
+_Static_assert(MQTT_BULK_CHUNK_SIZE <= MQTT_BULK_CHUNK_MAX && STORAGE_SEGMENT_SIZE % MQTT_BULK_CHUNK_SIZE == 0,
+               "bulk chunks must tile a segment");
+
+static mqtt_bulk_lzss_t s_lzss;
+static uint8_t s_chunk[MQTT_BULK_CHUNK_SIZE];
+static uint8_t s_bulk_msg[MQTT_BULK_HEADER_SIZE + MQTT_BULK_CHUNK_SIZE];
+
+static bool publish_bulk(esp_mqtt_client_handle_t client, upload_stats_t *stats)
+{
+    uint32_t first, end;
 
-        line = strtok_r(NULL, "\n", &line_ctx);
+    if (storage_upload_segments(&first, &end) != ESP_OK || end - first < MQTT_BULK_MIN_SEGMENTS) {
+        return true;
     }
+    ESP_LOGI(TAG, "Sending %lu segments in bulk", (unsigned long)(end - first));
+
+    for (uint32_t seq = first; seq < end; seq++) {
+        esp_err_t err = ESP_OK;
 
-    free(data);
+        for (uint32_t off = 0; off < STORAGE_SEGMENT_SIZE && err == ESP_OK; off += MQTT_BULK_CHUNK_SIZE) {
+            err = storage_segment_read(seq, off, s_chunk, sizeof(s_chunk));
+            if (err == ESP_OK) {
+                size_t len = mqtt_bulk_encode(&s_lzss, seq, off, s_chunk, sizeof(s_chunk), s_bulk_msg);
+                storage_pos_t at = { .seq = seq, .off = off };
+                stats->at = &at;
+                bool sent = upload_publish(client, TOPIC_BULK, s_bulk_msg, len, stats);
+                stats->at = NULL;
+                if (!sent) {
+                    return false;
+                }
+            }
+        }
+        if (err == ESP_ERR_NOT_FOUND) {
+            ESP_LOGW(TAG, "Segment %lu was reused before it was sent", (unsigned long)seq);
+        } else if (err != ESP_OK) {
+            return false;
+        } else {
+            stats->segments++;
+        }
 
-    ESP_LOGI(TAG, "All stored data sent, clearing SPIFFS");
-    storage_clear_all();
+        if ((seq - first + 1) % MQTT_BULK_ACK_SEGMENTS == 0 || seq + 1 == end) {
+            if (!upload_inflight_wait(client, &s_inflight)) {
+                return false;
+            }
+            storage_upload_ack_segment(seq);
+        }
+    }
+    return true;
 }
 
+static bool publish_storage_via_mqtt(esp_mqtt_client_handle_t client)
+{
+    static storage_cursor_t cursor;
+    storage_record_t record;
+    storage_pos_t done, acked = {0};
+    upload_stats_t stats = {0};
+    uint32_t blocks = 0;
+    bool ok = true;
+    bool held = false;
+
+    ESP_LOGD(TAG, "Sending stored data via MQTT...");
+    int64_t start_us = esp_timer_get_time();
+    xQueueReset(puback_queue);
+    s_inflight.count = 0;
+    for (uint8_t id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        mqtt_payload_begin(&s_batches[id].payload, s_batches[id].buf, sizeof(s_batches[id].buf),
+                           MQTT_PAYLOAD_FORMAT, id);
+    }
+
+    if (!publish_bulk(client, &stats)) {
+        ESP_LOGW(TAG, "Bulk upload interrupted after %lu segments", (unsigned long)stats.segments);
+        return false;
+    }
+    if (storage_upload_open(&cursor) != ESP_OK) {
+        ESP_LOGW(TAG, "Storage not available");
+        return true;
+    }
+
+    stats.at = &cursor.block;
+    while (ok && storage_cursor_next(&cursor, &record) == ESP_OK) {
+        if (record.raw != STORAGE_RAW_NONE) {
+            // A code without a calibration has no value to send. The upload
+            // stops before its block and is acknowledged up to there, so
+            // the code stays in the log until storage_set_calibration();
+            // bulk segments carry codes as they are.
+            held = true;
+            break;
+        }
+        if (record.sensor_id < STORAGE_SENSOR_COUNT) { // notes stay on the device
+            ok = batch_add(client, &record, &stats);
+        }
+        if (ok && storage_cursor_block_done(&cursor, &done)) {
+            acked = done;
+            if (++blocks % MQTT_UPLOAD_ACK_BLOCKS == 0) {
+                ok = upload_checkpoint(client, &stats);
+                if (ok) {
+                    storage_upload_ack(&acked);
+                }
+            }
+        }
+    }
+    if (ok && blocks % MQTT_UPLOAD_ACK_BLOCKS != 0) {
+        ok = upload_checkpoint(client, &stats);
+        if (ok) {
+            storage_upload_ack(&acked);
+        }
+    }
+    storage_cursor_close(&cursor);
+
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    if (!ok) {
+        ESP_LOGW(TAG, "Upload interrupted after %lu samples, will resume from the last acknowledged block",
+                 (unsigned long)stats.samples);
+        return false;
+    }
+
+    if (held) {
+        ESP_LOGW(TAG, "Upload waits at %lu:%lu for a %s calibration, %lu samples sent",
+                 (unsigned long)cursor.block.seq, (unsigned long)cursor.block.off,
+                 storage_sensor_name(record.sensor_id), (unsigned long)stats.samples);
+    } else if (stats.messages == 0) {
+        ESP_LOGD(TAG, "No stored data to send");
+    } else {
+        ESP_LOGI(TAG, "All stored data sent: %lu segments in bulk and %lu samples in %lu messages, %llu bytes, "
+                 "%lu ms (%lu samples/s)",
+                 (unsigned long)stats.segments, (unsigned long)stats.samples, (unsigned long)stats.messages,
+                 (unsigned long long)stats.bytes, (unsigned long)elapsed_ms,
+                 (unsigned long)(stats.samples * 1000ULL / (elapsed_ms ? elapsed_ms : 1)));
+    }
+    return true;
+}
+
+// Query channel. The backend publishes a request on "<user>/<mac>/query":
+//
+//   <id> <SENSOR|*> <from> <to> [<step>]
+//
+// id is any 32-bit number, from and to are timestamps (both included) and
+// step, in seconds, keeps only the first sample of each sensor per step
+// (0 or none keeps all). Sensor codes stored before the sensor had a
+// calibration are left out. The device answers on "<user>/<mac>/response"
+// with QoS 1 messages that start with
+//
+//  off  size  field
+//  0    1     version     MQTT_QUERY_VERSION
+//  1    1     status      QUERY_DATA, or the last message: QUERY_DONE,
+//                         QUERY_BAD_REQUEST, QUERY_FAILED
+//  2    2     seq         message number within the response, from 0
+//  4    4     request id
+//
+// followed by one binary batch (mqtt_payload.h) for QUERY_DATA, or by the
+// number of samples sent as a u32 for QUERY_DONE. All integers are
+// little-endian. Requests are served one at a time between uploads; up to
+// MQTT_QUERY_QUEUE_LEN wait, later ones are dropped. tools/mqtt_query.py
+// sends a request and prints the answer.
+#define MQTT_QUERY_VERSION 1
+#define QUERY_HEADER_SIZE 8
+
+enum { QUERY_DATA, QUERY_DONE, QUERY_BAD_REQUEST, QUERY_FAILED };
+
+typedef struct {
+    uint32_t id;
+    int sensor_id;   // STORAGE_SENSOR_ANY for all
+    uint32_t from;
+    uint32_t to;
+    uint32_t step_s;
+    uint8_t status;  // QUERY_BAD_REQUEST if it could not be parsed
+} query_request_t;
+
+typedef struct {
+    esp_mqtt_client_handle_t client;
+    const query_request_t *req;
+    uint32_t bucket[STORAGE_SENSOR_COUNT];
+    bool seen[STORAGE_SENSOR_COUNT];
+    uint16_t seq;
+    bool ok;
+    upload_stats_t stats;
+} query_t;
+
+static QueueHandle_t s_query_queue;
+static uint8_t s_query_msg[QUERY_HEADER_SIZE + MQTT_BATCH_MAX_BYTES];
+
+// From the event handler; parsing is cheap, the query runs in the MQTT task
+static void query_request(const char *data, int len)
+{
+    query_request_t req = { .sensor_id = STORAGE_SENSOR_ANY };
+    unsigned long id = 0, from = 0, to = 0, step = 0;
+    char line[64];
+    char name[24];
+
+    len = len < (int)sizeof(line) - 1 ? len : (int)sizeof(line) - 1;
+    memcpy(line, data, len);
+    line[len] = '\0';
+
+    int n = sscanf(line, "%lu %23s %lu %lu %lu", &id, name, &from, &to, &step);
+    req.id = id;
+    if (n < 4 || from > to || (strcmp(name, "*") != 0 && (req.sensor_id = storage_sensor_from_name(name)) < 0)) {
+        ESP_LOGW(TAG, "Bad query: %s", line);
+        req.status = QUERY_BAD_REQUEST;
+    }
+    req.from = from;
+    req.to = to;
+    req.step_s = n == 5 ? step : 0;
+    if (xQueueSend(s_query_queue, &req, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Query %lu dropped, %d already waiting", id, MQTT_QUERY_QUEUE_LEN);
+    }
+}
+
+static bool query_send(query_t *q, uint8_t status, const void *body, size_t len)
+{
+    s_query_msg[0] = MQTT_QUERY_VERSION;
+    s_query_msg[1] = status;
+    s_query_msg[2] = q->seq;
+    s_query_msg[3] = q->seq >> 8;
+    for (int i = 0; i < 4; i++) {
+        s_query_msg[4 + i] = q->req->id >> (8 * i);
+    }
+    memcpy(&s_query_msg[QUERY_HEADER_SIZE], body, len);
+    if (!upload_publish(q->client, TOPIC_RESPONSE, s_query_msg, QUERY_HEADER_SIZE + len, &q->stats)) {
+        return false;
+    }
+    q->seq++;
+    return true;
+}
+
+static bool query_flush(query_t *q, uint8_t sensor_id)
+{
+    sensor_batch_t *batch = &s_batches[sensor_id];
+
+    if (batch->payload.count == 0) {
+        return true;
+    }
+    size_t len = mqtt_payload_finish(&batch->payload);
+    if (!query_send(q, QUERY_DATA, batch->buf, len)) {
+        return false;
+    }
+    q->stats.samples += batch->payload.count;
+    mqtt_payload_begin(&batch->payload, batch->buf, sizeof(batch->buf), MQTT_PAYLOAD_BINARY, sensor_id);
+    return true;
+}
+
+static bool query_record(const storage_record_t *record, void *ctx)
+{
+    query_t *q = ctx;
+    uint8_t id = record->sensor_id;
+
+    if (id >= STORAGE_SENSOR_COUNT) {
+        return true; // notes
+    }
+    if (record->raw != STORAGE_RAW_NONE) {
+        q->stats.uncalibrated++;
+        return true;
+    }
+    if (q->req->step_s > 0) {
+        uint32_t bucket = record->timestamp / q->req->step_s;
+        if (q->seen[id] && q->bucket[id] == bucket) {
+            return true;
+        }
+        q->bucket[id] = bucket;
+        q->seen[id] = true;
+    }
+
+    mqtt_payload_t *payload = &s_batches[id].payload;
+    if (!mqtt_payload_add(payload, record->timestamp, record->value)) {
+        q->ok = query_flush(q, id) && mqtt_payload_add(payload, record->timestamp, record->value);
+    }
+    return q->ok;
+}
+
+static void query_serve(esp_mqtt_client_handle_t client)
+{
+    query_request_t req;
+    storage_query_stats_t qstats = { 0 };
+
+    if (!mqtt_connected || xQueueReceive(s_query_queue, &req, 0) != pdTRUE) {
+        return;
+    }
+
+    query_t q = { .client = client, .req = &req, .ok = true };
+    int64_t start_us = esp_timer_get_time();
+    xQueueReset(puback_queue);
+    s_inflight.count = 0;
+    for (uint8_t id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        mqtt_payload_begin(&s_batches[id].payload, s_batches[id].buf, sizeof(s_batches[id].buf),
+                           MQTT_PAYLOAD_BINARY, id);
+    }
+
+    uint8_t status = req.status;
+    if (status != QUERY_BAD_REQUEST) {
+        esp_err_t err = storage_query(req.sensor_id, req.from, req.to, query_record, &q, &qstats);
+        for (uint8_t id = 0; id < STORAGE_SENSOR_COUNT && q.ok; id++) {
+            q.ok = query_flush(&q, id);
+        }
+        status = err == ESP_OK && q.ok ? QUERY_DONE : QUERY_FAILED;
+    }
+
+    uint8_t samples[4];
+    for (int i = 0; i < 4; i++) {
+        samples[i] = q.stats.samples >> (8 * i);
+    }
+    bool ok = query_send(&q, status, samples, status == QUERY_DONE ? 4 : 0) &&
+              upload_inflight_wait(client, &s_inflight);
+
+    ESP_LOGI(TAG, "Query %lu: %lu samples in %u messages (%lu uncalibrated left out), %lu of %lu blocks read, "
+             "%lu ms%s",
+             (unsigned long)req.id, (unsigned long)q.stats.samples, q.seq, (unsigned long)q.stats.uncalibrated,
+             (unsigned long)qstats.blocks_read, (unsigned long)(qstats.blocks_read + qstats.blocks_skipped),
+             (unsigned long)((esp_timer_get_time() - start_us) / 1000), ok ? "" : ", not delivered");
+}
 
 static void mqtt_task(void *arg)
 {
     while (!wifi_station_is_connected()) {
         vTaskDelay(pdMS_TO_TICKS(500));
     }
-    char mac[32];
-    get_mac_str(mac, sizeof(mac));
-
+    topics_init();
+    state_init();
 
     esp_mqtt_client_config_t cfg = {
         .broker.address.uri = MQTT_BROKER_URI,
+        .outbox.limit = MQTT_OUTBOX_LIMIT_BYTES,
+        .task.stack_size = MQTT_CLIENT_STACK_SIZE,
+#if USE_TOPIC_ALIASES
+        .session.protocol_ver = MQTT_PROTOCOL_V_5,
+#endif
     };
+    bool tls = strncmp(MQTT_BROKER_URI, "mqtts://", 8) == 0;
+    if (tls) {
+        cfg.network.transport = mqtt_tls_transport_create(); // resumes TLS sessions on reconnect
+    }
+#if USE_TOPIC_ALIASES
+    // The broker's Topic Alias Maximum comes in the CONNACK
+    cfg.network.transport = mqtt_connack_transport_wrap(tls ? cfg.network.transport : esp_transport_tcp_init(),
+                                                        tls ? 8883 : 1883);
+#endif
 
     esp_mqtt_client_handle_t client = esp_mqtt_client_init(&cfg);
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID,
@@ -171,15 +1083,38 @@ static void mqtt_task(void *arg)
         vTaskDelay(pdMS_TO_TICKS(200));
     }
 
-    publish_hello(client, user, mac, "ADXL345");
-    publish_hello(client, user, mac, "MAX6675_NORMAL");
-    publish_hello(client, user, mac, "MAX6675_PROFILE");
-
-    publish_storage_via_mqtt(client, user, mac);
+    publish_hello(client, STORAGE_SENSOR_ADXL345);
+    publish_hello(client, STORAGE_SENSOR_MAX6675_NORMAL);
+    publish_hello(client, STORAGE_SENSOR_MAX6675_PROFILE);
 
-    ESP_LOGI(TAG, "All MQTT data sent");
+    TickType_t last_metrics = xTaskGetTickCount() - pdMS_TO_TICKS(MQTT_METRICS_INTERVAL_MS);
+    TickType_t last_upload = xTaskGetTickCount();
 
     while (!mqtt_exit_requested) {
+        publish_live(client);
+        publish_state(client);
+        query_serve(client);
+        stack_sample();
+
+        if (mqtt_connected &&
+            xTaskGetTickCount() - last_metrics >= pdMS_TO_TICKS(MQTT_METRICS_INTERVAL_MS)) {
+            publish_metrics(client);
+            last_metrics = xTaskGetTickCount();
+        }
+
+        // The backlog is drained after every reconnect and then every
+        // MQTT_UPLOAD_INTERVAL_MS while connected; a failed upload is
+        // retried after a pause, starting from the last acknowledged block.
+        if (mqtt_connected && (upload_requested ||
+                               xTaskGetTickCount() - last_upload >= pdMS_TO_TICKS(MQTT_UPLOAD_INTERVAL_MS))) {
+            last_upload = xTaskGetTickCount();
+            if (publish_storage_via_mqtt(client)) {
+                upload_requested = false;
+            } else {
+                vTaskDelay(pdMS_TO_TICKS(MQTT_UPLOAD_ACK_TIMEOUT_MS));
+            }
+            stack_sample();
+        }
         vTaskDelay(pdMS_TO_TICKS(200));
     }
 
@@ -193,5 +1128,7 @@ static void mqtt_task(void *arg)
 
 void mqtt_client_start(void)
 {
-    xTaskCreate(mqtt_task, "mqtt_hello", 4096, NULL, 5, NULL);
+    puback_queue = xQueueCreate(MQTT_UPLOAD_MAX_INFLIGHT, sizeof(int));
+    s_query_queue = xQueueCreate(MQTT_QUERY_QUEUE_LEN, sizeof(query_request_t));
+    xTaskCreate(mqtt_task, "mqtt_hello", MQTT_TASK_STACK_SIZE, NULL, 5, NULL);
 }
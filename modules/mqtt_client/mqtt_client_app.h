@@ -1,5 +1,27 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 void mqtt_client_start(void);
+
+// Offer a converted sample to the live stream. Safe from any task; only the
+// latest sample per sensor is kept until the MQTT task publishes it.
+void mqtt_client_live_sample(uint8_t sensor_id, uint32_t timestamp, float value);
+
+// QoS 1 upload counters. Unacknowledged backlog messages are not kept for
+// later: their records stay in the log until acknowledged and are read
+// again after a reconnect or reboot. "resent" counts the messages actually
+// published again from log data that had gone out before (since boot).
+typedef struct {
+    uint32_t published;           // QoS 1 messages handed to esp-mqtt
+    uint32_t acked;               // PUBACKs received for them
+    uint32_t resent;              // published again from the log after an interrupted upload
+    uint32_t expired;             // copies esp-mqtt dropped from its outbox
+    uint32_t inflight_high_water; // messages awaiting a PUBACK at once
+    uint32_t outbox_bytes;        // esp-mqtt outbox now...
+    uint32_t outbox_high_water;   // ...and at most
+    uint32_t stack_free_min;      // bytes of the MQTT task's stack never used
+} mqtt_client_stats_t;
+
+void mqtt_client_get_stats(mqtt_client_stats_t *out);
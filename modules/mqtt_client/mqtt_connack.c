@@ -0,0 +1,216 @@
+#include "mqtt_connack.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPTURE_MAX 128
+
+#define CONNACK_TYPE 2
+#define PROP_TOPIC_ALIAS_MAXIMUM 0x22
+
+typedef struct {
+    esp_transport_handle_t parent;
+    bool capturing;
+    size_t len;
+    uint8_t buf[CAPTURE_MAX];
+} connack_transport_t;
+
+// Only touched from esp-mqtt's task, which connects and reads
+static uint16_t s_topic_alias_max;
+
+// MQTT variable byte integer; returns its length, 0 if it runs past len
+static size_t varint(const uint8_t *p, size_t len, uint32_t *out)
+{
+    uint32_t value = 0;
+
+    for (size_t i = 0; i < len && i < 4; i++) {
+        value |= (uint32_t)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *out = value;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// Bytes the value of a CONNACK property takes at p, 0 if unknown or cut off
+static size_t property_len(uint8_t id, const uint8_t *p, size_t len)
+{
+    size_t n;
+
+    switch (id) {
+    case 0x24: // Maximum QoS
+    case 0x25: // Retain Available
+    case 0x28: // Wildcard Subscription Available
+    case 0x29: // Subscription Identifiers Available
+    case 0x2a: // Shared Subscription Available
+        n = 1;
+        break;
+    case 0x13: // Server Keep Alive
+    case 0x21: // Receive Maximum
+    case PROP_TOPIC_ALIAS_MAXIMUM:
+        n = 2;
+        break;
+    case 0x11: // Session Expiry Interval
+    case 0x27: // Maximum Packet Size
+        n = 4;
+        break;
+    case 0x12: // Assigned Client Identifier
+    case 0x15: // Authentication Method
+    case 0x16: // Authentication Data
+    case 0x1a: // Response Information
+    case 0x1c: // Server Reference
+    case 0x1f: // Reason String
+        n = len >= 2 ? 2 + be16(p) : 0;
+        break;
+    case 0x26: // User Property, a string pair
+        n = len >= 2 ? 2 + be16(p) : 0;
+        n = n + 2 <= len ? n + 2 + be16(p + n) : 0;
+        break;
+    default:
+        return 0;
+    }
+    return n <= len ? n : 0;
+}
+
+// body is the CONNACK after its fixed header, possibly cut off at the end
+static void connack_parse(const uint8_t *body, size_t len)
+{
+    uint32_t props_len;
+
+    if (len < 3) {
+        return;
+    }
+    size_t n = varint(body + 2, len - 2, &props_len);
+    if (n == 0) {
+        return;
+    }
+    const uint8_t *p = body + 2 + n;
+    const uint8_t *end = p + (props_len < len - 2 - n ? props_len : len - 2 - n);
+    while (p < end) {
+        uint8_t id = *p++;
+        size_t value_len = property_len(id, p, end - p);
+        if (value_len == 0) {
+            return;
+        }
+        if (id == PROP_TOPIC_ALIAS_MAXIMUM) {
+            s_topic_alias_max = be16(p);
+        }
+        p += value_len;
+    }
+}
+
+// Collects the first packet until it is whole, or the buffer is full
+static void capture(connack_transport_t *ctx, const char *data, int len)
+{
+    size_t n = (size_t)len < CAPTURE_MAX - ctx->len ? (size_t)len : CAPTURE_MAX - ctx->len;
+    uint32_t remaining;
+
+    memcpy(ctx->buf + ctx->len, data, n);
+    ctx->len += n;
+    if (ctx->buf[0] >> 4 != CONNACK_TYPE) {
+        ctx->capturing = false;
+        return;
+    }
+    size_t header = varint(ctx->buf + 1, ctx->len - 1, &remaining);
+    if (header == 0) {
+        ctx->capturing = ctx->len < 5; // the length is at most 4 bytes
+        return;
+    }
+    if (1 + header + remaining <= ctx->len || ctx->len == CAPTURE_MAX) {
+        connack_parse(ctx->buf + 1 + header, ctx->len - 1 - header);
+        ctx->capturing = false;
+    }
+}
+
+static int connack_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    connack_transport_t *ctx = esp_transport_get_context_data(t);
+
+    ctx->capturing = true;
+    ctx->len = 0;
+    s_topic_alias_max = 0;
+    return esp_transport_connect(ctx->parent, host, port, timeout_ms);
+}
+
+static int connack_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    connack_transport_t *ctx = esp_transport_get_context_data(t);
+    int ret = esp_transport_read(ctx->parent, buffer, len, timeout_ms);
+
+    if (ret > 0 && ctx->capturing) {
+        capture(ctx, buffer, ret);
+    }
+    return ret;
+}
+
+static int connack_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    connack_transport_t *ctx = esp_transport_get_context_data(t);
+
+    return esp_transport_write(ctx->parent, buffer, len, timeout_ms);
+}
+
+static int connack_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    connack_transport_t *ctx = esp_transport_get_context_data(t);
+
+    return esp_transport_poll_read(ctx->parent, timeout_ms);
+}
+
+static int connack_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    connack_transport_t *ctx = esp_transport_get_context_data(t);
+
+    return esp_transport_poll_write(ctx->parent, timeout_ms);
+}
+
+static int connack_close(esp_transport_handle_t t)
+{
+    connack_transport_t *ctx = esp_transport_get_context_data(t);
+
+    return esp_transport_close(ctx->parent);
+}
+
+static int connack_destroy(esp_transport_handle_t t)
+{
+    connack_transport_t *ctx = esp_transport_get_context_data(t);
+
+    esp_transport_destroy(ctx->parent);
+    free(ctx);
+    return 0;
+}
+
+esp_transport_handle_t mqtt_connack_transport_wrap(esp_transport_handle_t parent, int default_port)
+{
+    if (parent == NULL) {
+        return NULL;
+    }
+    esp_transport_handle_t t = esp_transport_init();
+    connack_transport_t *ctx = calloc(1, sizeof(*ctx));
+
+    if (t == NULL || ctx == NULL) {
+        if (t != NULL) {
+            esp_transport_destroy(t);
+        }
+        free(ctx);
+        esp_transport_destroy(parent);
+        return NULL;
+    }
+    ctx->parent = parent;
+    esp_transport_set_func(t, connack_connect, connack_read, connack_write, connack_close, connack_poll_read,
+                           connack_poll_write, connack_destroy);
+    esp_transport_set_context_data(t, ctx);
+    esp_transport_set_default_port(t, default_port);
+    return t;
+}
+
+uint16_t mqtt_connack_topic_alias_max(void)
+{
+    return s_topic_alias_max;
+}
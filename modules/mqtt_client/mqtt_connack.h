@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_transport.h"
+
+/*
+ * Transport that reads the broker's CONNACK on its way to esp-mqtt.
+ *
+ * esp-mqtt parses the MQTT 5 CONNACK properties but keeps them private;
+ * topic aliases need the Topic Alias Maximum before the first publish.
+ * This transport passes everything through to the one it wraps and parses
+ * the first packet of each connection itself. Only its first
+ * 128 bytes are looked at, which covers any CONNACK without long reason
+ * strings or user properties.
+ */
+
+/**
+ * @brief Wrap parent, for esp_mqtt_client_config_t.network.transport.
+ * Destroying the wrapper destroys parent; NULL if parent is NULL.
+ */
+esp_transport_handle_t mqtt_connack_transport_wrap(esp_transport_handle_t parent, int default_port);
+
+/**
+ * @brief Topic Alias Maximum of the last CONNACK, 0 when the broker sent
+ * none (no aliases). Set on esp-mqtt's task before MQTT_EVENT_CONNECTED.
+ */
+uint16_t mqtt_connack_topic_alias_max(void);
@@ -0,0 +1,215 @@
+#include "mqtt_payload.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t varint_put(uint8_t *out, uint32_t v)
+{
+    size_t n = 0;
+
+    do {
+        out[n] = v & 0x7F;
+        v >>= 7;
+        if (v != 0) {
+            out[n] |= 0x80;
+        }
+        n++;
+    } while (v != 0);
+    return n;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v);
+    put_le16(p + 2, v >> 16);
+}
+
+void mqtt_payload_begin(mqtt_payload_t *p, uint8_t *buf, size_t cap, uint8_t format, uint8_t sensor_id)
+{
+    *p = (mqtt_payload_t){
+        .buf = buf,
+        .cap = cap,
+        .format = format,
+        .sensor_id = sensor_id,
+    };
+    if (format == MQTT_PAYLOAD_BINARY) {
+        p->len = MQTT_PAYLOAD_HEADER_SIZE;
+    }
+}
+
+static bool add_text(mqtt_payload_t *p, uint32_t timestamp, float value)
+{
+    char line[32];
+
+    int n = snprintf(line, sizeof(line), "%s%lu;%.3f", p->count ? "\n" : "", (unsigned long)timestamp, value);
+    if (n <= 0 || (size_t)n >= sizeof(line) || p->len + n > p->cap) {
+        return false;
+    }
+    memcpy(&p->buf[p->len], line, n);
+    p->len += n;
+    return true;
+}
+
+static bool add_binary(mqtt_payload_t *p, uint32_t timestamp, float value)
+{
+    uint8_t tmp[10];
+    int32_t scaled = (int32_t)lroundf(value * MQTT_PAYLOAD_VALUE_SCALE);
+    uint32_t prev_ts = p->count ? p->last_ts : timestamp;
+
+    if (timestamp < prev_ts) {
+        return false; // deltas are unsigned, start a new payload
+    }
+    size_t n = varint_put(tmp, timestamp - prev_ts);
+    n += varint_put(&tmp[n], zigzag(scaled - p->last_value));
+    if (p->len + n > p->cap) {
+        return false;
+    }
+    memcpy(&p->buf[p->len], tmp, n);
+    p->len += n;
+    p->last_value = scaled;
+    return true;
+}
+
+bool mqtt_payload_add(mqtt_payload_t *p, uint32_t timestamp, float value)
+{
+    if (p->count == UINT16_MAX) {
+        return false;
+    }
+    bool added = p->format == MQTT_PAYLOAD_BINARY ? add_binary(p, timestamp, value)
+                                                  : add_text(p, timestamp, value);
+    if (!added) {
+        return false;
+    }
+    if (p->count++ == 0) {
+        p->first_ts = timestamp;
+    }
+    p->last_ts = timestamp;
+    return true;
+}
+
+size_t mqtt_payload_finish(mqtt_payload_t *p)
+{
+    if (p->format == MQTT_PAYLOAD_BINARY) {
+        p->buf[0] = MQTT_PAYLOAD_VERSION;
+        p->buf[1] = p->sensor_id;
+        put_le16(&p->buf[2], p->count);
+        put_le32(&p->buf[4], p->first_ts);
+    }
+    return p->len;
+}
+
+#ifndef ESP_PLATFORM
+// Decoder for host tools; the firmware only encodes
+
+static bool varint_get(mqtt_payload_iter_t *it, uint32_t *v)
+{
+    uint32_t result = 0;
+
+    for (int shift = 0; shift < 35 && it->pos < it->len; shift += 7) {
+        uint8_t byte = it->data[it->pos++];
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+esp_err_t mqtt_payload_iter_init(mqtt_payload_iter_t *it, const void *data, size_t len, uint8_t format)
+{
+    const uint8_t *d = data;
+
+    *it = (mqtt_payload_iter_t){
+        .data = d,
+        .len = len,
+        .format = format,
+    };
+    if (format != MQTT_PAYLOAD_BINARY) {
+        return ESP_OK;
+    }
+    if (len < MQTT_PAYLOAD_HEADER_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (d[0] != MQTT_PAYLOAD_VERSION) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    it->sensor_id = d[1];
+    it->remaining = d[2] | d[3] << 8;
+    it->ts = get_le32(&d[4]);
+    it->pos = MQTT_PAYLOAD_HEADER_SIZE;
+    return ESP_OK;
+}
+
+static esp_err_t next_text(mqtt_payload_iter_t *it, uint32_t *timestamp, float *value)
+{
+    char line[32];
+    size_t n = 0;
+
+    if (it->pos >= it->len) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    while (it->pos < it->len && it->data[it->pos] != '\n') {
+        if (n == sizeof(line) - 1) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        line[n++] = it->data[it->pos++];
+    }
+    it->pos++; // the separator
+    line[n] = '\0';
+
+    char *sep = strchr(line, ';');
+    if (sep == NULL) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *timestamp = strtoul(line, NULL, 10);
+    *value = strtof(sep + 1, NULL);
+    return ESP_OK;
+}
+
+static esp_err_t next_binary(mqtt_payload_iter_t *it, uint32_t *timestamp, float *value)
+{
+    uint32_t delta, zz;
+
+    if (it->remaining == 0) {
+        return it->pos == it->len ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_SIZE;
+    }
+    if (!varint_get(it, &delta) || !varint_get(it, &zz)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    it->remaining--;
+    it->ts += delta;
+    it->value += unzigzag(zz);
+    *timestamp = it->ts;
+    *value = (float)it->value / MQTT_PAYLOAD_VALUE_SCALE;
+    return ESP_OK;
+}
+
+esp_err_t mqtt_payload_iter_next(mqtt_payload_iter_t *it, uint32_t *timestamp, float *value)
+{
+    return it->format == MQTT_PAYLOAD_BINARY ? next_binary(it, timestamp, value)
+                                             : next_text(it, timestamp, value);
+}
+#endif
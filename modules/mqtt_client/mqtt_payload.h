@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Payload of a batched sensor message: samples of one sensor, oldest first.
+ *
+ * Text (MQTT_PAYLOAD_TEXT), published on <user>/<mac>/sensor/<sensor>:
+ *  one "timestamp;value" line per sample, value with 3 decimals, lines
+ *  separated by '\n' with none after the last.
+ *
+ * Binary (MQTT_PAYLOAD_BINARY), published on <user>/<mac>/bin. All integers
+ * are little-endian.
+ *
+ *  off  size  field
+ *  0    1     version     MQTT_PAYLOAD_VERSION
+ *  1    1     sensor id   storage_sensor_id_t
+ *  2    2     count       number of samples
+ *  4    4     base_ts     timestamp of the first sample
+ *
+ * Then per sample:
+ *  varint          timestamp delta to the previous sample (base_ts for
+ *                  the first)
+ *  zig-zag varint  value * MQTT_PAYLOAD_VALUE_SCALE, delta to the previous
+ *                  sample (to 0 for the first)
+ *
+ * Varints are LEB128, 7 bits per byte, low bits first. Both formats carry
+ * the value with the same precision, so a receiver gets the same numbers
+ * from either.
+ */
+
+#define MQTT_PAYLOAD_VERSION 1
+#define MQTT_PAYLOAD_HEADER_SIZE 8
+#define MQTT_PAYLOAD_VALUE_SCALE 1000
+
+typedef enum {
+    MQTT_PAYLOAD_TEXT = 0,
+    MQTT_PAYLOAD_BINARY = 1,
+} mqtt_payload_format_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    uint8_t format;
+    uint8_t sensor_id;
+    uint16_t count;
+    uint32_t first_ts;
+    uint32_t last_ts;
+    int32_t last_value;
+} mqtt_payload_t;
+
+void mqtt_payload_begin(mqtt_payload_t *p, uint8_t *buf, size_t cap, uint8_t format, uint8_t sensor_id);
+
+// Returns false, leaving the payload unchanged, when the sample does not fit
+bool mqtt_payload_add(mqtt_payload_t *p, uint32_t timestamp, float value);
+
+// Completes the header; returns the payload length
+size_t mqtt_payload_finish(mqtt_payload_t *p);
+
+#ifndef ESP_PLATFORM
+// Decoding is for host tools (tools/mqtt_payload_bench.c) only
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    uint8_t format;
+    uint8_t sensor_id; // binary payloads only
+    uint16_t remaining;
+    uint32_t ts;
+    int32_t value;
+} mqtt_payload_iter_t;
+
+esp_err_t mqtt_payload_iter_init(mqtt_payload_iter_t *it, const void *data, size_t len, uint8_t format);
+
+// ESP_ERR_NOT_FOUND after the last sample, ESP_ERR_INVALID_SIZE on a
+// truncated or malformed payload
+esp_err_t mqtt_payload_iter_next(mqtt_payload_iter_t *it, uint32_t *timestamp, float *value);
+#endif
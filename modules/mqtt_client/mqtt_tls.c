@@ -0,0 +1,307 @@
+// session_resumed() compares mbedtls_ssl_session fields mbedtls keeps private
+#define MBEDTLS_ALLOW_PRIVATE_ACCESS
+
+#include "mqtt_tls.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include "esp_attr.h"
+#include "esp_crt_bundle.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "project_config.h"
+
+static const char *TAG = "MQTT_TLS";
+
+typedef struct {
+    esp_tls_t *tls;
+} tls_transport_t;
+
+static mqtt_tls_stats_t s_stats;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+#include "mbedtls/ssl.h"
+
+// Only touched from the MQTT task, which connects
+static esp_tls_client_session_t *s_session;
+
+#if MQTT_TLS_SESSION_RTC
+#define RTC_SESSION_MAGIC 0x544c5331 // "TLS1"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t len;
+    uint32_t crc;
+    uint8_t data[MQTT_TLS_RTC_SESSION_MAX];
+} rtc_session_t;
+
+static RTC_NOINIT_ATTR rtc_session_t s_rtc_session;
+
+// esp_tls_client_session_t is an mbedtls_ssl_session and nothing else
+// (esp-tls keeps the definition private); mbedtls serialises that.
+static void rtc_session_save(const esp_tls_client_session_t *session)
+{
+    size_t len = 0;
+
+    s_rtc_session.magic = 0;
+    if (mbedtls_ssl_session_save((const mbedtls_ssl_session *)session, s_rtc_session.data,
+                                 sizeof(s_rtc_session.data), &len) != 0) {
+        ESP_LOGW(TAG, "TLS session does not fit in RTC memory (%zu bytes)", len);
+        return;
+    }
+    s_rtc_session.len = len;
+    s_rtc_session.crc = esp_rom_crc32_le(0, s_rtc_session.data, len);
+    s_rtc_session.magic = RTC_SESSION_MAGIC;
+}
+
+static esp_tls_client_session_t *rtc_session_load(void)
+{
+    if (s_rtc_session.magic != RTC_SESSION_MAGIC || s_rtc_session.len > sizeof(s_rtc_session.data) ||
+        esp_rom_crc32_le(0, s_rtc_session.data, s_rtc_session.len) != s_rtc_session.crc) {
+        return NULL;
+    }
+    mbedtls_ssl_session *session = calloc(1, sizeof(*session));
+    if (session == NULL) {
+        return NULL;
+    }
+    mbedtls_ssl_session_init(session);
+    if (mbedtls_ssl_session_load(session, s_rtc_session.data, s_rtc_session.len) != 0) {
+        mbedtls_ssl_session_free(session);
+        free(session);
+        s_rtc_session.magic = 0;
+        return NULL;
+    }
+    return (esp_tls_client_session_t *)session;
+}
+#endif
+
+// esp_tls_client_session_t is an mbedtls_ssl_session (see above). A TLS 1.2
+// resumption carries on with the master secret of the session it resumes,
+// a full handshake derives a new one. A TLS 1.3 resumption cannot be told
+// apart this way and counts as full.
+static bool session_resumed(const esp_tls_client_session_t *offered, const esp_tls_client_session_t *now)
+{
+#if defined(MBEDTLS_SSL_PROTO_TLS1_2)
+    const mbedtls_ssl_session *a = (const mbedtls_ssl_session *)offered;
+    const mbedtls_ssl_session *b = (const mbedtls_ssl_session *)now;
+
+    return a->tls_version == MBEDTLS_SSL_VERSION_TLS1_2 && b->tls_version == MBEDTLS_SSL_VERSION_TLS1_2 &&
+           memcmp(a->master, b->master, sizeof(a->master)) == 0;
+#else
+    return false;
+#endif
+}
+#endif
+
+static void stats_add(mqtt_tls_handshake_stats_t *s, bool ok, uint32_t ms, uint32_t heap)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    if (!ok) {
+        s->failures++;
+    } else {
+        s->handshakes++;
+        s->last_ms = ms;
+        s->total_ms += ms;
+        s->max_ms = ms > s->max_ms ? ms : s->max_ms;
+        s->heap_peak = heap > s->heap_peak ? heap : s->heap_peak;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+static int tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    esp_tls_cfg_t cfg = {
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .timeout_ms = timeout_ms,
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        .client_session = s_session,
+#endif
+    };
+    bool offered = false;
+    bool resumed = false;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    offered = s_session != NULL;
+#endif
+
+    ctx->tls = esp_tls_init();
+    if (ctx->tls == NULL) {
+        return -1;
+    }
+
+    // Heap the handshake takes: the local low-water mark while it runs
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    heap_caps_monitor_local_minimum_free_size_start();
+    int64_t start_us = esp_timer_get_time();
+    int ret = esp_tls_conn_new_sync(host, strlen(host), port, &cfg, ctx->tls);
+    uint32_t ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    size_t min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    heap_caps_monitor_local_minimum_free_size_stop();
+    uint32_t heap = free_before > min_free ? free_before - min_free : 0;
+
+    uint32_t stack_free = uxTaskGetStackHighWaterMark(NULL);
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.stack_free_min = stack_free;
+    portEXIT_CRITICAL(&s_stats_lock);
+    if (ret != 1) {
+        stats_add(&s_stats.full, false, ms, heap);
+        ESP_LOGW(TAG, "TLS connection to %s:%d failed after %lu ms", host, port, (unsigned long)ms);
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+        return -1;
+    }
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_tls_client_session_t *session = esp_tls_get_client_session(ctx->tls);
+    if (session != NULL) {
+        if (s_session != NULL) {
+            resumed = session_resumed(s_session, session);
+            esp_tls_free_client_session(s_session);
+        }
+        s_session = session;
+#if MQTT_TLS_SESSION_RTC
+        rtc_session_save(session);
+#endif
+        portENTER_CRITICAL(&s_stats_lock);
+        s_stats.session_cached = true;
+        s_stats.session_from_rtc = false;
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+#endif
+    stats_add(resumed ? &s_stats.resumed : &s_stats.full, true, ms, heap);
+    if (offered && !resumed) {
+        portENTER_CRITICAL(&s_stats_lock);
+        s_stats.sessions_refused++;
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+    ESP_LOGI(TAG, "TLS handshake with %s: %lu ms, %lu bytes of heap, %s", host, (unsigned long)ms,
+             (unsigned long)heap, resumed ? "resumed" : offered ? "full, session refused" : "full");
+    return 0;
+}
+
+// > 0 when ready, 0 on timeout, < 0 on a socket error
+static int tls_poll(esp_transport_handle_t t, int timeout_ms, bool write)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    fd_set set, errset;
+    int fd = -1;
+
+    if (ctx->tls == NULL || esp_tls_get_conn_sockfd(ctx->tls, &fd) != ESP_OK) {
+        return -1;
+    }
+    if (!write && esp_tls_get_bytes_avail(ctx->tls) > 0) {
+        return 1; // decrypted already, the socket may have nothing more
+    }
+    FD_ZERO(&set);
+    FD_ZERO(&errset);
+    FD_SET(fd, &set);
+    FD_SET(fd, &errset);
+    int ret = select(fd + 1, write ? NULL : &set, write ? &set : NULL, &errset, timeout_ms < 0 ? NULL : &tv);
+    if (ret > 0 && FD_ISSET(fd, &errset)) {
+        return -1;
+    }
+    return ret;
+}
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(t, timeout_ms, false);
+}
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(t, timeout_ms, true);
+}
+
+static int tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll(t, timeout_ms, false);
+
+    if (poll <= 0) {
+        return poll < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    ssize_t ret = esp_tls_conn_read(ctx->tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT; // only part of a record so far
+    }
+    if (ret == 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : ret;
+}
+
+static int tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll(t, timeout_ms, true);
+
+    if (poll <= 0) {
+        return poll;
+    }
+    ssize_t ret = esp_tls_conn_write(ctx->tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        return 0;
+    }
+    return ret < 0 ? -1 : ret;
+}
+
+static int tls_close(esp_transport_handle_t t)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+
+    if (ctx->tls != NULL) {
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+    }
+    return 0;
+}
+
+static int tls_destroy(esp_transport_handle_t t)
+{
+    tls_close(t);
+    free(esp_transport_get_context_data(t));
+    return 0;
+}
+
+esp_transport_handle_t mqtt_tls_transport_create(void)
+{
+    esp_transport_handle_t t = esp_transport_init();
+    tls_transport_t *ctx = calloc(1, sizeof(*ctx));
+
+    if (t == NULL || ctx == NULL) {
+        if (t != NULL) {
+            esp_transport_destroy(t);
+        }
+        free(ctx);
+        return NULL;
+    }
+#if defined(CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS) && MQTT_TLS_SESSION_RTC
+    if (s_session == NULL && (s_session = rtc_session_load()) != NULL) {
+        ESP_LOGI(TAG, "TLS session restored from RTC memory");
+        s_stats.session_cached = true;
+        s_stats.session_from_rtc = true;
+    }
+#elif !defined(CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS)
+    ESP_LOGW(TAG, "CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS is off, every connection does a full handshake");
+#endif
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write,
+                           tls_destroy);
+    esp_transport_set_context_data(t, ctx);
+    esp_transport_set_default_port(t, 8883);
+    return t;
+}
+
+void mqtt_tls_get_stats(mqtt_tls_stats_t *out)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *out = s_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
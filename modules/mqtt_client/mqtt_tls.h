@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_transport.h"
+
+/*
+ * TLS transport for mqtts:// brokers that resumes sessions.
+ *
+ * esp-mqtt's own SSL transport does a full handshake on every reconnect.
+ * This one connects through esp-tls and, with
+ * CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS, keeps the session of the last
+ * connection and offers it on the next one, so the broker can skip the
+ * certificate exchange and key agreement. With MQTT_TLS_SESSION_RTC the
+ * session is also copied to RTC memory and survives a restart (not a
+ * power cycle).
+ *
+ * The server certificate is checked against the certificate bundle; a
+ * private CA (e.g. of a local mosquitto) is added to it with
+ * CONFIG_MBEDTLS_CUSTOM_CERTIFICATE_BUNDLE_PATH. tools/mosquitto_tls.conf
+ * sets up a broker to measure against; the `mqtt` console command prints
+ * the figures below. They have not been measured yet, so what resumption
+ * saves over a full handshake is still unknown.
+ *
+ * The handshake runs on esp-mqtt's task (MQTT_CLIENT_STACK_SIZE), reads
+ * and writes on whichever task publishes.
+ */
+
+typedef struct {
+    uint32_t handshakes;
+    uint32_t failures;
+    uint32_t last_ms;
+    uint32_t max_ms;
+    uint64_t total_ms;
+    uint32_t heap_peak; // most heap a handshake took, bytes
+} mqtt_tls_handshake_stats_t;
+
+typedef struct {
+    mqtt_tls_handshake_stats_t full;    // includes failed handshakes and refused sessions
+    mqtt_tls_handshake_stats_t resumed; // the broker accepted the offered session
+    uint32_t sessions_refused;          // a session offered, yet a full handshake
+    bool session_cached;
+    bool session_from_rtc;              // the cached session came from before a restart
+    uint32_t stack_free_min;            // bytes of the connecting task's stack never used
+} mqtt_tls_stats_t;
+
+/**
+ * @brief Create the transport, for esp_mqtt_client_config_t.network.transport.
+ * esp-mqtt destroys it with the client.
+ */
+esp_transport_handle_t mqtt_tls_transport_create(void);
+
+void mqtt_tls_get_stats(mqtt_tls_stats_t *out);
@@ -5,12 +5,13 @@ void adxl345_task(void *arg)
 {
     while (1)
     {
-        float acceleration = adxl345_read_data();
-        if (acceleration != -1.0f)
+        int16_t axes[3];
+        if (adxl345_read_raw(axes) == ESP_OK)
         {
+            float acceleration = adxl345_raw_to_ms2(axes);
             *(float *)arg = acceleration;
             vTaskDelay(FREQUENT_MEASUREMENT_INTERVAL_MS);
-            save_sensor_to_storage("ADXL345", acceleration);
+            save_axes_to_storage(STORAGE_SENSOR_ADXL345, axes, acceleration);
         }
         else
         {
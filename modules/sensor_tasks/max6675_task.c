@@ -12,16 +12,17 @@ void max6675_task(void *arg)
 {
     while (1)
     {
-        float engine_temp = max6675_read_celsius();
-        if (engine_temp != -1.0f)
+        uint16_t code;
+        if (max6675_read_raw(&code) == ESP_OK)
         {
+            float engine_temp = max6675_raw_to_celsius(code);
             *(float *)arg = engine_temp;
             vTaskDelay(MAX6675_MEASUREMENT_INTERVAL_MS);
 
             char alert_msg[32];
             snprintf(alert_msg, sizeof(alert_msg), "%.1f", engine_temp);
             ble_send_alert("MAX6675", alert_msg);
-            save_sensor_to_storage("MAX6675_NORMAL", engine_temp);
+            save_raw_to_storage(STORAGE_SENSOR_MAX6675_NORMAL, code, engine_temp);
         }
         else
         {
@@ -56,16 +57,17 @@ void max6675_profile_task(void *arg)
 
   
 
-        float temp = max6675_read_celsius();
-        if (temp < 0)
+        uint16_t code;
+        if (max6675_read_raw(&code) != ESP_OK)
         {
             vTaskDelay(pdMS_TO_TICKS(500));
             continue;
         }
 
+        float temp = max6675_raw_to_celsius(code);
         *shared_temp = temp;
 
-        save_sensor_to_storage("MAX6675_PROFILE", temp);
+        save_raw_to_storage(STORAGE_SENSOR_MAX6675_PROFILE, code, temp);
         ble_notify_max6675_profile(temp);
 
 
@@ -230,20 +230,34 @@ static float calculate_acceleration(float x, float y, float z)
     return norm;
 }
 
-float adxl345_read_data()
+float adxl345_raw_to_ms2(const int16_t axes[3])
+{
+    float x, y, z;
+    convert_raw_data_to_ms2(axes[0], axes[1], axes[2], &x, &y, &z);
+
+    return calculate_acceleration(x, y, z) - 9.81f;
+}
+
+esp_err_t adxl345_read_raw(int16_t axes[3])
 {
     uint8_t raw[6];
     esp_err_t err = read_register_adxl345(REG_DATAX0, raw, 6);
 
     if (err != ESP_OK)
-        return -1.0f;
+        return err;
 
-    int16_t rx = (int16_t)(raw[1] << 8 | raw[0]);
-    int16_t ry = (int16_t)(raw[3] << 8 | raw[2]);
-    int16_t rz = (int16_t)(raw[5] << 8 | raw[4]);
+    axes[0] = (int16_t)(raw[1] << 8 | raw[0]);
+    axes[1] = (int16_t)(raw[3] << 8 | raw[2]);
+    axes[2] = (int16_t)(raw[5] << 8 | raw[4]);
+    return ESP_OK;
+}
 
-    float x, y, z;
-    convert_raw_data_to_ms2(rx, ry, rz, &x, &y, &z);
+float adxl345_read_data()
+{
+    int16_t axes[3];
 
-    return calculate_acceleration(x, y, z) - 9.81f;
+    if (adxl345_read_raw(axes) != ESP_OK)
+        return -1.0f;
+
+    return adxl345_raw_to_ms2(axes);
 }
\ No newline at end of file
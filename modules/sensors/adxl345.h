@@ -66,4 +66,8 @@ esp_err_t adxl345_set_frequency_in_sleep_mode(uint8_t frequency);
 esp_err_t adxl345_enable_auto_sleep(bool enable);
 esp_err_t adxl345_enable_all_axis_activity_detection();
 
-float adxl345_read_data();
\ No newline at end of file
+float adxl345_read_data();
+
+// Raw X, Y, Z codes and their calibrated magnitude, as adxl345_read_data() returns it
+esp_err_t adxl345_read_raw(int16_t axes[3]);
+float adxl345_raw_to_ms2(const int16_t axes[3]);
\ No newline at end of file
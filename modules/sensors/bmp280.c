@@ -269,6 +269,13 @@ esp_err_t bmp280_change_standby_time(uint8_t time)
     return ESP_OK;
 }
 
+void bmp280_get_temp_trimming(uint16_t *t1, int16_t *t2, int16_t *t3)
+{
+    *t1 = cal_data.dig_T1;
+    *t2 = cal_data.dig_T2;
+    *t3 = cal_data.dig_T3;
+}
+
 static float convert_temperature(int32_t raw_temp)
 {
     int32_t var1, var2;
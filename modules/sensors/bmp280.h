@@ -76,6 +76,10 @@ esp_err_t bmp280_trigger_normal_mode();
  * @return **double**  - Temperature in Celsius
  */
 float bmp280_read_temp();
+/**
+ * @brief Temperature trimming parameters (dig_T1..dig_T3) read by bmp280_configure()
+ */
+void bmp280_get_temp_trimming(uint16_t *t1, int16_t *t2, int16_t *t3);
 /**
  * @brief Take one measurement of pressure in hPa
  *
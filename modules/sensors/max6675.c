@@ -43,13 +43,12 @@ static bool check_open_thermocouple(uint16_t value)
     }
 }
 
-static float convert_raw_data(uint16_t value)
+float max6675_raw_to_celsius(uint16_t code)
 {
-    value >>= 3;
-    return value * 0.25f;
+    return code * 0.25f;
 }
 
-float max6675_read_celsius()
+esp_err_t max6675_read_raw(uint16_t *code)
 {
     uint8_t raw_data[2] = {0};
 
@@ -70,15 +69,28 @@ float max6675_read_celsius()
     if (err != ESP_OK)
     {
         ESP_LOGW(TAG, "SPI transmit error: %s", esp_err_to_name(err));
-        return -1.0f;
+        return err;
     }
 
     uint16_t value = (t.rx_data[0] << 8) | t.rx_data[1];
 
     if (check_open_thermocouple(value))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    *code = value >> 3;
+    return ESP_OK;
+}
+
+float max6675_read_celsius()
+{
+    uint16_t code;
+
+    if (max6675_read_raw(&code) != ESP_OK)
     {
         return -1.0f;
     }
 
-    return convert_raw_data(value);
+    return max6675_raw_to_celsius(code);
 }
\ No newline at end of file
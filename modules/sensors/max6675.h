@@ -33,14 +33,22 @@ esp_err_t max6675_delete();
 static bool check_open_thermocouple(uint16_t value);
 
 /**
- * @brief Convert raw data to Celsius.
- * 1) The temperature bits are in D14..D3, so shift right by 3 to remove status bits.
- * 2) Multiply by 0.25 to convert to degrees Celsius (Each unit represents 0.25°C according to the MAX6675 datasheet).
+ * @brief Convert a temperature code to Celsius.
+ * Each unit represents 0.25°C according to the MAX6675 datasheet.
  *
- * @param value Raw data value
+ * @param code 12-bit temperature code from max6675_read_raw()
  * @return float Temperature in Celsius
  */
-static float convert_raw_data(uint16_t value);
+float max6675_raw_to_celsius(uint16_t code);
+
+/**
+ * @brief Read the 12-bit temperature code.
+ * The temperature bits are in D14..D3 of the 16-bit frame, the status bits are dropped.
+ *
+ * @param code Pointer to store the code
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if the thermocouple is open
+ */
+esp_err_t max6675_read_raw(uint16_t *code);
 
 /**
  * @brief Read temperature in Celsius
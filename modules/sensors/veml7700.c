@@ -44,7 +44,7 @@ esp_err_t veml7700_delete()
 
 void veml7700_wake_up()
 {
-    uint8_t write_buf[3] = {0x00, 0x00, 0x00};
+    uint8_t write_buf[3] = {CMD_ALS_CONF, CONF_DEFAULT & 0xFF, CONF_DEFAULT >> 8};
 
     ESP_ERROR_CHECK(i2c_master_transmit(veml7700_handle, write_buf, sizeof(write_buf), -1));
 
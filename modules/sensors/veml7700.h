@@ -12,6 +12,7 @@
 #define CONF_GAIN_1_8 (0x02 << 11)
 #define CONF_IT_100MS (0x00 << 6)
 #define CONF_SHUTDOWN (0x01)
+#define CONF_DEFAULT (0x0000) // gain x1, 100 ms, powered on; set by veml7700_wake_up()
 
 #define LUX_RESOLUTION 0.576f
 
@@ -0,0 +1,672 @@
+#include "storage_manager.h"
+#include "storage_internal.h"
+#include "project_config.h"
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_vfs_fat.h"
+#include "diskio_sdmmc.h"
+#include "ff.h"
+#include "driver/gpio.h"
+#include "driver/sdspi_host.h"
+#include "sdmmc_cmd.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "spi_bus_mutex.h"
+
+/*
+ * Cold tier on the SD card. Samples always land in the flash log; this task
+ * copies every sealed raw segment, byte for byte, into files on the card:
+ *
+ *   /sdcard/slog/XXXXXXXX.SLG   segments [X * FILE_SEGMENTS, (X + 1) * FILE_SEGMENTS)
+ *
+ * Segment `seq` sits at (seq % FILE_SEGMENTS) * STORAGE_SEGMENT_SIZE in its
+ * file, so a copy interrupted by a reset is simply redone, and the files
+ * decode with tools/storage_decode.py (which checks each segment header,
+ * the unwritten rest of a preallocated file holds whatever the card had).
+ *
+ * FAT on SPI is slow at small appends: every partial sector is a
+ * read-modify-write and every growing write updates the FAT. So each
+ * archive file is preallocated as one contiguous run (f_expand) when it is
+ * created, and written only in whole, sector aligned chunks through FatFs
+ * directly, which then go to the card without touching its sector cache.
+ * Chunks come from two DMA capable ping-pong buffers: the io task writes
+ * one to the card while this task fills the other from flash.
+ *
+ * The card shares SPI3 with the MAX6675, so the bus is never held for more
+ * than one STORAGE_ARCHIVE_CHUNK_SIZE write (or a FAT open/sync), and a
+ * chunk is only started while the writer queue is empty. The storage lock
+ * and the bus mutex are never held together.
+ */
+
+static const char *TAG = "STORAGE_ARCHIVE";
+
+#define NVS_NAMESPACE "storage_mgr"
+#define NVS_ARCHIVE_SEQ_KEY "archive_seq"
+
+#define ARCHIVE_DIR STORAGE_ARCHIVE_MOUNT "/slog"
+#define ARCHIVE_FILE_BYTES ((FSIZE_t)STORAGE_ARCHIVE_FILE_SEGMENTS * STORAGE_SEGMENT_SIZE)
+// How long to back off while the writer has samples queued
+#define ARCHIVE_IDLE_POLL_MS 20
+#define ARCHIVE_BUFFERS 2
+#define SD_SECTOR_SIZE 512
+
+_Static_assert(STORAGE_SEGMENT_SIZE % STORAGE_ARCHIVE_CHUNK_SIZE == 0, "chunks must tile a segment");
+_Static_assert(STORAGE_ARCHIVE_CHUNK_SIZE % SD_SECTOR_SIZE == 0, "chunks must be whole sectors");
+
+// A ping-pong buffer on its way to the io task and back
+typedef struct {
+    uint8_t buf;
+    FIL *file;
+    FSIZE_t off;
+    esp_err_t err; // result of the write, on the way back
+} archive_job_t;
+
+// Fills a buffer with `len` bytes for file offset `off`
+typedef esp_err_t (*archive_fill_t)(uint8_t *buf, size_t len, FSIZE_t off, void *ctx);
+
+static TaskHandle_t s_task = NULL;
+static TaskHandle_t s_io_task = NULL;
+static QueueHandle_t s_write_q = NULL; // filled buffers, to the io task
+static QueueHandle_t s_free_q = NULL;  // written buffers, back with the result
+static uint8_t *s_buf[ARCHIVE_BUFFERS];
+// Held by whoever uses the card (archive task or the benchmark)
+static SemaphoreHandle_t s_card_mutex = NULL;
+static sdmmc_card_t *s_card = NULL;
+static char s_drive[4];               // FatFs drive of the card, e.g. "0:"
+static FIL s_file;
+static int32_t s_file_index = -1;     // archive file open in s_file
+static int64_t s_retry_at_us = 0;
+
+// Oldest raw segment not copied yet; guarded by the storage lock
+static uint32_t s_next_seq;
+
+static storage_archive_stats_t s_stats = { .state = STORAGE_ARCHIVE_DISABLED };
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void set_state(storage_archive_state_t state)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.state = state;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+static int64_t bus_take(void)
+{
+    spi_bus_mutex_lock();
+    return esp_timer_get_time();
+}
+
+static uint32_t bus_give(int64_t since)
+{
+    uint32_t held = (uint32_t)(esp_timer_get_time() - since);
+    spi_bus_mutex_unlock();
+    return held;
+}
+
+static void count_hold(uint32_t held_us)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.bus_holds++;
+    s_stats.total_hold_us += held_us;
+    if (held_us > s_stats.max_hold_us) {
+        s_stats.max_hold_us = held_us;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+static void next_seq_persist(uint32_t seq)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_u32(handle, NVS_ARCHIVE_SEQ_KEY, seq);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to persist archive position (%s)", esp_err_to_name(err));
+    }
+}
+
+void storage_archive_restore(void)
+{
+    storage_log_t *log = storage_main_log();
+    nvs_handle_t handle;
+    uint32_t seq = 0;
+
+    s_next_seq = log->tail_seq;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = nvs_get_u32(handle, NVS_ARCHIVE_SEQ_KEY, &seq);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return;
+    }
+
+    if (seq > log->head_seq) {
+        // Left over from a log that has since been reformatted
+        ESP_LOGW(TAG, "Stored archive position %lu is past the head, starting at %lu",
+                 (unsigned long)seq, (unsigned long)s_next_seq);
+        return;
+    }
+    s_next_seq = seq;
+    ESP_LOGI(TAG, "Archive resumes at segment %lu", (unsigned long)s_next_seq);
+}
+
+void storage_archive_skip(uint32_t seq)
+{
+    if (seq > s_next_seq) {
+        s_next_seq = seq;
+    }
+}
+
+static void archive_close(void)
+{
+    if (s_file_index < 0) {
+        return;
+    }
+    int64_t since = bus_take();
+    f_close(&s_file);
+    count_hold(bus_give(since));
+    s_file_index = -1;
+}
+
+static esp_err_t try_mount(uint32_t freq_khz)
+{
+    // The driver talks to the card at 400 kHz until it is initialized and
+    // only then switches to max_freq_khz
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    host.slot = SPI_HOST_USED;
+    host.max_freq_khz = freq_khz;
+
+    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
+    slot_config.gpio_cs = CS_SD_CARD_PIN;
+    slot_config.host_id = SPI_HOST_USED;
+
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+        .format_if_mount_failed = false,
+        .max_files = 2,
+        .allocation_unit_size = 16 * 1024,
+    };
+
+    int64_t since = bus_take();
+    esp_err_t err = esp_vfs_fat_sdspi_mount(STORAGE_ARCHIVE_MOUNT, &host, &slot_config, &mount_config, &s_card);
+    if (err == ESP_OK) {
+        snprintf(s_drive, sizeof(s_drive), "%u:", ff_diskio_get_pdrv_card(s_card));
+        char dir[16];
+        snprintf(dir, sizeof(dir), "%s/slog", s_drive);
+        FRESULT res = f_mkdir(dir);
+        if (res != FR_OK && res != FR_EXIST) {
+            ESP_LOGE(TAG, "Cannot create %s (FatFs %d)", ARCHIVE_DIR, res);
+            esp_vfs_fat_sdcard_unmount(STORAGE_ARCHIVE_MOUNT, s_card);
+            err = ESP_FAIL;
+        }
+    }
+    uint32_t held = bus_give(since);
+
+    if (err != ESP_OK) {
+        s_card = NULL;
+    }
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.mount_us = held;
+    s_stats.freq_khz = s_card ? s_card->max_freq_khz : 0;
+    s_stats.card_bytes = s_card ? (uint64_t)s_card->csd.capacity * s_card->csd.sector_size : 0;
+    portEXIT_CRITICAL(&s_stats_lock);
+    return err;
+}
+
+static esp_err_t archive_mount(void)
+{
+    esp_err_t err = try_mount(STORAGE_ARCHIVE_SD_FREQ_KHZ);
+    if (err != ESP_OK && err != ESP_ERR_TIMEOUT && STORAGE_ARCHIVE_SD_FREQ_KHZ > STORAGE_ARCHIVE_SD_SAFE_FREQ_KHZ) {
+        // A card answered but the link did not hold up at full speed
+        ESP_LOGW(TAG, "SD card failed at %d kHz (%s), retrying at %d kHz", STORAGE_ARCHIVE_SD_FREQ_KHZ,
+                 esp_err_to_name(err), STORAGE_ARCHIVE_SD_SAFE_FREQ_KHZ);
+        err = try_mount(STORAGE_ARCHIVE_SD_SAFE_FREQ_KHZ);
+    }
+    return err;
+}
+
+static void archive_unmount(void)
+{
+    if (s_card == NULL) {
+        return;
+    }
+    archive_close();
+    int64_t since = bus_take();
+    esp_vfs_fat_sdcard_unmount(STORAGE_ARCHIVE_MOUNT, s_card);
+    bus_give(since);
+    s_card = NULL;
+}
+
+// Open (creating and preallocating) the archive file holding segment seq
+static esp_err_t archive_open(uint32_t file_index)
+{
+    if (s_file_index == (int32_t)file_index) {
+        return ESP_OK;
+    }
+    archive_close();
+
+    char path[32];
+    snprintf(path, sizeof(path), "%s/slog/%08lX.SLG", s_drive, (unsigned long)file_index);
+
+    int64_t since = bus_take();
+    FRESULT res = f_open(&s_file, path, FA_WRITE | FA_OPEN_ALWAYS);
+    FRESULT expand = FR_OK;
+    if (res == FR_OK && f_size(&s_file) == 0) {
+        // One contiguous cluster run: no FAT updates while the file fills
+        expand = f_expand(&s_file, ARCHIVE_FILE_BYTES, 1);
+    }
+    count_hold(bus_give(since));
+
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Cannot open %s (FatFs %d)", path, res);
+        return ESP_FAIL;
+    }
+    if (expand != FR_OK) {
+        // Not enough contiguous space; the file grows chunk by chunk instead
+        ESP_LOGW(TAG, "Cannot preallocate %s (FatFs %d)", path, expand);
+        portENTER_CRITICAL(&s_stats_lock);
+        s_stats.prealloc_failed++;
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+    s_file_index = file_index;
+    return ESP_OK;
+}
+
+static void io_write(archive_job_t *job)
+{
+    UINT written = 0;
+
+    int64_t since = bus_take();
+    FRESULT res = f_lseek(job->file, job->off);
+    if (res == FR_OK) {
+        res = f_write(job->file, s_buf[job->buf], STORAGE_ARCHIVE_CHUNK_SIZE, &written);
+    }
+    count_hold(bus_give(since));
+
+    job->err = res == FR_OK && written == STORAGE_ARCHIVE_CHUNK_SIZE ? ESP_OK : ESP_FAIL;
+    if (job->err != ESP_OK) {
+        ESP_LOGE(TAG, "Write at %lu failed (FatFs %d)", (unsigned long)job->off, res);
+    }
+}
+
+static void storage_archive_io_task(void *arg)
+{
+    archive_job_t job;
+
+    while (1) {
+        if (xQueueReceive(s_write_q, &job, portMAX_DELAY) == pdTRUE) {
+            io_write(&job);
+            xQueueSend(s_free_q, &job, portMAX_DELAY);
+        }
+    }
+}
+
+/**
+ * Write [off, off + len) of a file in chunks through the ping-pong buffers.
+ * Each buffer is filled (fill) while the other one is being written.
+ */
+static esp_err_t pipeline_write(FIL *file, FSIZE_t off, uint32_t len, archive_fill_t fill, void *ctx)
+{
+    archive_job_t jobs[ARCHIVE_BUFFERS], job;
+    esp_err_t err = ESP_OK;
+
+    for (uint32_t pos = 0; pos < len && err == ESP_OK; pos += STORAGE_ARCHIVE_CHUNK_SIZE) {
+        xQueueReceive(s_free_q, &job, portMAX_DELAY);
+        err = job.err;
+        if (err == ESP_OK) {
+            err = fill(s_buf[job.buf], STORAGE_ARCHIVE_CHUNK_SIZE, off + pos, ctx);
+        }
+        if (err != ESP_OK) {
+            job.err = ESP_OK;
+            xQueueSend(s_free_q, &job, portMAX_DELAY);
+            break;
+        }
+        job.file = file;
+        job.off = off + pos;
+        xQueueSend(s_write_q, &job, portMAX_DELAY);
+    }
+
+    // Wait for both buffers, the last write may still fail
+    for (int i = 0; i < ARCHIVE_BUFFERS; i++) {
+        xQueueReceive(s_free_q, &jobs[i], portMAX_DELAY);
+        if (err == ESP_OK) {
+            err = jobs[i].err;
+        }
+        jobs[i].err = ESP_OK;
+    }
+    for (int i = 0; i < ARCHIVE_BUFFERS; i++) {
+        xQueueSend(s_free_q, &jobs[i], portMAX_DELAY);
+    }
+    return err;
+}
+
+static void wait_idle(void)
+{
+    while (!storage_writer_idle()) {
+        vTaskDelay(pdMS_TO_TICKS(ARCHIVE_IDLE_POLL_MS));
+    }
+}
+
+// Fill a buffer from segment *ctx; ESP_ERR_NOT_FOUND once the log reused it
+static esp_err_t fill_from_segment(uint8_t *buf, size_t len, FSIZE_t off, void *ctx)
+{
+    uint32_t seq = *(const uint32_t *)ctx;
+    uint32_t seg_off = off % STORAGE_SEGMENT_SIZE;
+    esp_err_t err;
+
+    wait_idle();
+    storage_log_t *log = storage_main_log();
+    if (!storage_log_segment_readable(log, seq)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    storage_read_begin(log);
+    err = storage_backend_read(log->backend, storage_log_segment_offset(log, seq) + seg_off, buf, len);
+    storage_read_end(log);
+    // The writer may have moved on to erasing this slot while we read
+    if (err == ESP_OK && !storage_log_segment_readable(log, seq)) {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    return err;
+}
+
+// Copy one sealed segment; ESP_ERR_NOT_FOUND if the log reused it meanwhile
+static esp_err_t archive_segment(uint32_t seq)
+{
+    esp_err_t err = archive_open(seq / STORAGE_ARCHIVE_FILE_SEGMENTS);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    FSIZE_t file_off = (FSIZE_t)(seq % STORAGE_ARCHIVE_FILE_SEGMENTS) * STORAGE_SEGMENT_SIZE;
+    err = pipeline_write(&s_file, file_off, STORAGE_SEGMENT_SIZE, fill_from_segment, &seq);
+
+    int64_t since = bus_take();
+    if (f_sync(&s_file) != FR_OK && err == ESP_OK) {
+        err = ESP_FAIL;
+    }
+    count_hold(bus_give(since));
+    return err;
+}
+
+// Copy every sealed segment the card does not have yet
+static void archive_pending(void)
+{
+    while (1) {
+        storage_lock();
+        storage_log_t *log = storage_main_log();
+        uint32_t oldest = storage_log_oldest_readable(log);
+        uint32_t missed = 0;
+        if (s_next_seq < oldest) {
+            missed = oldest - s_next_seq;
+            s_next_seq = oldest;
+        }
+        uint32_t seq = s_next_seq;
+        bool sealed = seq < log->head_seq;
+        storage_unlock();
+
+        if (missed > 0) {
+            ESP_LOGW(TAG, "%lu segments were reused before they reached the card", (unsigned long)missed);
+            portENTER_CRITICAL(&s_stats_lock);
+            s_stats.missed += missed;
+            portEXIT_CRITICAL(&s_stats_lock);
+        }
+        if (!sealed) {
+            set_state(STORAGE_ARCHIVE_IDLE);
+            return;
+        }
+
+        set_state(STORAGE_ARCHIVE_COPYING);
+        esp_err_t err = archive_segment(seq);
+        if (err == ESP_ERR_NOT_FOUND) {
+            continue; // counted as missed on the next pass
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Card error, unmounting; segments stay in flash");
+            archive_unmount();
+            portENTER_CRITICAL(&s_stats_lock);
+            s_stats.errors++;
+            s_stats.state = STORAGE_ARCHIVE_NO_CARD;
+            portEXIT_CRITICAL(&s_stats_lock);
+            s_retry_at_us = esp_timer_get_time() + (int64_t)STORAGE_ARCHIVE_RETRY_MS * 1000;
+            return;
+        }
+
+        storage_lock();
+        if (s_next_seq == seq) {
+            s_next_seq = seq + 1;
+        }
+        uint32_t next = s_next_seq;
+        storage_unlock();
+        next_seq_persist(next);
+
+        portENTER_CRITICAL(&s_stats_lock);
+        s_stats.segments++;
+        s_stats.bytes += STORAGE_SEGMENT_SIZE;
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+}
+
+static void storage_archive_task(void *arg)
+{
+    while (1) {
+        xSemaphoreTake(s_card_mutex, portMAX_DELAY);
+        if (s_card == NULL && esp_timer_get_time() >= s_retry_at_us) {
+            if (archive_mount() == ESP_OK) {
+                ESP_LOGI(TAG, "SD card mounted, archiving to %s", ARCHIVE_DIR);
+            } else {
+                ESP_LOGW(TAG, "No SD card, retrying in %d s", STORAGE_ARCHIVE_RETRY_MS / 1000);
+                set_state(STORAGE_ARCHIVE_NO_CARD);
+                s_retry_at_us = esp_timer_get_time() + (int64_t)STORAGE_ARCHIVE_RETRY_MS * 1000;
+            }
+        }
+        if (s_card != NULL) {
+            archive_pending();
+        }
+        xSemaphoreGive(s_card_mutex);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STORAGE_ARCHIVE_INTERVAL_MS));
+    }
+}
+
+void storage_archive_start(void)
+{
+#if STORAGE_ARCHIVE_ENABLED
+    if (s_task != NULL) {
+        return;
+    }
+
+    // Keep the card deselected while it is not mounted, it shares the bus
+    gpio_set_pull_mode(SPI_MISO_PIN, GPIO_PULLUP_ONLY);
+    gpio_set_pull_mode(CS_SD_CARD_PIN, GPIO_PULLUP_ONLY);
+    gpio_set_direction(CS_SD_CARD_PIN, GPIO_MODE_OUTPUT);
+    gpio_set_level(CS_SD_CARD_PIN, 1);
+
+    s_card_mutex = xSemaphoreCreateMutex();
+    s_write_q = xQueueCreate(ARCHIVE_BUFFERS, sizeof(archive_job_t));
+    s_free_q = xQueueCreate(ARCHIVE_BUFFERS, sizeof(archive_job_t));
+    for (int i = 0; i < ARCHIVE_BUFFERS; i++) {
+        s_buf[i] = heap_caps_malloc(STORAGE_ARCHIVE_CHUNK_SIZE, MALLOC_CAP_DMA);
+    }
+    if (s_card_mutex == NULL || s_write_q == NULL || s_free_q == NULL || s_buf[0] == NULL || s_buf[1] == NULL) {
+        ESP_LOGE(TAG, "No memory for the SD archive, staying flash only");
+        return;
+    }
+    for (int i = 0; i < ARCHIVE_BUFFERS; i++) {
+        archive_job_t job = { .buf = i, .err = ESP_OK };
+        xQueueSend(s_free_q, &job, 0);
+    }
+
+    set_state(STORAGE_ARCHIVE_NO_CARD);
+    // Below the writer and the sensor tasks, it only runs when they are idle
+    xTaskCreate(storage_archive_io_task, "storage_sd_io", 3072, NULL, 2, &s_io_task);
+    xTaskCreate(storage_archive_task, "storage_archive", 4096, NULL, 2, &s_task);
+#endif
+}
+
+// --- `bench sd`: old per-line appends against the archive's chunked writes ---
+
+#define BENCH_SD_LINES 200
+#define BENCH_SD_BYTES (256 * 1024)
+
+typedef struct {
+    uint32_t bytes;
+    uint32_t writes;
+    uint32_t us;
+} bench_sd_result_t;
+
+static esp_err_t fill_pattern(uint8_t *buf, size_t len, FSIZE_t off, void *ctx)
+{
+    memset(buf, (uint8_t)(off / len), len);
+    return ESP_OK;
+}
+
+// What storage_write_line() used to do: check free space, open for append,
+// write one line, close
+static esp_err_t bench_sd_lines(const char *path, bench_sd_result_t *res)
+{
+    char line[48];
+    FATFS *fs;
+    DWORD free_clusters;
+    FIL file;
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCH_SD_LINES; i++) {
+        int n = snprintf(line, sizeof(line), "ADXL345;%lu;%.3f\n", (unsigned long)(1700000000 + i), 0.01f * i);
+        UINT written = 0;
+
+        int64_t since = bus_take();
+        FRESULT fr = f_getfree(s_drive, &free_clusters, &fs);
+        if (fr == FR_OK) {
+            fr = f_open(&file, path, FA_WRITE | FA_OPEN_APPEND);
+        }
+        if (fr == FR_OK) {
+            fr = f_write(&file, line, n, &written);
+            FRESULT closed = f_close(&file);
+            if (fr == FR_OK) {
+                fr = closed;
+            }
+        }
+        bus_give(since);
+        if (fr != FR_OK || written != (UINT)n) {
+            return ESP_FAIL;
+        }
+        res->bytes += n;
+        res->writes++;
+    }
+    res->us = (uint32_t)(esp_timer_get_time() - start);
+    return ESP_OK;
+}
+
+static esp_err_t bench_sd_chunks(const char *path, bool prealloc, bench_sd_result_t *res)
+{
+    FIL file;
+
+    int64_t start = esp_timer_get_time();
+    int64_t since = bus_take();
+    FRESULT fr = f_open(&file, path, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr == FR_OK && prealloc) {
+        fr = f_expand(&file, BENCH_SD_BYTES, 1);
+    }
+    bus_give(since);
+    if (fr != FR_OK) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = pipeline_write(&file, 0, BENCH_SD_BYTES, fill_pattern, NULL);
+
+    since = bus_take();
+    if (f_close(&file) != FR_OK && err == ESP_OK) {
+        err = ESP_FAIL;
+    }
+    bus_give(since);
+
+    res->bytes = BENCH_SD_BYTES;
+    res->writes = BENCH_SD_BYTES / STORAGE_ARCHIVE_CHUNK_SIZE;
+    res->us = (uint32_t)(esp_timer_get_time() - start);
+    return err;
+}
+
+static void bench_sd_print(const char *name, esp_err_t err, const bench_sd_result_t *res)
+{
+    if (err != ESP_OK) {
+        printf("  %-22s failed\n", name);
+        return;
+    }
+    printf("  %-22s %7lu B  %8.1f KB/s  %5lu writes  %7lu us/write\n", name, (unsigned long)res->bytes,
+           res->us ? res->bytes / 1024.0 / (res->us / 1e6) : 0.0, (unsigned long)res->writes,
+           (unsigned long)(res->writes ? res->us / res->writes : 0));
+}
+
+void storage_bench_sd(void)
+{
+    if (s_card_mutex == NULL) {
+        ESP_LOGE(TAG, "SD archive is disabled");
+        return;
+    }
+    xSemaphoreTake(s_card_mutex, portMAX_DELAY);
+    if (s_card == NULL) {
+        xSemaphoreGive(s_card_mutex);
+        ESP_LOGE(TAG, "No SD card mounted");
+        return;
+    }
+
+    char path[32];
+    snprintf(path, sizeof(path), "%s/slog/BENCH.TMP", s_drive);
+    printf("SD write benchmark at %lu kHz, %d byte chunks:\n", (unsigned long)s_card->max_freq_khz,
+           STORAGE_ARCHIVE_CHUNK_SIZE);
+
+    static const struct {
+        const char *name;
+        int strategy; // 0 lines, 1 chunks, 2 preallocated chunks
+    } runs[] = {
+        { "line append + getfree", 0 },
+        { "chunks", 1 },
+        { "chunks, preallocated", 2 },
+    };
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        bench_sd_result_t res = { 0 };
+        esp_err_t err = runs[i].strategy == 0 ? bench_sd_lines(path, &res)
+                                              : bench_sd_chunks(path, runs[i].strategy == 2, &res);
+        bench_sd_print(runs[i].name, err, &res);
+
+        int64_t since = bus_take();
+        f_unlink(path);
+        bus_give(since);
+    }
+    xSemaphoreGive(s_card_mutex);
+}
+
+void storage_archive_request(void)
+{
+    if (s_task != NULL) {
+        s_retry_at_us = 0;
+        xTaskNotifyGive(s_task);
+    }
+}
+
+void storage_get_archive_stats(storage_archive_stats_t *out)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *out = s_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    if (out->state == STORAGE_ARCHIVE_DISABLED) {
+        return;
+    }
+    storage_lock();
+    storage_log_t *log = storage_main_log();
+    out->next_seq = s_next_seq;
+    out->pending = log->head_seq > s_next_seq ? log->head_seq - s_next_seq : 0;
+    storage_unlock();
+}
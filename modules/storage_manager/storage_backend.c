@@ -0,0 +1,83 @@
+#include "storage_backend.h"
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "STORAGE_BACKEND";
+
+esp_err_t storage_backend_open(storage_backend_t *be, int type, const char *label, const char *path, uint32_t size)
+{
+    memset(be, 0, sizeof(*be));
+    be->label = label;
+    be->path = path;
+    be->stats.size = size;
+
+    switch (type) {
+    case STORAGE_BACKEND_RAW:
+        be->ops = &storage_backend_raw_ops;
+        break;
+    case STORAGE_BACKEND_SPIFFS:
+        be->ops = &storage_backend_spiffs_ops;
+        break;
+    case STORAGE_BACKEND_LITTLEFS:
+        be->ops = &storage_backend_littlefs_ops;
+        break;
+    case STORAGE_BACKEND_FILE:
+        be->ops = &storage_backend_file_ops;
+        break;
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = be->ops->mount(be);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Mounting %s on %s failed (%s)", be->ops->name, path ? path : label, esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Backend %s on %s, %lu bytes", be->ops->name, path ? path : label, (unsigned long)be->stats.size);
+    return ESP_OK;
+}
+
+void storage_backend_close(storage_backend_t *be)
+{
+    if (be->ops != NULL && be->ops->unmount != NULL) {
+        be->ops->unmount(be);
+    }
+    be->ops = NULL;
+}
+
+// --- raw partition ---
+
+static esp_err_t raw_mount(storage_backend_t *be)
+{
+    be->part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, be->label);
+    if (be->part == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    be->stats.size = be->part->size;
+    return ESP_OK;
+}
+
+static esp_err_t raw_append(storage_backend_t *be, uint32_t off, const void *data, size_t len)
+{
+    be->stats.programmed += len;
+    return esp_partition_write(be->part, off, data, len);
+}
+
+static esp_err_t raw_read_at(storage_backend_t *be, uint32_t off, void *buf, size_t len)
+{
+    return esp_partition_read(be->part, off, buf, len);
+}
+
+static esp_err_t raw_truncate(storage_backend_t *be, uint32_t off, size_t len)
+{
+    return esp_partition_erase_range(be->part, off, len);
+}
+
+const storage_backend_ops_t storage_backend_raw_ops = {
+    .name = "raw",
+    .shared_reads = true, // the flash driver serializes operations itself
+    .mount = raw_mount,
+    .append = raw_append,
+    .read_at = raw_read_at,
+    .truncate = raw_truncate,
+};
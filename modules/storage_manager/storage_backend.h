@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/*
+ * Medium the segment log lives on. The log addresses it as a flat byte
+ * range of `size` bytes with NOR flash rules: truncate() returns a range to
+ * the erased state (all 0xFF), append() programs bytes inside an erased
+ * range, and the log never appends to the same bytes twice.
+ *
+ *  raw       The storage partition itself through esp_partition; truncate
+ *            is a sector erase. No file system, no metadata writes.
+ *  spiffs    One preallocated file on SPIFFS, mounted on the partition.
+ *  littlefs  The same on LittleFS (needs the joltwallet/littlefs component).
+ *  file      A file on a file system that is already mounted (or a host
+ *            file when the code runs off-target).
+ *
+ * File backends emulate erasing by writing 0xFF, so their stats show what
+ * that costs next to the raw partition. They share one FILE position
+ * between reads and writes, so unlike raw their reads must not overlap a
+ * write (shared_reads).
+ */
+
+#define STORAGE_BACKEND_RAW 0
+#define STORAGE_BACKEND_SPIFFS 1
+#define STORAGE_BACKEND_LITTLEFS 2
+#define STORAGE_BACKEND_FILE 3
+
+// Mount point of the spiffs and littlefs backends
+#define STORAGE_BACKEND_FS_BASE "/storage"
+
+typedef struct {
+    uint32_t size;        // bytes addressable by the log
+    uint32_t appends;
+    uint32_t reads;
+    uint32_t truncates;
+    uint64_t appended;    // bytes handed to append()
+    uint64_t read;        // bytes returned by read_at()
+    uint64_t programmed;  // bytes the backend wrote to the medium, erase emulation included
+    uint64_t erased;      // bytes returned to the erased state
+} storage_backend_stat_t;
+
+typedef struct storage_backend storage_backend_t;
+
+typedef struct {
+    const char *name;
+    bool shared_reads; // read_at() may run in another task alongside append/truncate
+    esp_err_t (*mount)(storage_backend_t *be);
+    void (*unmount)(storage_backend_t *be);
+    esp_err_t (*append)(storage_backend_t *be, uint32_t off, const void *data, size_t len);
+    esp_err_t (*read_at)(storage_backend_t *be, uint32_t off, void *buf, size_t len);
+    esp_err_t (*truncate)(storage_backend_t *be, uint32_t off, size_t len);
+} storage_backend_ops_t;
+
+struct storage_backend {
+    const storage_backend_ops_t *ops;
+    const char *label;            // partition holding the medium
+    const char *path;             // file backends: file holding the log
+    const esp_partition_t *part;  // raw backend
+    FILE *file;                   // file backends
+    storage_backend_stat_t stats;
+};
+
+extern const storage_backend_ops_t storage_backend_raw_ops;
+extern const storage_backend_ops_t storage_backend_spiffs_ops;
+extern const storage_backend_ops_t storage_backend_littlefs_ops;
+extern const storage_backend_ops_t storage_backend_file_ops;
+
+/**
+ * @brief Set up a backend of the given type (STORAGE_BACKEND_*) and mount it.
+ *
+ * @param label Partition holding the medium (unused by the file backend)
+ * @param path  File backends: file holding the log
+ * @param size  File backends: size of that file, 0 to derive it from the
+ *              file system (spiffs, littlefs) or the existing file (file)
+ */
+esp_err_t storage_backend_open(storage_backend_t *be, int type, const char *label, const char *path, uint32_t size);
+
+void storage_backend_close(storage_backend_t *be);
+
+static inline esp_err_t storage_backend_append(storage_backend_t *be, uint32_t off, const void *data, size_t len)
+{
+    if ((uint64_t)off + len > be->stats.size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    be->stats.appends++;
+    be->stats.appended += len;
+    return be->ops->append(be, off, data, len);
+}
+
+static inline esp_err_t storage_backend_read(storage_backend_t *be, uint32_t off, void *buf, size_t len)
+{
+    if ((uint64_t)off + len > be->stats.size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    be->stats.reads++;
+    be->stats.read += len;
+    return be->ops->read_at(be, off, buf, len);
+}
+
+static inline esp_err_t storage_backend_truncate(storage_backend_t *be, uint32_t off, size_t len)
+{
+    if ((uint64_t)off + len > be->stats.size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    be->stats.truncates++;
+    be->stats.erased += len;
+    return be->ops->truncate(be, off, len);
+}
+
+static inline void storage_backend_stat(const storage_backend_t *be, storage_backend_stat_t *st)
+{
+    *st = be->stats;
+}
@@ -0,0 +1,154 @@
+#include "storage_backend_bench.h"
+#include "storage_log.h"
+#include "storage_format.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "esp_timer.h"
+
+// Samples per block, matching the writer's flush count
+#define BENCH_BLOCK_SAMPLES 64
+
+static int u32_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void latency_summary(uint32_t *samples, uint32_t count, storage_latency_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (count == 0) {
+        return;
+    }
+    qsort(samples, count, sizeof(*samples), u32_cmp);
+    out->p50 = samples[count * 50 / 100];
+    out->p90 = samples[count * 90 / 100];
+    out->p99 = samples[count * 99 / 100];
+    out->max = samples[count - 1];
+}
+
+// ADXL345 every second, MAX6675 every 5 s
+static void bench_sample(uint32_t i, storage_sample_t *s)
+{
+    s->timestamp = 1700000000 + i * 5 / 6;
+    if (i % 6 == 5) {
+        s->sensor_id = STORAGE_SENSOR_MAX6675_NORMAL;
+        s->value = roundf((85.0f + 15.0f * sinf(i / 2000.0f)) * 4) / 4;
+    } else {
+        s->sensor_id = STORAGE_SENSOR_ADXL345;
+        s->value = 0.05f * sinf(i * 0.7f);
+    }
+}
+
+esp_err_t storage_backend_bench_run(storage_backend_t *be, uint32_t base, uint32_t segments,
+                                    storage_backend_bench_result_t *res)
+{
+    static storage_log_t log;
+    static uint8_t buf[STORAGE_BLOCK_SIZE];
+    storage_block_builder_t b;
+    storage_backend_stat_t before, after;
+    storage_sample_t s;
+    esp_err_t err;
+
+    memset(res, 0, sizeof(*res));
+
+    // Enough room for every block of one pass over the ring
+    uint32_t max_blocks = segments * (STORAGE_SEGMENT_SIZE / 64);
+    uint32_t *lat = malloc(max_blocks * sizeof(uint32_t));
+    storage_span_t *index = calloc(segments, sizeof(storage_span_t));
+    if (lat == NULL || index == NULL) {
+        free(lat);
+        free(index);
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = storage_backend_truncate(be, base, segments * STORAGE_SEGMENT_SIZE);
+    if (err == ESP_OK) {
+        err = storage_log_mount(&log, be, base, segments, index);
+    }
+    if (err != ESP_OK) {
+        goto out;
+    }
+
+    // Append until the ring wraps, so reclaiming is part of the numbers
+    storage_backend_stat(be, &before);
+    storage_block_begin_encoded(&b, buf, sizeof(buf), STORAGE_ENCODING_SERIES);
+    while (log.reclaimed == 0 && res->blocks < max_blocks) {
+        bench_sample(res->samples, &s);
+        bool fits = b.count < BENCH_BLOCK_SAMPLES && storage_block_add_sample(&b, s.sensor_id, s.timestamp, s.value);
+        if (fits) {
+            res->samples++;
+            continue;
+        }
+
+        storage_span_t span;
+        storage_block_span(&b, &span);
+        size_t len = storage_block_seal(&b);
+
+        int64_t start = esp_timer_get_time();
+        err = storage_log_append(&log, buf, len, &span);
+        uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+        if (err != ESP_OK) {
+            goto out;
+        }
+        lat[res->blocks++] = elapsed;
+        res->append_us += elapsed;
+        res->payload_bytes += len;
+        storage_block_begin_encoded(&b, buf, sizeof(buf), STORAGE_ENCODING_SERIES);
+    }
+    storage_backend_stat(be, &after);
+    latency_summary(lat, res->blocks, &res->append);
+    if (res->payload_bytes > 0) {
+        res->write_amplification = (double)(after.programmed - before.programmed) / res->payload_bytes;
+        res->erase_ratio = (double)(after.erased - before.erased) / res->payload_bytes;
+    }
+
+    // Read back everything that survived the wrap
+    storage_pos_t pos = storage_log_tail(&log);
+    uint32_t reads = 0;
+    for (;;) {
+        size_t len;
+        int64_t start = esp_timer_get_time();
+        err = storage_log_read_block(&log, &pos, NULL, buf, sizeof(buf), &len, NULL);
+        uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+        if (err != ESP_OK || reads == max_blocks) {
+            break;
+        }
+        lat[reads++] = elapsed;
+        res->read_us += elapsed;
+        res->read_bytes += len;
+    }
+    if (err == ESP_ERR_NOT_FOUND) {
+        err = ESP_OK;
+    }
+    latency_summary(lat, reads, &res->read);
+
+    int64_t start = esp_timer_get_time();
+    if (err == ESP_OK) {
+        err = storage_log_clear(&log);
+    }
+    res->clear_us = (uint32_t)(esp_timer_get_time() - start);
+
+out:
+    // Leave nothing behind that a later mount could take for a log
+    storage_backend_truncate(be, base, segments * STORAGE_SEGMENT_SIZE);
+    free(lat);
+    free(index);
+    return err;
+}
+
+void storage_backend_bench_print(const char *name, const storage_backend_bench_result_t *res)
+{
+    double append_s = res->append_us / 1e6, read_s = res->read_us / 1e6;
+
+    printf("  %-9s append %7.1f KB/s  read %8.1f KB/s  clear %6lu us  WA %.2f  erased %.2f\n", name,
+           append_s > 0 ? res->payload_bytes / 1024.0 / append_s : 0.0,
+           read_s > 0 ? res->read_bytes / 1024.0 / read_s : 0.0, (unsigned long)res->clear_us,
+           res->write_amplification, res->erase_ratio);
+    printf("  %-9s append us p50 %lu p90 %lu p99 %lu max %lu | read us p50 %lu p90 %lu p99 %lu max %lu\n", "",
+           (unsigned long)res->append.p50, (unsigned long)res->append.p90, (unsigned long)res->append.p99,
+           (unsigned long)res->append.max, (unsigned long)res->read.p50, (unsigned long)res->read.p90,
+           (unsigned long)res->read.p99, (unsigned long)res->read.max);
+}
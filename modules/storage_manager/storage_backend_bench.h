@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "storage_backend.h"
+
+/*
+ * Append/read/clear workload run through the segment log on any backend.
+ * Used by the `bench backend` console command on the device and by
+ * tools/storage_backend_bench.c on a host-side flash image, so both report
+ * the same numbers.
+ */
+
+typedef struct {
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+} storage_latency_t; // microseconds
+
+typedef struct {
+    uint32_t samples;
+    uint32_t blocks;
+    uint64_t payload_bytes;   // sealed blocks handed to the log
+    uint64_t read_bytes;      // blocks read back (what survived the wrap)
+    uint64_t append_us;
+    uint64_t read_us;
+    uint32_t clear_us;
+    storage_latency_t append; // per block, segment rollover and reclaim included
+    storage_latency_t read;   // per block
+    double write_amplification; // bytes programmed / payload bytes
+    double erase_ratio;         // bytes erased / payload bytes
+} storage_backend_bench_result_t;
+
+/**
+ * @brief Write a synthetic trace through a log on [base, base + segments)
+ * until the ring wraps once, read it all back and clear it. The region is
+ * erased again afterwards.
+ */
+esp_err_t storage_backend_bench_run(storage_backend_t *be, uint32_t base, uint32_t segments,
+                                    storage_backend_bench_result_t *res);
+
+void storage_backend_bench_print(const char *name, const storage_backend_bench_result_t *res);
@@ -0,0 +1,234 @@
+#include "storage_backend.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+
+#if __has_include("esp_spiffs.h")
+#include "esp_spiffs.h"
+#define HAVE_SPIFFS 1
+#endif
+#if __has_include("esp_littlefs.h")
+#include "esp_littlefs.h"
+#define HAVE_LITTLEFS 1
+#endif
+
+static const char *TAG = "STORAGE_BACKEND";
+
+// Granularity the log file is sized in
+#define FILE_SIZE_ALIGN 4096
+
+static const uint8_t s_erased[512] = {
+    [0 ... 511] = 0xFF,
+};
+
+static esp_err_t file_fill_erased(storage_backend_t *be, uint32_t off, size_t len)
+{
+    if (fseek(be->file, off, SEEK_SET) != 0) {
+        return ESP_FAIL;
+    }
+    while (len > 0) {
+        size_t n = len < sizeof(s_erased) ? len : sizeof(s_erased);
+        if (fwrite(s_erased, 1, n, be->file) != n) {
+            return ESP_FAIL;
+        }
+        be->stats.programmed += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t file_sync(storage_backend_t *be)
+{
+    if (fflush(be->file) != 0 || fsync(fileno(be->file)) != 0) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Open the log file, creating it fully erased when missing or resized
+static esp_err_t file_prepare(storage_backend_t *be)
+{
+    struct stat st;
+    bool exists = stat(be->path, &st) == 0;
+
+    if (be->stats.size == 0) {
+        if (!exists) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        be->stats.size = st.st_size;
+    }
+
+    if (exists && (uint32_t)st.st_size == be->stats.size) {
+        be->file = fopen(be->path, "r+b");
+        return be->file != NULL ? ESP_OK : ESP_FAIL;
+    }
+
+    ESP_LOGW(TAG, "Creating %s (%lu bytes)", be->path, (unsigned long)be->stats.size);
+    be->file = fopen(be->path, "w+b");
+    if (be->file == NULL) {
+        return ESP_FAIL;
+    }
+    esp_err_t err = file_fill_erased(be, 0, be->stats.size);
+    if (err == ESP_OK) {
+        err = file_sync(be);
+    }
+    if (err != ESP_OK) {
+        fclose(be->file);
+        be->file = NULL;
+        unlink(be->path);
+    }
+    return err;
+}
+
+static void file_unmount(storage_backend_t *be)
+{
+    if (be->file != NULL) {
+        fclose(be->file);
+        be->file = NULL;
+    }
+}
+
+static esp_err_t file_append(storage_backend_t *be, uint32_t off, const void *data, size_t len)
+{
+    if (fseek(be->file, off, SEEK_SET) != 0 || fwrite(data, 1, len, be->file) != len) {
+        return ESP_FAIL;
+    }
+    be->stats.programmed += len;
+    return file_sync(be);
+}
+
+static esp_err_t file_read_at(storage_backend_t *be, uint32_t off, void *buf, size_t len)
+{
+    if (fseek(be->file, off, SEEK_SET) != 0 || fread(buf, 1, len, be->file) != len) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t file_truncate(storage_backend_t *be, uint32_t off, size_t len)
+{
+    esp_err_t err = file_fill_erased(be, off, len);
+    return err == ESP_OK ? file_sync(be) : err;
+}
+
+static esp_err_t file_mount(storage_backend_t *be)
+{
+    return be->path != NULL ? file_prepare(be) : ESP_ERR_INVALID_ARG;
+}
+
+#if defined(HAVE_SPIFFS) || defined(HAVE_LITTLEFS)
+// File systems need room for their own metadata; SPIFFS in particular
+// slows down sharply when it gets close to full.
+static uint32_t file_size_for(size_t total, unsigned percent)
+{
+    return (uint32_t)(total / 100 * percent) / FILE_SIZE_ALIGN * FILE_SIZE_ALIGN;
+}
+#endif
+
+static esp_err_t spiffs_mount(storage_backend_t *be)
+{
+#ifdef HAVE_SPIFFS
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = STORAGE_BACKEND_FS_BASE,
+        .partition_label = be->label,
+        .max_files = 2,
+        .format_if_mount_failed = true,
+    };
+    size_t total = 0, used = 0;
+
+    esp_err_t err = esp_vfs_spiffs_register(&conf);
+    if (err == ESP_OK) {
+        err = esp_spiffs_info(be->label, &total, &used);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (be->stats.size == 0) {
+        be->stats.size = file_size_for(total, 75);
+    }
+    err = file_prepare(be);
+    if (err != ESP_OK) {
+        esp_vfs_spiffs_unregister(be->label);
+    }
+    return err;
+#else
+    (void)be;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+static void spiffs_unmount(storage_backend_t *be)
+{
+    file_unmount(be);
+#ifdef HAVE_SPIFFS
+    esp_vfs_spiffs_unregister(be->label);
+#endif
+}
+
+static esp_err_t littlefs_mount(storage_backend_t *be)
+{
+#ifdef HAVE_LITTLEFS
+    esp_vfs_littlefs_conf_t conf = {
+        .base_path = STORAGE_BACKEND_FS_BASE,
+        .partition_label = be->label,
+        .format_if_mount_failed = true,
+    };
+    size_t total = 0, used = 0;
+
+    esp_err_t err = esp_vfs_littlefs_register(&conf);
+    if (err == ESP_OK) {
+        err = esp_littlefs_info(be->label, &total, &used);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (be->stats.size == 0) {
+        be->stats.size = file_size_for(total, 90);
+    }
+    err = file_prepare(be);
+    if (err != ESP_OK) {
+        esp_vfs_littlefs_unregister(be->label);
+    }
+    return err;
+#else
+    (void)be;
+    ESP_LOGE(TAG, "LittleFS backend needs the joltwallet/littlefs component");
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+static void littlefs_unmount(storage_backend_t *be)
+{
+    file_unmount(be);
+#ifdef HAVE_LITTLEFS
+    esp_vfs_littlefs_unregister(be->label);
+#endif
+}
+
+const storage_backend_ops_t storage_backend_spiffs_ops = {
+    .name = "spiffs",
+    .mount = spiffs_mount,
+    .unmount = spiffs_unmount,
+    .append = file_append,
+    .read_at = file_read_at,
+    .truncate = file_truncate,
+};
+
+const storage_backend_ops_t storage_backend_littlefs_ops = {
+    .name = "littlefs",
+    .mount = littlefs_mount,
+    .unmount = littlefs_unmount,
+    .append = file_append,
+    .read_at = file_read_at,
+    .truncate = file_truncate,
+};
+
+const storage_backend_ops_t storage_backend_file_ops = {
+    .name = "file",
+    .mount = file_mount,
+    .unmount = file_unmount,
+    .append = file_append,
+    .read_at = file_read_at,
+    .truncate = file_truncate,
+};
@@ -0,0 +1,306 @@
+#include "storage_manager.h"
+#include "storage_internal.h"
+#include "storage_format.h"
+#include "storage_backend_bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "STORAGE_BENCH";
+
+#define BENCH_SCRATCH_MAX (4 * STORAGE_SEGMENT_SIZE)
+#define BENCH_SCAN_SEGMENTS 16
+#define BENCH_BACKEND_SEGMENTS 8
+
+// Synthetic trace shaped like the real one: ADXL345 at 1 Hz, MAX6675 every
+// 5 s, profile samples at 2 Hz while a session is running.
+static void bench_sample(uint32_t i, uint32_t base_ts, storage_sample_t *s)
+{
+    static const uint8_t pattern[] = {
+        STORAGE_SENSOR_ADXL345, STORAGE_SENSOR_MAX6675_PROFILE, STORAGE_SENSOR_MAX6675_PROFILE,
+        STORAGE_SENSOR_ADXL345, STORAGE_SENSOR_MAX6675_NORMAL,
+    };
+    s->sensor_id = pattern[i % sizeof(pattern)];
+    s->timestamp = base_ts + i / 2;
+    if (s->sensor_id == STORAGE_SENSOR_ADXL345) {
+        s->value = 0.05f * sinf(i * 0.7f);
+    } else {
+        s->value = 20.0f + (i / 10) * 0.25f;
+    }
+}
+
+static void bench_report(const char *name, uint32_t samples, long bytes, int64_t elapsed_us)
+{
+    double secs = elapsed_us / 1e6;
+    printf("  %-6s %8ld B  %6.2f B/sample  %8.0f samples/s  %8.0f B/s\n",
+           name, bytes, (double)bytes / samples, samples / secs, bytes / secs);
+}
+
+// Appends a chunk to the scratch region, mimicking how the writer commits
+// to flash. Returns false once the scratch region is exhausted.
+typedef struct {
+    storage_backend_t *backend;
+    uint32_t offset;
+    uint32_t len;
+    uint32_t used;
+} bench_sink_t;
+
+static bool sink_write(bench_sink_t *sink, const void *data, size_t len)
+{
+    if (sink->used + len > sink->len) {
+        return false;
+    }
+    if (storage_backend_append(sink->backend, sink->offset + sink->used, data, len) != ESP_OK) {
+        return false;
+    }
+    sink->used += len;
+    return true;
+}
+
+static bool bench_sink_prepare(bench_sink_t *sink)
+{
+    storage_log_t *log = storage_main_log();
+    sink->backend = log->backend;
+    sink->used = 0;
+    if (!storage_log_scratch_region(log, &sink->offset, &sink->len)) {
+        return false;
+    }
+    if (sink->len > BENCH_SCRATCH_MAX) {
+        sink->len = BENCH_SCRATCH_MAX;
+    }
+    return storage_backend_truncate(sink->backend, sink->offset, sink->len) == ESP_OK;
+}
+
+// Writes the trace as blocks of one encoding to the sink
+static bool bench_encode(bench_sink_t *sink, uint8_t encoding, uint32_t samples, uint32_t base_ts,
+                         long *bytes, int64_t *elapsed_us)
+{
+    static uint8_t buf[STORAGE_BLOCK_SIZE];
+    storage_block_builder_t b;
+    storage_sample_t s;
+    bool ok = true;
+
+    int64_t start = esp_timer_get_time();
+    storage_block_begin_encoded(&b, buf, sizeof(buf), encoding);
+    for (uint32_t i = 0; i < samples && ok; i++) {
+        bench_sample(i, base_ts, &s);
+        if (!storage_block_add_sample(&b, s.sensor_id, s.timestamp, s.value)) {
+            ok = sink_write(sink, buf, storage_block_seal(&b));
+            storage_block_begin_encoded(&b, buf, sizeof(buf), encoding);
+            storage_block_add_sample(&b, s.sensor_id, s.timestamp, s.value);
+        }
+    }
+    ok = ok && sink_write(sink, buf, storage_block_seal(&b));
+    *elapsed_us = esp_timer_get_time() - start;
+    *bytes = sink->used;
+    return ok;
+}
+
+void storage_bench_format(uint32_t samples)
+{
+    const uint32_t base_ts = 1700000000;
+    storage_sample_t s;
+    bench_sink_t sink;
+    bool ok = true;
+
+    printf("Format benchmark, %lu samples:\n", (unsigned long)samples);
+
+    // Writes go to log segments that hold no data; the writer task is
+    // paused for the duration and the log erases them before reuse.
+    storage_lock();
+
+    if (!bench_sink_prepare(&sink)) {
+        storage_unlock();
+        ESP_LOGE(TAG, "No free segments to benchmark on");
+        return;
+    }
+
+    // Text: one line per sample, buffered into the same block size
+    static char text_buf[STORAGE_BLOCK_SIZE];
+    size_t text_len = 0;
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < samples && ok; i++) {
+        char line[48];
+        bench_sample(i, base_ts, &s);
+        int n = snprintf(line, sizeof(line), "%s;%lu;%.3f\n", storage_sensor_name(s.sensor_id),
+                         (unsigned long)s.timestamp, s.value);
+        if (text_len + n > sizeof(text_buf)) {
+            ok = sink_write(&sink, text_buf, text_len);
+            text_len = 0;
+        }
+        memcpy(&text_buf[text_len], line, n);
+        text_len += n;
+    }
+    ok = ok && sink_write(&sink, text_buf, text_len);
+    int64_t text_us = esp_timer_get_time() - start;
+    long text_bytes = sink.used;
+
+    if (!ok || !bench_sink_prepare(&sink)) {
+        storage_unlock();
+        ESP_LOGE(TAG, "Scratch region too small for %lu samples", (unsigned long)samples);
+        return;
+    }
+
+    int64_t bin_us = 0, series_us = 0;
+    long bin_bytes = 0, series_bytes = 0;
+    ok = bench_encode(&sink, STORAGE_ENCODING_PLAIN, samples, base_ts, &bin_bytes, &bin_us) &&
+         bench_sink_prepare(&sink) &&
+         bench_encode(&sink, STORAGE_ENCODING_SERIES, samples, base_ts, &series_bytes, &series_us);
+
+    storage_unlock();
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Scratch region too small for %lu samples", (unsigned long)samples);
+        return;
+    }
+
+    bench_report("text", samples, text_bytes, text_us);
+    bench_report("binary", samples, bin_bytes, bin_us);
+    bench_report("series", samples, series_bytes, series_us);
+    printf("  ratio  %.2fx / %.2fx smaller\n", (double)text_bytes / bin_bytes, (double)text_bytes / series_bytes);
+}
+
+// Engine temperature every 5 s cycling between 70 and 100 °C with a short
+// overheat now and then, vibration at 1 Hz with a rare knock.
+static void bench_scan_sample(uint32_t i, uint32_t base_ts, storage_sample_t *s)
+{
+    s->timestamp = base_ts + i;
+    if (i % 5 == 4) {
+        s->sensor_id = STORAGE_SENSOR_MAX6675_NORMAL;
+        s->value = (i % 20000) < 60 ? 108.0f : 85.0f + 15.0f * sinf(i / 2000.0f);
+    } else {
+        s->sensor_id = STORAGE_SENSOR_ADXL345;
+        s->value = i % 7919 == 0 ? 2.5f : 0.05f * sinf(i * 0.7f);
+    }
+}
+
+static bool bench_count_cb(const storage_record_t *record, void *ctx)
+{
+    (*(uint32_t *)ctx)++;
+    return true;
+}
+
+static void bench_scan_run(storage_log_t *log, const char *name, const storage_predicate_t *pred)
+{
+    for (int use_summaries = 1; use_summaries >= 0; use_summaries--) {
+        storage_query_stats_t stats;
+        uint32_t matches = 0;
+
+        int64_t start = esp_timer_get_time();
+        storage_scan_log(log, pred, use_summaries, bench_count_cb, &matches, &stats);
+        int64_t elapsed_us = esp_timer_get_time() - start;
+
+        uint32_t blocks = stats.blocks_skipped + stats.blocks_read;
+        printf("  %-18s %-9s %5lu/%5lu blocks skipped  %6lu matches  %7.1f ms\n",
+               name, use_summaries ? "summary" : "full", (unsigned long)stats.blocks_skipped,
+               (unsigned long)blocks, (unsigned long)matches, elapsed_us / 1000.0);
+    }
+}
+
+void storage_bench_scan(void)
+{
+    const uint32_t base_ts = 1700000000;
+    static storage_log_t bench_log;
+    static uint8_t buf[STORAGE_BLOCK_SIZE];
+    storage_block_builder_t b;
+    storage_span_t span;
+    storage_sample_t s;
+    uint32_t offset, len;
+
+    storage_lock();
+
+    storage_log_t *log = storage_main_log();
+    if (!storage_log_scratch_region(log, &offset, &len) || len < 2 * STORAGE_SEGMENT_SIZE) {
+        storage_unlock();
+        ESP_LOGE(TAG, "No free segments to benchmark on");
+        return;
+    }
+    uint32_t segments = len / STORAGE_SEGMENT_SIZE;
+    if (segments > BENCH_SCAN_SEGMENTS) {
+        segments = BENCH_SCAN_SEGMENTS;
+    }
+    storage_span_t *index = calloc(segments, sizeof(storage_span_t));
+    if (index == NULL ||
+        storage_backend_truncate(log->backend, offset, segments * STORAGE_SEGMENT_SIZE) != ESP_OK ||
+        storage_log_mount(&bench_log, log->backend, offset, segments, index) != ESP_OK) {
+        storage_unlock();
+        free(index);
+        ESP_LOGE(TAG, "Could not set up the scratch log");
+        return;
+    }
+
+    // Fill until the ring wraps, like a partition that has been full for a while
+    uint32_t samples = 0;
+    storage_block_begin(&b, buf, sizeof(buf));
+    while (bench_log.reclaimed == 0) {
+        bench_scan_sample(samples, base_ts, &s);
+        if (!storage_block_add_sample(&b, s.sensor_id, s.timestamp, s.value)) {
+            storage_block_span(&b, &span);
+            if (storage_log_append(&bench_log, buf, storage_block_seal(&b), &span) != ESP_OK) {
+                break;
+            }
+            storage_block_begin(&b, buf, sizeof(buf));
+            continue;
+        }
+        samples++;
+    }
+
+    printf("Scan benchmark, %lu segments, %lu samples written:\n",
+           (unsigned long)segments, (unsigned long)samples);
+
+    storage_predicate_t overheat = {
+        .sensor_id = STORAGE_SENSOR_MAX6675_NORMAL,
+        .t_from = 0,
+        .t_to = UINT32_MAX,
+        .match = STORAGE_MATCH_ABOVE,
+        .threshold = 105.0f,
+    };
+    storage_predicate_t knock = {
+        .sensor_id = STORAGE_SENSOR_ADXL345,
+        .t_from = 0,
+        .t_to = UINT32_MAX,
+        .match = STORAGE_MATCH_ABOVE,
+        .threshold = 1.0f,
+    };
+    bench_scan_run(&bench_log, "MAX6675 > 105", &overheat);
+    bench_scan_run(&bench_log, "ADXL345 > 1.0", &knock);
+
+    // The scratch log's segment headers must not be mistaken for the real
+    // log's at the next mount
+    storage_backend_truncate(log->backend, offset, segments * STORAGE_SEGMENT_SIZE);
+    storage_unlock();
+    free(index);
+}
+
+void storage_bench_backend(void)
+{
+    storage_backend_bench_result_t res;
+    uint32_t offset, len;
+
+    storage_lock();
+
+    storage_log_t *log = storage_main_log();
+    if (!storage_log_scratch_region(log, &offset, &len) || len < 2 * STORAGE_SEGMENT_SIZE) {
+        storage_unlock();
+        ESP_LOGE(TAG, "No free segments to benchmark on");
+        return;
+    }
+    uint32_t segments = len / STORAGE_SEGMENT_SIZE;
+    if (segments > BENCH_BACKEND_SEGMENTS) {
+        segments = BENCH_BACKEND_SEGMENTS;
+    }
+
+    esp_err_t err = storage_backend_bench_run(log->backend, offset, segments, &res);
+    storage_unlock();
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Backend benchmark failed (%s)", esp_err_to_name(err));
+        return;
+    }
+    printf("Backend benchmark, %lu segments, %lu samples in %lu blocks:\n", (unsigned long)segments,
+           (unsigned long)res.samples, (unsigned long)res.blocks);
+    storage_backend_bench_print(log->backend->ops->name, &res);
+}
@@ -0,0 +1,330 @@
+#include "storage_manager.h"
+#include "storage_internal.h"
+#include "storage_format.h"
+#include "project_config.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "STORAGE_CALIB";
+
+/*
+ * Calibration of the sensors whose raw codes go into the log.
+ *
+ * Every sensor keeps its last STORAGE_CALIB_HISTORY calibrations in RAM
+ * and NVS, oldest first, each valid from its `since` timestamp on; a code
+ * is converted with the newest one not newer than the sample (or the
+ * oldest one for samples before any). The current calibration of a sensor
+ * is also written to the log once per boot and on every change, as a note:
+ *
+ *   CAL;BMP280;t1;t2;t3
+ *   CAL;VEML7700;conf;lux_per_count
+ *   CAL;ADXL345;ms2_per_lsb;ox;oy;oz;sx;sy;sz
+ *
+ * with the note's timestamp as `since`, so tools/storage_decode.py can
+ * convert a log dump or an SD card archive on its own.
+ */
+
+#define NVS_NAMESPACE "storage_mgr"
+#define NVS_CALIB_KEY "calib%u"
+
+#define MAX6675_DEG_PER_CODE 0.25f
+// veml7700.c: correction of the non-linearity above 1000 lux
+#define VEML7700_COEF_A 6.0135e-13
+#define VEML7700_COEF_B -9.3924e-9
+#define VEML7700_COEF_C 8.1488e-5
+#define VEML7700_COEF_D 1.0023
+// adxl345.c reports the magnitude with gravity taken off
+#define ADXL345_GRAVITY_MS2 9.81f
+
+static storage_calib_t s_calib[STORAGE_SENSOR_COUNT][STORAGE_CALIB_HISTORY];
+static uint8_t s_calib_count[STORAGE_SENSOR_COUNT];
+static uint32_t s_noted; // sensors whose calibration went into the log since boot
+static portMUX_TYPE s_calib_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Copy of the fields that matter for the sensor, everything else zeroed
+static bool calib_normalize(const storage_calib_t *cal, storage_calib_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->sensor_id = cal->sensor_id;
+    out->since = cal->since;
+    switch (cal->sensor_id) {
+    case STORAGE_SENSOR_BMP280:
+        out->bmp280 = cal->bmp280;
+        return true;
+    case STORAGE_SENSOR_VEML7700:
+        out->veml7700 = cal->veml7700;
+        return true;
+    case STORAGE_SENSOR_ADXL345:
+        out->adxl345 = cal->adxl345;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool calib_same(const storage_calib_t *a, const storage_calib_t *b)
+{
+    storage_calib_t x = *a, y = *b;
+    x.since = y.since = 0;
+    return memcmp(&x, &y, sizeof(x)) == 0;
+}
+
+static void calib_persist(uint8_t sensor_id)
+{
+    storage_calib_t copy[STORAGE_CALIB_HISTORY];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_handle_t handle;
+
+    portENTER_CRITICAL(&s_calib_lock);
+    uint8_t n = s_calib_count[sensor_id];
+    memcpy(copy, s_calib[sensor_id], n * sizeof(copy[0]));
+    portEXIT_CRITICAL(&s_calib_lock);
+
+    snprintf(key, sizeof(key), NVS_CALIB_KEY, sensor_id);
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, key, copy, n * sizeof(copy[0]));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to persist %s calibration (%s)", storage_sensor_name(sensor_id), esp_err_to_name(err));
+    }
+}
+
+void storage_calib_restore(void)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_handle_t handle;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    for (uint8_t id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        storage_calib_t loaded[STORAGE_CALIB_HISTORY];
+        size_t len = sizeof(loaded);
+
+        snprintf(key, sizeof(key), NVS_CALIB_KEY, id);
+        if (nvs_get_blob(handle, key, loaded, &len) != ESP_OK || len % sizeof(loaded[0]) != 0) {
+            continue;
+        }
+        portENTER_CRITICAL(&s_calib_lock);
+        memcpy(s_calib[id], loaded, len);
+        s_calib_count[id] = len / sizeof(loaded[0]);
+        portEXIT_CRITICAL(&s_calib_lock);
+    }
+    nvs_close(handle);
+}
+
+static int calib_note(const storage_calib_t *c, char *out, size_t len)
+{
+    const char *name = storage_sensor_name(c->sensor_id);
+
+    switch (c->sensor_id) {
+    case STORAGE_SENSOR_BMP280:
+        return snprintf(out, len, "CAL;%s;%u;%d;%d", name, c->bmp280.t1, c->bmp280.t2, c->bmp280.t3);
+    case STORAGE_SENSOR_VEML7700:
+        return snprintf(out, len, "CAL;%s;%u;%.6g", name, c->veml7700.conf, c->veml7700.lux_per_count);
+    default:
+        return snprintf(out, len, "CAL;%s;%.6g;%.6g;%.6g;%.6g;%.6g;%.6g;%.6g", name, c->adxl345.ms2_per_lsb,
+                        c->adxl345.offset[0], c->adxl345.offset[1], c->adxl345.offset[2], c->adxl345.scale[0],
+                        c->adxl345.scale[1], c->adxl345.scale[2]);
+    }
+}
+
+esp_err_t storage_set_calibration(const storage_calib_t *cal)
+{
+    storage_calib_t entry;
+    char note[STORAGE_NOTE_MAX_LEN + 1];
+
+    if (cal->sensor_id >= STORAGE_SENSOR_COUNT || !calib_normalize(cal, &entry)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t id = entry.sensor_id;
+
+    portENTER_CRITICAL(&s_calib_lock);
+    uint8_t n = s_calib_count[id];
+    bool changed = n == 0 || !calib_same(&s_calib[id][n - 1], &entry);
+    if (changed) {
+        // Entries stay in `since` order, the clock may have been set back
+        if (n > 0 && entry.since < s_calib[id][n - 1].since) {
+            entry.since = s_calib[id][n - 1].since;
+        }
+        if (n == STORAGE_CALIB_HISTORY) {
+            memmove(&s_calib[id][0], &s_calib[id][1], (n - 1) * sizeof(entry));
+            n--;
+        }
+        s_calib[id][n++] = entry;
+        s_calib_count[id] = n;
+    } else {
+        entry = s_calib[id][n - 1];
+    }
+    bool noted = (s_noted & (1UL << id)) != 0;
+    s_noted |= 1UL << id;
+    portEXIT_CRITICAL(&s_calib_lock);
+
+    if (changed) {
+        ESP_LOGI(TAG, "New %s calibration from %lu", storage_sensor_name(id), (unsigned long)entry.since);
+        calib_persist(id);
+    }
+    if ((changed || !noted) && storage_mounted()) {
+        calib_note(&entry, note, sizeof(note));
+        storage_lock();
+        bool ok = storage_block_append_note(entry.since, note);
+        storage_unlock();
+        if (!ok) {
+            ESP_LOGW(TAG, "Failed to log %s calibration", storage_sensor_name(id));
+        }
+        storage_request_flush();
+    }
+    return ESP_OK;
+}
+
+bool storage_get_calibration(uint8_t sensor_id, uint32_t timestamp, storage_calib_t *out)
+{
+    if (sensor_id >= STORAGE_SENSOR_COUNT) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&s_calib_lock);
+    int n = s_calib_count[sensor_id];
+    int i = n - 1;
+    while (i > 0 && s_calib[sensor_id][i].since > timestamp) {
+        i--;
+    }
+    if (n > 0) {
+        *out = s_calib[sensor_id][i];
+    }
+    portEXIT_CRITICAL(&s_calib_lock);
+    return n > 0;
+}
+
+// bmp280.c: compensation formula of the datasheet, 0.01 °C resolution
+static float bmp280_celsius(const storage_calib_t *c, int32_t adc_t)
+{
+    int32_t t1 = c->bmp280.t1;
+    int32_t var1 = ((((adc_t >> 3) - (t1 << 1))) * (int32_t)c->bmp280.t2) >> 11;
+    int32_t var2 = (((((adc_t >> 4) - t1) * ((adc_t >> 4) - t1)) >> 12) * (int32_t)c->bmp280.t3) >> 14;
+    return (float)(((var1 + var2) * 5 + 128) >> 8) / 100.0f;
+}
+
+static float veml7700_lux(const storage_calib_t *c, int32_t counts)
+{
+    float lux = counts * c->veml7700.lux_per_count;
+
+    if (lux > 1000.0f) {
+        lux = (VEML7700_COEF_A * powf(lux, 4)) + (VEML7700_COEF_B * powf(lux, 3)) +
+              (VEML7700_COEF_C * powf(lux, 2)) + (VEML7700_COEF_D * lux);
+    }
+    return lux;
+}
+
+static float adxl345_magnitude(const storage_calib_t *c, const int32_t *axes)
+{
+    float sum = 0.0f;
+
+    for (int i = 0; i < 3; i++) {
+        float v = c->adxl345.scale[i] * (axes[i] * c->adxl345.ms2_per_lsb - c->adxl345.offset[i]);
+        sum += v * v;
+    }
+    return sqrtf(sum) - ADXL345_GRAVITY_MS2;
+}
+
+// codes holds three axes for STORAGE_RAW_ADXL345_X, one code otherwise
+static bool convert(uint8_t channel, uint32_t timestamp, const int32_t *codes, float *value)
+{
+    storage_calib_t cal;
+
+    switch (channel) {
+    case STORAGE_RAW_MAX6675_NORMAL:
+    case STORAGE_RAW_MAX6675_PROFILE:
+        *value = codes[0] * MAX6675_DEG_PER_CODE;
+        return true;
+    case STORAGE_RAW_BMP280_T:
+        if (!storage_get_calibration(STORAGE_SENSOR_BMP280, timestamp, &cal)) {
+            return false;
+        }
+        *value = bmp280_celsius(&cal, codes[0]);
+        return true;
+    case STORAGE_RAW_VEML7700:
+        if (!storage_get_calibration(STORAGE_SENSOR_VEML7700, timestamp, &cal)) {
+            return false;
+        }
+        *value = veml7700_lux(&cal, codes[0]);
+        return true;
+    case STORAGE_RAW_ADXL345_X:
+        if (!storage_get_calibration(STORAGE_SENSOR_ADXL345, timestamp, &cal)) {
+            return false;
+        }
+        *value = adxl345_magnitude(&cal, codes);
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool storage_calib_to_units(const storage_sample_t *sample, storage_sample_t *out)
+{
+    int32_t codes[3] = { sample->code };
+    float value;
+
+    if (sample->raw == STORAGE_RAW_NONE) {
+        *out = *sample;
+        return true;
+    }
+    if (sample->raw == STORAGE_RAW_ADXL345_X) {
+        codes[0] = sample->axes[0];
+        codes[1] = sample->axes[1];
+        codes[2] = sample->axes[2];
+    }
+    if (!convert(sample->raw, sample->timestamp, codes, &value)) {
+        return false;
+    }
+    *out = (storage_sample_t){
+        .sensor_id = sample->sensor_id,
+        .timestamp = sample->timestamp,
+        .value = value,
+    };
+    return true;
+}
+
+esp_err_t storage_calib_next(storage_block_iter_t *it, storage_record_t *record)
+{
+    storage_calib_t cal;
+    int32_t codes[3];
+    float value;
+
+    esp_err_t err = storage_block_iter_next(it, record);
+    if (err != ESP_OK || record->raw == STORAGE_RAW_NONE) {
+        return err;
+    }
+
+    codes[0] = (int32_t)record->value;
+    if (record->raw == STORAGE_RAW_ADXL345_X) {
+        // Without a calibration the axes are handed out one by one, as codes
+        if (!storage_get_calibration(STORAGE_SENSOR_ADXL345, record->timestamp, &cal)) {
+            return ESP_OK;
+        }
+        for (int i = 1; i < 3; i++) {
+            storage_record_t axis;
+            if ((err = storage_block_iter_next(it, &axis)) != ESP_OK || axis.raw != STORAGE_RAW_ADXL345_X + i ||
+                axis.timestamp != record->timestamp) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            codes[i] = (int32_t)axis.value;
+        }
+    }
+    if (convert(record->raw, record->timestamp, codes, &value)) {
+        record->raw = STORAGE_RAW_NONE;
+        record->value = value;
+        record->min = value;
+        record->max = value;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,764 @@
+#include "storage_format.h"
+#include "storage_manager.h"
+#include "storage_series.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+static const uint32_t s_crc_nibble_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t storage_crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ s_crc_nibble_table[crc & 0x0F];
+        crc = (crc >> 4) ^ s_crc_nibble_table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static size_t varint_put(uint8_t *out, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static size_t varint64_put(uint8_t *out, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static size_t varint64_len(uint64_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static size_t varint_get(const uint8_t *in, size_t avail, uint32_t *v)
+{
+    uint32_t result = 0;
+    for (size_t n = 0; n < avail && n < 5; n++) {
+        result |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+        if ((in[n] & 0x80) == 0) {
+            *v = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static size_t varint64_get(const uint8_t *in, size_t avail, uint64_t *v)
+{
+    uint64_t result = 0;
+    for (size_t n = 0; n < avail && n < 10; n++) {
+        result |= (uint64_t)(in[n] & 0x7F) << (7 * n);
+        if ((in[n] & 0x80) == 0) {
+            *v = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static inline uint32_t zigzag_encode(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline uint64_t zigzag64_encode(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t zigzag64_decode(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static size_t zone_encoded_len(const storage_zone_t *z)
+{
+    return 1 + varint64_len(z->count) + varint64_len(zigzag_encode(z->min)) +
+           varint64_len(zigzag_encode(z->max)) + varint64_len(zigzag64_encode(z->sum));
+}
+
+// Summary size once a record with this timestamp (and zone, if any) is added
+static size_t summary_len_with(const storage_block_builder_t *b, uint32_t timestamp,
+                               const storage_zone_t *old_zone, const storage_zone_t *new_zone)
+{
+    uint32_t base = b->count ? b->base_ts : timestamp;
+    size_t len = b->count ? b->summary_len - varint64_len(b->last_ts - base) : 1;
+
+    len += varint64_len(timestamp - base);
+    if (old_zone != NULL && old_zone->count > 0) {
+        len -= zone_encoded_len(old_zone);
+    }
+    if (new_zone != NULL) {
+        len += zone_encoded_len(new_zone);
+    }
+    return len;
+}
+
+void storage_block_begin(storage_block_builder_t *b, uint8_t *buf, size_t cap)
+{
+    storage_block_begin_encoded(b, buf, cap, STORAGE_ENCODING_PLAIN);
+}
+
+void storage_block_begin_encoded(storage_block_builder_t *b, uint8_t *buf, size_t cap, uint8_t sample_encoding)
+{
+    b->buf = buf;
+    b->cap = cap;
+    b->len = STORAGE_BLOCK_HEADER_SIZE;
+    b->count = 0;
+    b->base_ts = 0;
+    b->last_ts = 0;
+    b->sensors = 0;
+    b->encoding = sample_encoding;
+    b->sample_encoding = sample_encoding;
+    b->summary_len = 0;
+    b->bits = 0;
+    memset(b->zones, 0, sizeof(b->zones));
+}
+
+// Bytes the record stream takes once `bits` more bits are added
+static inline size_t series_len_with(const storage_block_builder_t *b, size_t bits)
+{
+    return STORAGE_BLOCK_HEADER_SIZE + (b->bits + bits + 7) / 8;
+}
+
+static bool block_reserve_ts(storage_block_builder_t *b, uint32_t timestamp, uint32_t *delta)
+{
+    if (b->count == 0) {
+        b->base_ts = timestamp;
+        b->last_ts = timestamp;
+    }
+    if (timestamp < b->last_ts || b->count == UINT16_MAX) {
+        return false;
+    }
+    *delta = timestamp - b->last_ts;
+    return true;
+}
+
+static void zone_add(const storage_zone_t *zone, uint8_t sensor_id, int32_t scaled, storage_zone_t *updated)
+{
+    *updated = *zone;
+    if (updated->count == 0) {
+        updated->sensor_id = sensor_id;
+        updated->min = scaled;
+        updated->max = scaled;
+    }
+    updated->count++;
+    updated->min = scaled < updated->min ? scaled : updated->min;
+    updated->max = scaled > updated->max ? scaled : updated->max;
+    updated->sum += scaled;
+}
+
+static const uint8_t s_raw_sensor[STORAGE_RAW_CHANNEL_COUNT] = {
+    [STORAGE_RAW_NONE] = STORAGE_SENSOR_COUNT,
+    [STORAGE_RAW_BMP280_T] = STORAGE_SENSOR_BMP280,
+    [STORAGE_RAW_VEML7700] = STORAGE_SENSOR_VEML7700,
+    [STORAGE_RAW_MAX6675_NORMAL] = STORAGE_SENSOR_MAX6675_NORMAL,
+    [STORAGE_RAW_MAX6675_PROFILE] = STORAGE_SENSOR_MAX6675_PROFILE,
+    [STORAGE_RAW_ADXL345_X] = STORAGE_SENSOR_ADXL345,
+    [STORAGE_RAW_ADXL345_Y] = STORAGE_SENSOR_ADXL345,
+    [STORAGE_RAW_ADXL345_Z] = STORAGE_SENSOR_ADXL345,
+};
+
+uint8_t storage_raw_sensor(uint8_t channel)
+{
+    return channel < STORAGE_RAW_CHANNEL_COUNT ? s_raw_sensor[channel] : STORAGE_SENSOR_COUNT;
+}
+
+bool storage_block_add_sample(storage_block_builder_t *b, uint8_t sensor_id, uint32_t timestamp, float value)
+{
+    uint8_t rec[1 + 5 + 5];
+    uint32_t delta;
+
+    bool series = b->sample_encoding == STORAGE_ENCODING_SERIES;
+
+    if ((b->count > 0 && b->encoding != b->sample_encoding) || (series && sensor_id >= STORAGE_SENSOR_COUNT) ||
+        !block_reserve_ts(b, timestamp, &delta)) {
+        return false;
+    }
+    if (b->count == 0) {
+        b->encoding = b->sample_encoding;
+        storage_series_reset(b->series, timestamp);
+    }
+
+    int32_t scaled = (int32_t)lroundf(value * STORAGE_VALUE_SCALE);
+    size_t n = 0, bits = 0;
+    if (series) {
+        bits = storage_series_sample_bits(b->series, sensor_id, timestamp, scaled);
+    } else {
+        rec[n++] = sensor_id;
+        n += varint_put(&rec[n], delta);
+        n += varint_put(&rec[n], zigzag_encode(scaled));
+    }
+
+    storage_zone_t *zone = sensor_id < STORAGE_SENSOR_COUNT ? &b->zones[sensor_id] : NULL;
+    storage_zone_t updated;
+    if (zone != NULL) {
+        zone_add(zone, sensor_id, scaled, &updated);
+    }
+
+    size_t summary_len = summary_len_with(b, timestamp, zone, zone ? &updated : NULL);
+    size_t len = series ? series_len_with(b, bits) : b->len + n;
+    if (len + summary_len > b->cap) {
+        return false;
+    }
+    if (series) {
+        storage_series_put_sample(&b->buf[STORAGE_BLOCK_HEADER_SIZE], &b->bits, b->series, sensor_id, timestamp,
+                                  scaled);
+    } else {
+        memcpy(&b->buf[b->len], rec, n);
+    }
+    b->len = len;
+    b->summary_len = summary_len;
+    if (zone != NULL) {
+        *zone = updated;
+    }
+    b->last_ts = timestamp;
+    b->sensors |= STORAGE_SENSOR_BIT(sensor_id);
+    b->count++;
+    return true;
+}
+
+bool storage_block_add_raw(storage_block_builder_t *b, const storage_sample_t *sample, float value)
+{
+    uint8_t rec[3 * (1 + 5 + 5)];
+    int32_t codes[3] = { sample->code };
+    size_t records = 1;
+    uint32_t delta;
+
+    bool series = b->sample_encoding == STORAGE_ENCODING_SERIES;
+    uint8_t sensor_id = sample->sensor_id;
+
+    if (sample->raw == STORAGE_RAW_ADXL345_X) {
+        codes[0] = sample->axes[0];
+        codes[1] = sample->axes[1];
+        codes[2] = sample->axes[2];
+        records = 3;
+    }
+    if (sample->raw == STORAGE_RAW_NONE || sample->raw == STORAGE_RAW_ADXL345_Y ||
+        sample->raw == STORAGE_RAW_ADXL345_Z || sensor_id >= STORAGE_SENSOR_COUNT ||
+        storage_raw_sensor(sample->raw) != sensor_id || (b->count > 0 && b->encoding != b->sample_encoding) ||
+        b->count > UINT16_MAX - records || !block_reserve_ts(b, sample->timestamp, &delta)) {
+        return false;
+    }
+    if (b->count == 0) {
+        b->encoding = b->sample_encoding;
+        storage_series_reset(b->series, sample->timestamp);
+    }
+
+    size_t n = 0, bits = 0;
+    for (size_t i = 0; i < records; i++) {
+        uint8_t channel = sample->raw + i;
+        if (series) {
+            bits += storage_series_raw_bits(b->series, channel, sample->timestamp, codes[i]);
+        } else {
+            rec[n++] = STORAGE_RECORD_RAW + channel;
+            n += varint_put(&rec[n], i == 0 ? delta : 0);
+            n += varint_put(&rec[n], zigzag_encode(codes[i]));
+        }
+    }
+
+    storage_zone_t *zone = &b->zones[sensor_id];
+    storage_zone_t updated;
+    if (isnan(value)) {
+        // Unknown in units until converted on read; no scan may rule it out
+        zone_add(zone, sensor_id, INT32_MIN, &updated);
+        updated.sum = zone->sum;
+        updated.max = INT32_MAX;
+    } else {
+        zone_add(zone, sensor_id, (int32_t)lroundf(value * STORAGE_VALUE_SCALE), &updated);
+    }
+
+    size_t summary_len = summary_len_with(b, sample->timestamp, zone, &updated);
+    size_t len = series ? series_len_with(b, bits) : b->len + n;
+    if (len + summary_len > b->cap) {
+        return false;
+    }
+    if (series) {
+        for (size_t i = 0; i < records; i++) {
+            storage_series_put_raw(&b->buf[STORAGE_BLOCK_HEADER_SIZE], &b->bits, b->series, sample->raw + i,
+                                   sample->timestamp, codes[i]);
+        }
+    } else {
+        memcpy(&b->buf[b->len], rec, n);
+    }
+    b->len = len;
+    b->summary_len = summary_len;
+    *zone = updated;
+    b->last_ts = sample->timestamp;
+    b->sensors |= STORAGE_SENSOR_BIT(sensor_id);
+    b->count += records;
+    return true;
+}
+
+bool storage_block_add_note(storage_block_builder_t *b, uint32_t timestamp, const char *text)
+{
+    uint32_t delta;
+    size_t text_len = strnlen(text, STORAGE_NOTE_MAX_LEN);
+
+    bool series = b->sample_encoding == STORAGE_ENCODING_SERIES;
+
+    if ((b->count > 0 && b->encoding != b->sample_encoding) || !block_reserve_ts(b, timestamp, &delta)) {
+        return false;
+    }
+    if (b->count == 0) {
+        b->encoding = b->sample_encoding;
+        storage_series_reset(b->series, timestamp);
+    }
+
+    uint8_t hdr[1 + 5 + 5];
+    size_t n = 0, len;
+    if (series) {
+        len = series_len_with(b, storage_series_note_bits(b->series, timestamp, text_len, b->bits));
+    } else {
+        hdr[n++] = STORAGE_RECORD_NOTE;
+        n += varint_put(&hdr[n], delta);
+        n += varint_put(&hdr[n], (uint32_t)text_len);
+        len = b->len + n + text_len;
+    }
+
+    size_t summary_len = summary_len_with(b, timestamp, NULL, NULL);
+    if (len + summary_len > b->cap) {
+        return false;
+    }
+    if (series) {
+        storage_series_put_note(&b->buf[STORAGE_BLOCK_HEADER_SIZE], &b->bits, b->series, timestamp, text, text_len);
+    } else {
+        memcpy(&b->buf[b->len], hdr, n);
+        memcpy(&b->buf[b->len + n], text, text_len);
+    }
+    b->len = len;
+    b->summary_len = summary_len;
+    b->last_ts = timestamp;
+    b->sensors |= STORAGE_SENSOR_BIT(STORAGE_RECORD_NOTE);
+    b->count++;
+    return true;
+}
+
+bool storage_block_add_rollup(storage_block_builder_t *b, uint8_t sensor_id, uint32_t bucket_ts,
+                              uint32_t count, int32_t min, int32_t max, int64_t sum)
+{
+    uint8_t rec[1 + 5 + 5 + 5 + 5 + 10];
+    uint32_t delta;
+
+    if (sensor_id >= STORAGE_SENSOR_COUNT || count == 0 ||
+        (b->count > 0 && b->encoding != STORAGE_ENCODING_ROLLUP) || !block_reserve_ts(b, bucket_ts, &delta)) {
+        return false;
+    }
+
+    size_t n = 0;
+    rec[n++] = sensor_id;
+    n += varint_put(&rec[n], delta);
+    n += varint_put(&rec[n], count);
+    n += varint_put(&rec[n], zigzag_encode(min));
+    n += varint_put(&rec[n], zigzag_encode(max));
+    n += varint64_put(&rec[n], zigzag64_encode(sum));
+
+    storage_zone_t *zone = &b->zones[sensor_id];
+    storage_zone_t updated = *zone;
+    if (updated.count == 0) {
+        updated.sensor_id = sensor_id;
+        updated.min = min;
+        updated.max = max;
+    }
+    updated.count++;
+    updated.min = min < updated.min ? min : updated.min;
+    updated.max = max > updated.max ? max : updated.max;
+    updated.sum += sum;
+
+    size_t summary_len = summary_len_with(b, bucket_ts, zone, &updated);
+    if (b->len + n + summary_len > b->cap) {
+        return false;
+    }
+    memcpy(&b->buf[b->len], rec, n);
+    b->len += n;
+    b->summary_len = summary_len;
+    *zone = updated;
+    b->encoding = STORAGE_ENCODING_ROLLUP;
+    b->last_ts = bucket_ts;
+    b->sensors |= STORAGE_SENSOR_BIT(sensor_id);
+    b->count++;
+    return true;
+}
+
+void storage_block_span(const storage_block_builder_t *b, storage_span_t *span)
+{
+    // Timestamps never go backwards inside a block
+    if (b->count == 0) {
+        storage_span_reset(span);
+        return;
+    }
+    span->min_ts = b->base_ts;
+    span->max_ts = b->last_ts;
+    span->sensors = b->sensors;
+    for (int i = 0; i < STORAGE_SENSOR_COUNT; i++) {
+        span->counts[i] = b->zones[i].count;
+    }
+}
+
+static inline uint16_t count_add(uint16_t a, uint32_t b)
+{
+    return a + b > UINT16_MAX ? UINT16_MAX : a + b;
+}
+
+void storage_span_add(storage_span_t *span, uint32_t timestamp, uint8_t sensor_id)
+{
+    if (timestamp < span->min_ts) {
+        span->min_ts = timestamp;
+    }
+    if (timestamp > span->max_ts) {
+        span->max_ts = timestamp;
+    }
+    span->sensors |= STORAGE_SENSOR_BIT(sensor_id);
+    if (sensor_id < STORAGE_SENSOR_COUNT) {
+        span->counts[sensor_id] = count_add(span->counts[sensor_id], 1);
+    }
+}
+
+void storage_span_merge(storage_span_t *span, const storage_span_t *other)
+{
+    if (other->sensors == 0) {
+        return;
+    }
+    if (other->min_ts < span->min_ts) {
+        span->min_ts = other->min_ts;
+    }
+    if (other->max_ts > span->max_ts) {
+        span->max_ts = other->max_ts;
+    }
+    span->sensors |= other->sensors;
+    for (int i = 0; i < STORAGE_SENSOR_COUNT; i++) {
+        span->counts[i] = count_add(span->counts[i], other->counts[i]);
+    }
+}
+
+bool storage_span_overlaps(const storage_span_t *span, uint32_t sensors, uint32_t t_from, uint32_t t_to)
+{
+    return (span->sensors & sensors) != 0 && span->min_ts <= t_to && span->max_ts >= t_from;
+}
+
+static size_t summary_encode(const storage_block_builder_t *b, uint8_t *out)
+{
+    size_t n = varint_put(out, b->last_ts - b->base_ts);
+    uint8_t *zone_count = &out[n++];
+
+    *zone_count = 0;
+    for (int i = 0; i < STORAGE_SENSOR_COUNT; i++) {
+        const storage_zone_t *z = &b->zones[i];
+        if (z->count == 0) {
+            continue;
+        }
+        out[n++] = z->sensor_id;
+        n += varint_put(&out[n], z->count);
+        n += varint_put(&out[n], zigzag_encode(z->min));
+        n += varint_put(&out[n], zigzag_encode(z->max));
+        n += varint64_put(&out[n], zigzag64_encode(z->sum));
+        (*zone_count)++;
+    }
+    return n;
+}
+
+size_t storage_block_seal(storage_block_builder_t *b)
+{
+    uint8_t *h = b->buf;
+
+    if (b->count > 0) {
+        // Records were written right after the header; make room in front
+        uint8_t *records = &h[STORAGE_BLOCK_HEADER_SIZE];
+        memmove(records + b->summary_len, records, b->len - STORAGE_BLOCK_HEADER_SIZE);
+        summary_encode(b, records);
+        b->len += b->summary_len;
+        b->summary_len = 0;
+    }
+
+    put_u16(&h[0], STORAGE_BLOCK_MAGIC);
+    h[2] = STORAGE_FORMAT_VERSION;
+    h[3] = b->encoding;
+    put_u32(&h[4], b->base_ts);
+    put_u16(&h[8], b->count);
+    put_u16(&h[10], (uint16_t)(b->len - STORAGE_BLOCK_HEADER_SIZE));
+
+    uint32_t crc = storage_crc32(0, h, 12);
+    crc = storage_crc32(crc, &h[STORAGE_BLOCK_HEADER_SIZE], b->len - STORAGE_BLOCK_HEADER_SIZE);
+    put_u32(&h[12], crc);
+    return b->len;
+}
+
+esp_err_t storage_block_parse_header(const uint8_t *buf, size_t len, storage_block_header_t *hdr)
+{
+    if (len < STORAGE_BLOCK_HEADER_SIZE || get_u16(buf) != STORAGE_BLOCK_MAGIC) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    hdr->version = buf[2];
+    hdr->encoding = buf[3];
+    hdr->base_ts = get_u32(&buf[4]);
+    hdr->count = get_u16(&buf[8]);
+    hdr->payload_len = get_u16(&buf[10]);
+    hdr->crc = get_u32(&buf[12]);
+
+    if (hdr->version < STORAGE_FORMAT_VERSION_MIN || hdr->version > STORAGE_FORMAT_VERSION) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (hdr->payload_len > STORAGE_BLOCK_SIZE - STORAGE_BLOCK_HEADER_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t storage_block_iter_init(storage_block_iter_t *it, const uint8_t *block, size_t len)
+{
+    storage_block_header_t hdr;
+    esp_err_t err = storage_block_parse_header(block, len, &hdr);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (len < (size_t)STORAGE_BLOCK_HEADER_SIZE + hdr.payload_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const uint8_t *p = &block[STORAGE_BLOCK_HEADER_SIZE];
+    uint32_t crc = storage_crc32(0, block, 12);
+    if (storage_crc32(crc, p, hdr.payload_len) != hdr.crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    if (hdr.encoding != STORAGE_ENCODING_PLAIN && hdr.encoding != STORAGE_ENCODING_ROLLUP &&
+        hdr.encoding != STORAGE_ENCODING_SERIES) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    size_t skip = 0;
+    if (hdr.version >= 2) {
+        storage_block_summary_t summary;
+        if ((skip = storage_block_summary_parse(p, hdr.payload_len, &summary)) == 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    it->payload = p + skip;
+    it->pos = 0;
+    it->len = hdr.payload_len - skip;
+    it->ts = hdr.base_ts;
+    it->remaining = hdr.count;
+    it->encoding = hdr.encoding;
+    if (hdr.encoding == STORAGE_ENCODING_SERIES) {
+        storage_series_reset(it->series, hdr.base_ts);
+    }
+    return ESP_OK;
+}
+
+size_t storage_block_summary_parse(const uint8_t *payload, size_t len, storage_block_summary_t *summary)
+{
+    uint32_t v;
+    uint64_t v64;
+    size_t pos, n;
+
+    if ((pos = varint_get(payload, len, &summary->ts_span)) == 0 || pos >= len) {
+        return 0;
+    }
+    summary->zone_count = payload[pos++];
+    if (summary->zone_count > STORAGE_SENSOR_COUNT) {
+        return 0;
+    }
+
+    for (int i = 0; i < summary->zone_count; i++) {
+        storage_zone_t *z = &summary->zones[i];
+        if (pos >= len) {
+            return 0;
+        }
+        z->sensor_id = payload[pos++];
+        if ((n = varint_get(&payload[pos], len - pos, &v)) == 0) {
+            return 0;
+        }
+        z->count = (uint16_t)v;
+        pos += n;
+        if ((n = varint_get(&payload[pos], len - pos, &v)) == 0) {
+            return 0;
+        }
+        z->min = zigzag_decode(v);
+        pos += n;
+        if ((n = varint_get(&payload[pos], len - pos, &v)) == 0) {
+            return 0;
+        }
+        z->max = zigzag_decode(v);
+        pos += n;
+        if ((n = varint64_get(&payload[pos], len - pos, &v64)) == 0) {
+            return 0;
+        }
+        z->sum = zigzag64_decode(v64);
+        pos += n;
+    }
+    return pos;
+}
+
+const storage_zone_t *storage_block_summary_zone(const storage_block_summary_t *summary, uint8_t sensor_id)
+{
+    for (int i = 0; i < summary->zone_count; i++) {
+        if (summary->zones[i].sensor_id == sensor_id) {
+            return &summary->zones[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t storage_block_iter_next(storage_block_iter_t *it, storage_record_t *rec)
+{
+    const uint8_t *p = it->payload;
+    uint32_t v;
+    size_t n;
+
+    if (it->remaining == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (it->encoding == STORAGE_ENCODING_SERIES) {
+        uint32_t bit = it->pos;
+        esp_err_t err = storage_series_get(p, it->len, &bit, it->series, rec);
+        if (err == ESP_OK) {
+            it->pos = bit;
+            it->ts = rec->timestamp;
+            it->remaining--;
+        }
+        return err;
+    }
+    if (it->pos >= it->len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    rec->sensor_id = p[it->pos++];
+
+    if ((n = varint_get(&p[it->pos], it->len - it->pos, &v)) == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    it->pos += n;
+    it->ts += v;
+    rec->timestamp = it->ts;
+
+    if ((n = varint_get(&p[it->pos], it->len - it->pos, &v)) == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    it->pos += n;
+
+    if (it->encoding == STORAGE_ENCODING_ROLLUP) {
+        uint32_t min, max;
+        uint64_t sum;
+        if ((n = varint_get(&p[it->pos], it->len - it->pos, &min)) == 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        it->pos += n;
+        if ((n = varint_get(&p[it->pos], it->len - it->pos, &max)) == 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        it->pos += n;
+        if ((n = varint64_get(&p[it->pos], it->len - it->pos, &sum)) == 0 || v == 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        it->pos += n;
+        rec->count = v;
+        rec->min = (float)zigzag_decode(min) / STORAGE_VALUE_SCALE;
+        rec->max = (float)zigzag_decode(max) / STORAGE_VALUE_SCALE;
+        rec->value = (float)((double)zigzag64_decode(sum) / v / STORAGE_VALUE_SCALE);
+    } else if (rec->sensor_id == STORAGE_RECORD_NOTE) {
+        if (v > it->len - it->pos) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        rec->note = (const char *)&p[it->pos];
+        rec->note_len = (uint8_t)v;
+        it->pos += v;
+    } else if (rec->sensor_id > STORAGE_RECORD_RAW && rec->sensor_id < STORAGE_RECORD_RAW + STORAGE_RAW_CHANNEL_COUNT) {
+        rec->raw = rec->sensor_id - STORAGE_RECORD_RAW;
+        rec->sensor_id = storage_raw_sensor(rec->raw);
+        rec->value = (float)zigzag_decode(v);
+        rec->min = rec->value;
+        rec->max = rec->value;
+        rec->count = 1;
+    } else {
+        rec->value = (float)zigzag_decode(v) / STORAGE_VALUE_SCALE;
+        rec->min = rec->value;
+        rec->max = rec->value;
+        rec->count = 1;
+    }
+
+    it->remaining--;
+    return ESP_OK;
+}
+
+esp_err_t storage_block_decode(const uint8_t *block, size_t len, storage_record_cb_t cb, void *ctx)
+{
+    storage_block_iter_t it;
+    storage_record_t rec;
+
+    esp_err_t err = storage_block_iter_init(&it, block, len);
+    while (err == ESP_OK && (err = storage_block_iter_next(&it, &rec)) == ESP_OK) {
+        if (cb) {
+            cb(&rec, ctx);
+        }
+    }
+    return err == ESP_ERR_NOT_FOUND ? ESP_OK : err;
+}
+
+int storage_record_to_csv(const storage_record_t *record, char *out, size_t len)
+{
+    if (record->sensor_id == STORAGE_RECORD_NOTE) {
+        return snprintf(out, len, "%.*s", record->note_len, record->note);
+    }
+    if (record->raw != STORAGE_RAW_NONE) {
+        // No calibration to convert it with
+        return snprintf(out, len, "%s;%lu;%ld;raw", storage_sensor_name(record->sensor_id),
+                        (unsigned long)record->timestamp, (long)record->value);
+    }
+    return snprintf(out, len, "%s;%lu;%.3f", storage_sensor_name(record->sensor_id),
+                    (unsigned long)record->timestamp, record->value);
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_err.h"
+#include "storage_manager.h"
+
+/*
+ * On-flash log format, version 3.
+ *
+ * The log is a sequence of self-contained blocks, each protected by a CRC32
+ * (IEEE 802.3, same as zlib.crc32) over the header (minus the crc field)
+ * and the payload. All integers are little-endian.
+ *
+ *  off  size  field
+ *  0    2     magic        0x4C53 ("SL")
+ *  2    1     version      STORAGE_FORMAT_VERSION
+ *  3    1     encoding     STORAGE_ENCODING_PLAIN, _ROLLUP or _SERIES
+ *  4    4     base_ts      timestamp of the first record
+ *  8    2     count        number of records
+ *  10   2     payload_len  bytes following the header
+ *  12   4     crc32
+ *
+ * Version 2 payloads start with a block summary (zone map), so scans can
+ * rule a block out after reading only the header and the summary:
+ *  varint  ts_span      last record timestamp - base_ts
+ *  u8      zone count   one zone per sensor id present in the block
+ *  per zone:
+ *   u8      sensor id
+ *   varint  count
+ *   zig-zag varint  min * STORAGE_VALUE_SCALE
+ *   zig-zag varint  max * STORAGE_VALUE_SCALE
+ *   zig-zag varint  sum * STORAGE_VALUE_SCALE (up to 64 bits)
+ * Notes have no zone. Version 1 blocks have no summary and are still read.
+ * Raw codes count in the zone of their sensor once per sample, with the
+ * value in units as converted when the block was written. A code written
+ * before its sensor had a calibration widens the zone to the full range.
+ *
+ * Plain records follow, one after another:
+ *  u8      sensor id (storage_sensor_id_t), STORAGE_RECORD_NOTE or
+ *          STORAGE_RECORD_RAW + storage_raw_channel_t
+ *  varint  timestamp delta to the previous record (base_ts for the first)
+ *  sensor: zig-zag varint, value * STORAGE_VALUE_SCALE
+ *  raw:    zig-zag varint, the sensor code (version 3)
+ *  note:   varint length, then the raw text bytes
+ * The three ADXL345 axes of a raw sample are consecutive records of the
+ * same block.
+ *
+ * Rollup records (one aggregation bucket of one sensor each):
+ *  u8      sensor id
+ *  varint  bucket start delta to the previous record
+ *  varint  sample count
+ *  zig-zag varint  min, max (value * STORAGE_VALUE_SCALE)
+ *  zig-zag varint  sum (value * STORAGE_VALUE_SCALE, up to 64 bits)
+ * In rollup blocks a zone counts rollup records and aggregates their
+ * min, max and sum.
+ *
+ * Series blocks hold the same records as plain ones, bit-packed with
+ * delta-of-delta timestamps and per-sensor value deltas; the layout is
+ * described in storage_series.h.
+ *
+ * tools/storage_decode.py implements the same layout on the host.
+ */
+
+#define STORAGE_BLOCK_MAGIC 0x4C53
+#define STORAGE_FORMAT_VERSION 3
+#define STORAGE_FORMAT_VERSION_MIN 1
+#define STORAGE_ENCODING_PLAIN 0
+#define STORAGE_ENCODING_ROLLUP 1
+#define STORAGE_ENCODING_SERIES 2
+#define STORAGE_BLOCK_HEADER_SIZE 16
+
+#define STORAGE_RECORD_NOTE 0x7F
+#define STORAGE_RECORD_RAW 0x40
+#define STORAGE_VALUE_SCALE 1000
+#define STORAGE_NOTE_MAX_LEN 96 // series notes allow up to 127
+
+// Largest possible summary: ts_span, zone count, and per zone the sensor
+// id, a 3-byte count, two 5-byte and one 10-byte varint
+#define STORAGE_SUMMARY_MAX_SIZE (5 + 1 + STORAGE_SENSOR_COUNT * (1 + 3 + 5 + 5 + 10))
+
+typedef struct {
+    uint8_t version;
+    uint8_t encoding;
+    uint32_t base_ts;
+    uint16_t count;
+    uint16_t payload_len;
+    uint32_t crc;
+} storage_block_header_t;
+
+// Bit for a record's sensor id in a sensor bitmap; notes share the top bit
+#define STORAGE_SENSOR_BIT(id) ((id) < 31 ? (1UL << (id)) : (1UL << 31))
+
+// Time range, sensor bitmap and per-sensor record counts covered by one
+// or more blocks
+typedef struct {
+    uint32_t min_ts;
+    uint32_t max_ts;
+    uint32_t sensors; // 0 when nothing has been recorded
+    uint16_t counts[STORAGE_SENSOR_COUNT]; // saturating; notes are not counted
+} storage_span_t;
+
+// Per-sensor zone map entry; values are scaled by STORAGE_VALUE_SCALE
+typedef struct {
+    uint8_t sensor_id;
+    uint16_t count;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+} storage_zone_t;
+
+typedef struct {
+    uint32_t ts_span;
+    uint8_t zone_count;
+    storage_zone_t zones[STORAGE_SENSOR_COUNT];
+} storage_block_summary_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    uint16_t count;
+    uint32_t base_ts;
+    uint32_t last_ts;
+    uint32_t sensors;
+    uint8_t encoding;
+    uint8_t sample_encoding;                    // PLAIN or SERIES, used for samples and notes
+    storage_zone_t zones[STORAGE_SENSOR_COUNT]; // indexed by sensor id, count 0 = absent
+    size_t summary_len;                         // encoded size of the summary so far
+    uint32_t bits;                              // series blocks: bits of records written
+    storage_series_ctx_t series[STORAGE_SENSOR_COUNT + STORAGE_RAW_CHANNEL_COUNT];
+} storage_block_builder_t;
+
+typedef void (*storage_record_cb_t)(const storage_record_t *record, void *ctx);
+
+uint32_t storage_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+void storage_block_begin(storage_block_builder_t *b, uint8_t *buf, size_t cap);
+
+/**
+ * @brief Like storage_block_begin(), but samples and notes are stored with
+ * the given encoding (STORAGE_ENCODING_PLAIN or STORAGE_ENCODING_SERIES).
+ */
+void storage_block_begin_encoded(storage_block_builder_t *b, uint8_t *buf, size_t cap, uint8_t sample_encoding);
+
+/**
+ * @brief Append a record to the block being built.
+ *
+ * @return false if the record does not fit or the timestamp went backwards;
+ *         the caller should seal the block and start a new one.
+ */
+bool storage_block_add_sample(storage_block_builder_t *b, uint8_t sensor_id, uint32_t timestamp, float value);
+bool storage_block_add_note(storage_block_builder_t *b, uint32_t timestamp, const char *text);
+
+/**
+ * @brief Append the records of a raw sample (one code, or three ADXL345
+ * axes) as a unit. value is the sample in units, for the zone map; NAN
+ * when there is no calibration yet widens the zone to any value.
+ */
+bool storage_block_add_raw(storage_block_builder_t *b, const storage_sample_t *sample, float value);
+
+/**
+ * @return the sensor a raw channel belongs to
+ */
+uint8_t storage_raw_sensor(uint8_t channel);
+
+// Y and Z records of a raw ADXL345 sample; the sample counts once, on X
+static inline bool storage_record_continues(const storage_record_t *record)
+{
+    return record->raw == STORAGE_RAW_ADXL345_Y || record->raw == STORAGE_RAW_ADXL345_Z;
+}
+
+/**
+ * @brief Append an aggregated bucket; turns the block into a rollup block.
+ * Plain and rollup records never share a block.
+ */
+bool storage_block_add_rollup(storage_block_builder_t *b, uint8_t sensor_id, uint32_t bucket_ts,
+                              uint32_t count, int32_t min, int32_t max, int64_t sum);
+
+static inline bool storage_block_empty(const storage_block_builder_t *b)
+{
+    return b->count == 0;
+}
+
+/**
+ * @brief Time range and sensors of the records added so far.
+ */
+void storage_block_span(const storage_block_builder_t *b, storage_span_t *span);
+
+static inline void storage_span_reset(storage_span_t *span)
+{
+    span->min_ts = UINT32_MAX;
+    span->max_ts = 0;
+    span->sensors = 0;
+    memset(span->counts, 0, sizeof(span->counts));
+}
+
+void storage_span_add(storage_span_t *span, uint32_t timestamp, uint8_t sensor_id);
+void storage_span_merge(storage_span_t *span, const storage_span_t *other);
+
+/**
+ * @brief Check whether a span may hold records of the given sensors
+ * inside [t_from, t_to].
+ */
+bool storage_span_overlaps(const storage_span_t *span, uint32_t sensors, uint32_t t_from, uint32_t t_to);
+
+/**
+ * @brief Insert the summary in front of the records and fill in the
+ * header and CRC. The builder must be restarted with storage_block_begin()
+ * afterwards.
+ *
+ * @return total block length (header + payload)
+ */
+size_t storage_block_seal(storage_block_builder_t *b);
+
+/**
+ * @brief Decode the summary at the start of a version 2 payload. The CRC
+ * is not checked, so callers may pass just the first bytes of a block to
+ * decide whether the rest is worth reading.
+ *
+ * @return bytes consumed, 0 if the summary is malformed or truncated
+ */
+size_t storage_block_summary_parse(const uint8_t *payload, size_t len, storage_block_summary_t *summary);
+
+/**
+ * @return the zone for sensor_id, or NULL if the block holds none of its samples
+ */
+const storage_zone_t *storage_block_summary_zone(const storage_block_summary_t *summary, uint8_t sensor_id);
+
+/**
+ * @brief Parse and sanity check a block header. Does not verify the CRC.
+ */
+esp_err_t storage_block_parse_header(const uint8_t *buf, size_t len, storage_block_header_t *hdr);
+
+/**
+ * @brief Verify the CRC of a complete block and prepare to walk its records.
+ *
+ * @param block Header followed by hdr.payload_len payload bytes; must stay
+ *              valid while the iterator is in use
+ */
+esp_err_t storage_block_iter_init(storage_block_iter_t *it, const uint8_t *block, size_t len);
+
+/**
+ * @brief Decode the next record. Note text points into the block.
+ *
+ * @return ESP_ERR_NOT_FOUND after the last record
+ */
+esp_err_t storage_block_iter_next(storage_block_iter_t *it, storage_record_t *record);
+
+/**
+ * @brief Verify the CRC of a complete block and call cb for every record.
+ *
+ * @param block Header followed by hdr.payload_len payload bytes
+ */
+esp_err_t storage_block_decode(const uint8_t *block, size_t len, storage_record_cb_t cb, void *ctx);
+
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "storage_manager.h"
+#include "storage_log.h"
+
+#define STORAGE_PARTITION_NAME "storage"
+
+void storage_writer_start(void);
+// No samples waiting in the writer queue
+bool storage_writer_idle(void);
+
+// The log is shared by the writer task and the public API, every access
+// below has to happen between storage_lock/unlock. The lock is recursive.
+// Appends, trims and clears stay serialized by it; block reads are the
+// exception, see storage_read_begin().
+void storage_lock(void);
+void storage_unlock(void);
+storage_log_t* storage_main_log(void);
+bool storage_mounted(void);
+
+// Readers take a snapshot of the head under the lock and then read with
+// storage_log_read_snapshot() between these two, which only lock if the
+// backend cannot read while the writer appends. Sampling never waits for
+// a reader's flash reads.
+void storage_read_begin(const storage_log_t* log);
+void storage_read_end(const storage_log_t* log);
+
+// Recompute the cached free space after the log changed
+void storage_space_refresh(void);
+
+// Quotas and load shedding (storage_quota.c). Everything but the first two
+// runs under the storage lock: admit decides whether the writer stores a
+// sample in the raw log, before_append whether its block may go in (false
+// when that would reclaim a segment of the active session), refresh
+// recomputes per-sensor usage and pressure after the log changed.
+uint8_t storage_quota_priority(uint8_t sensor_id);
+void storage_quota_count_dropped(uint8_t sensor_id);
+bool storage_quota_admit(const storage_sample_t* sample);
+bool storage_quota_before_append(const storage_log_t* log, size_t len, const storage_span_t* span);
+void storage_quota_refresh(const storage_log_t* log);
+
+// Calibration of raw sensor codes (storage_calib.c). Restore loads the
+// history from NVS before the writer starts. to_units converts a queued
+// raw sample; calib_next is storage_block_iter_next() for readers, it
+// hands out raw codes converted and the three ADXL345 axes as one record.
+// Both leave codes as they are when there is no calibration for them.
+void storage_calib_restore(void);
+bool storage_calib_to_units(const storage_sample_t* sample, storage_sample_t* out);
+esp_err_t storage_calib_next(storage_block_iter_t* it, storage_record_t* record);
+
+// Loads the acknowledged upload position from NVS and trims the log
+// behind it; called once after the log is mounted.
+void storage_upload_restore(void);
+
+// Records go into the RAM block owned by the writer; the block reaches
+// the log only on storage_block_commit() (or when it fills up).
+bool storage_block_append_sample(const storage_sample_t* sample);
+bool storage_block_append_note(uint32_t timestamp, const char* text);
+bool storage_block_commit(void);
+
+// storage_scan() on any log instance; use_summaries = false decodes every
+// block in the time window, for comparison in the benchmark.
+esp_err_t storage_scan_log(storage_log_t* log, const storage_predicate_t* pred, bool use_summaries,
+                           storage_query_cb_t cb, void* ctx, storage_query_stats_t* stats);
+
+// Rollup tiers (storage_rollup.c) live in their own logs after the raw one
+// and are fed from storage_block_append_sample(), under the storage lock.
+uint32_t storage_rollup_segments(void);
+esp_err_t storage_rollup_mount(storage_backend_t* backend, uint32_t base);
+void storage_rollup_add(const storage_sample_t* sample);
+// Close buckets time has moved past; commit rollup blocks that are older
+// than STORAGE_ROLLUP_FLUSH_AGE_MS, or all of them when force is set
+void storage_rollup_flush(bool force);
+esp_err_t storage_rollup_clear(void);
+
+// NULL if the tier is not mounted
+storage_log_t* storage_tier_log(storage_tier_t tier);
+// Commit the RAM block that feeds this log, so scans see everything
+void storage_commit_pending(storage_log_t* log);
+
+// SD card archive (storage_archive.c): sealed raw segments are copied to
+// the card by a background task. Restore runs once after the log is
+// mounted; skip drops segments before seq from the copy queue (clear).
+void storage_archive_restore(void);
+void storage_archive_start(void);
+void storage_archive_skip(uint32_t seq);
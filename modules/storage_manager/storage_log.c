@@ -0,0 +1,441 @@
+#include "storage_log.h"
+#include "storage_format.h"
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "STORAGE_LOG";
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t reserved[3];
+    uint32_t seq;
+    uint32_t epoch_seq; // oldest live segment when this one was opened
+    uint32_t crc;
+} segment_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t min_ts;
+    uint32_t max_ts;
+    uint32_t sensors;
+    uint16_t counts[STORAGE_SENSOR_COUNT];
+    uint32_t crc;
+} segment_footer_t;
+
+_Static_assert(sizeof(segment_footer_t) <= STORAGE_SEGMENT_FOOTER_SIZE, "segment footer too large");
+
+// Shared by the walkers below; callers serialize through the storage lock.
+static uint8_t s_block_buf[STORAGE_BLOCK_SIZE];
+
+static bool read_segment_header(const storage_log_t *log, uint32_t index, segment_header_t *hdr)
+{
+    uint32_t offset = log->base + index * STORAGE_SEGMENT_SIZE;
+    if (storage_backend_read(log->backend, offset, hdr, sizeof(*hdr)) != ESP_OK) {
+        return false;
+    }
+    return hdr->magic == STORAGE_SEGMENT_MAGIC &&
+           hdr->version == STORAGE_SEGMENT_VERSION &&
+           hdr->seq % log->segment_count == index &&
+           storage_crc32(0, (const uint8_t *)hdr, offsetof(segment_header_t, crc)) == hdr->crc;
+}
+
+static bool is_erased(const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Walk the blocks of one segment, calling cb (if any) with every block.
+ * Returns the offset right after the last block; *clean tells whether the
+ * walk stopped at erased flash / end of segment rather than garbage.
+ */
+static uint32_t segment_walk(storage_log_t *log, uint32_t seq, storage_log_block_cb_t cb, void *ctx,
+                             bool *clean, bool *stopped)
+{
+    uint32_t seg_off = storage_log_segment_offset(log, seq);
+    uint32_t off = STORAGE_SEGMENT_HEADER_SIZE;
+    storage_block_header_t hdr;
+
+    *clean = true;
+    while (off + STORAGE_BLOCK_HEADER_SIZE <= STORAGE_SEGMENT_DATA_END) {
+        if (storage_backend_read(log->backend, seg_off + off, s_block_buf, STORAGE_BLOCK_HEADER_SIZE) != ESP_OK) {
+            *clean = false;
+            break;
+        }
+        if (is_erased(s_block_buf, STORAGE_BLOCK_HEADER_SIZE)) {
+            break;
+        }
+
+        size_t len;
+        if (storage_block_parse_header(s_block_buf, STORAGE_BLOCK_HEADER_SIZE, &hdr) != ESP_OK ||
+            off + (len = STORAGE_BLOCK_HEADER_SIZE + hdr.payload_len) > STORAGE_SEGMENT_DATA_END) {
+            *clean = false;
+            break;
+        }
+
+        if (cb != NULL) {
+            if (storage_backend_read(log->backend, seg_off + off + STORAGE_BLOCK_HEADER_SIZE,
+                                     &s_block_buf[STORAGE_BLOCK_HEADER_SIZE], hdr.payload_len) != ESP_OK) {
+                *clean = false;
+                break;
+            }
+            if (!cb(s_block_buf, len, seq, off, ctx)) {
+                *stopped = true;
+                off += len;
+                break;
+            }
+        }
+        off += len;
+    }
+    return off;
+}
+
+static void span_record_cb(const storage_record_t *record, void *ctx)
+{
+    if (storage_record_continues(record)) {
+        return;
+    }
+    storage_span_add(ctx, record->timestamp, record->sensor_id);
+}
+
+static bool span_block_cb(const uint8_t *block, size_t len, uint32_t seq, uint32_t off, void *ctx)
+{
+    (void)seq;
+    (void)off;
+    storage_block_decode(block, len, span_record_cb, ctx);
+    return true;
+}
+
+// Rebuild a segment's index entry from its footer, or by decoding its blocks
+static uint32_t segment_index(storage_log_t *log, uint32_t seq, bool sealed, bool *clean)
+{
+    storage_span_t *span = &log->index[seq % log->segment_count];
+    segment_footer_t footer;
+    bool stopped = false;
+
+    if (sealed &&
+        storage_backend_read(log->backend, storage_log_segment_offset(log, seq) + STORAGE_SEGMENT_DATA_END,
+                             &footer, sizeof(footer)) == ESP_OK &&
+        footer.magic == STORAGE_SEGMENT_FOOTER_MAGIC &&
+        storage_crc32(0, (const uint8_t *)&footer, offsetof(segment_footer_t, crc)) == footer.crc) {
+        span->min_ts = footer.min_ts;
+        span->max_ts = footer.max_ts;
+        span->sensors = footer.sensors;
+        memcpy(span->counts, footer.counts, sizeof(span->counts));
+        *clean = true;
+        return STORAGE_SEGMENT_SIZE;
+    }
+
+    storage_span_reset(span);
+    return segment_walk(log, seq, span_block_cb, span, clean, &stopped);
+}
+
+static void seal_segment(storage_log_t *log)
+{
+    const storage_span_t *span = storage_log_segment_span(log, log->head_seq);
+    segment_footer_t footer = {
+        .magic = STORAGE_SEGMENT_FOOTER_MAGIC,
+        .min_ts = span->min_ts,
+        .max_ts = span->max_ts,
+        .sensors = span->sensors,
+    };
+    memcpy(footer.counts, span->counts, sizeof(footer.counts));
+    footer.crc = storage_crc32(0, (const uint8_t *)&footer, offsetof(segment_footer_t, crc));
+
+    // Best effort: without a footer the segment is decoded at mount instead
+    esp_err_t err = storage_backend_append(log->backend, storage_log_segment_offset(log, log->head_seq) +
+                                           STORAGE_SEGMENT_DATA_END, &footer, sizeof(footer));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Footer of segment %lu not written (%s)", (unsigned long)log->head_seq, esp_err_to_name(err));
+    }
+}
+
+static esp_err_t open_segment(storage_log_t *log, uint32_t seq, uint32_t epoch_seq)
+{
+    uint32_t offset = storage_log_segment_offset(log, seq);
+
+    // Snapshot readers stop trusting the segment this reuses from here on
+    __atomic_store_n(&log->open_seq, seq, __ATOMIC_RELEASE);
+    esp_err_t err = storage_backend_truncate(log->backend, offset, STORAGE_SEGMENT_SIZE);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Erase of segment %lu failed (%s)", (unsigned long)seq, esp_err_to_name(err));
+        return err;
+    }
+
+    segment_header_t hdr = {
+        .magic = STORAGE_SEGMENT_MAGIC,
+        .version = STORAGE_SEGMENT_VERSION,
+        .reserved = {0xFF, 0xFF, 0xFF},
+        .seq = seq,
+        .epoch_seq = epoch_seq,
+    };
+    hdr.crc = storage_crc32(0, (const uint8_t *)&hdr, offsetof(segment_header_t, crc));
+
+    err = storage_backend_append(log->backend, offset, &hdr, sizeof(hdr));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    __atomic_store_n(&log->tail_seq, epoch_seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&log->head_seq, seq, __ATOMIC_RELEASE);
+    log->write_off = STORAGE_SEGMENT_HEADER_SIZE;
+    storage_span_reset(&log->index[seq % log->segment_count]);
+    return ESP_OK;
+}
+
+esp_err_t storage_log_mount(storage_log_t *log, storage_backend_t *backend, uint32_t base, uint32_t segment_count,
+                            storage_span_t *index)
+{
+    if (backend == NULL || index == NULL || segment_count < 2 ||
+        base + segment_count * STORAGE_SEGMENT_SIZE > backend->stats.size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(log, 0, sizeof(*log));
+    log->backend = backend;
+    log->base = base;
+    log->segment_count = segment_count;
+    log->index = index;
+
+    segment_header_t hdr, head_hdr = { 0 };
+    bool found = false;
+
+    for (uint32_t i = 0; i < segment_count; i++) {
+        if (read_segment_header(log, i, &hdr) && (!found || hdr.seq > head_hdr.seq)) {
+            head_hdr = hdr;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        ESP_LOGW(TAG, "No log found at 0x%lx, formatting", (unsigned long)base);
+        return open_segment(log, 0, 0);
+    }
+
+    // Walk back from the head while the sequence stays contiguous
+    log->head_seq = head_hdr.seq;
+    log->tail_seq = head_hdr.seq;
+    while (log->tail_seq > head_hdr.epoch_seq &&
+           log->head_seq - log->tail_seq + 1 < segment_count &&
+           read_segment_header(log, (log->tail_seq - 1) % segment_count, &hdr) &&
+           hdr.seq == log->tail_seq - 1) {
+        log->tail_seq--;
+    }
+
+    log->open_seq = log->head_seq;
+
+    bool clean = true;
+    for (uint32_t seq = log->tail_seq; seq < log->head_seq; seq++) {
+        segment_index(log, seq, true, &clean);
+    }
+    log->write_off = segment_index(log, log->head_seq, false, &clean);
+    if (!clean) {
+        // Torn write in the head segment; seal it and continue in a fresh one
+        ESP_LOGW(TAG, "Head segment %lu damaged at +%lu", (unsigned long)log->head_seq, (unsigned long)log->write_off);
+        log->write_off = STORAGE_SEGMENT_SIZE;
+    }
+
+    ESP_LOGI(TAG, "Mounted: segments %lu..%lu, head at +%lu",
+             (unsigned long)log->tail_seq, (unsigned long)log->head_seq, (unsigned long)log->write_off);
+    return ESP_OK;
+}
+
+esp_err_t storage_log_append(storage_log_t *log, const uint8_t *block, size_t len, const storage_span_t *span)
+{
+    if (len > STORAGE_SEGMENT_DATA_END - STORAGE_SEGMENT_HEADER_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (log->write_off + len > STORAGE_SEGMENT_DATA_END) {
+        seal_segment(log);
+
+        uint32_t next = log->head_seq + 1;
+        uint32_t tail = log->tail_seq;
+        if (next - tail >= log->segment_count) {
+            tail = next - log->segment_count + 1;
+            log->reclaimed++;
+            ESP_LOGW(TAG, "Log full, reclaiming segment %lu", (unsigned long)(tail - 1));
+        }
+        esp_err_t err = open_segment(log, next, tail);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    esp_err_t err = storage_backend_append(log->backend,
+                                           storage_log_segment_offset(log, log->head_seq) + log->write_off, block, len);
+    if (err == ESP_OK) {
+        log->write_off += len;
+        storage_span_merge(&log->index[log->head_seq % log->segment_count], span);
+    }
+    return err;
+}
+
+esp_err_t storage_log_clear(storage_log_t *log)
+{
+    uint32_t next = log->head_seq + 1;
+    return open_segment(log, next, next);
+}
+
+void storage_log_trim(storage_log_t *log, uint32_t seq)
+{
+    if (seq > log->head_seq) {
+        seq = log->head_seq;
+    }
+    if (seq > log->tail_seq) {
+        // Persisted through the epoch_seq of the next segment header
+        __atomic_store_n(&log->tail_seq, seq, __ATOMIC_RELEASE);
+    }
+}
+
+uint32_t storage_log_expire(storage_log_t *log, uint32_t before_ts)
+{
+    uint32_t seq = log->tail_seq;
+    while (seq < log->head_seq && storage_log_segment_span(log, seq)->max_ts < before_ts) {
+        seq++;
+    }
+    uint32_t expired = seq - log->tail_seq;
+    storage_log_trim(log, seq);
+    return expired;
+}
+
+size_t storage_log_used_bytes(const storage_log_t *log)
+{
+    uint32_t sealed = log->head_seq - log->tail_seq;
+    return (size_t)sealed * STORAGE_SEGMENT_SIZE + log->write_off;
+}
+
+size_t storage_log_free_bytes(const storage_log_t *log)
+{
+    return (size_t)log->segment_count * STORAGE_SEGMENT_SIZE - storage_log_used_bytes(log);
+}
+
+esp_err_t storage_log_for_each_block(storage_log_t *log, storage_log_block_cb_t cb, void *ctx)
+{
+    bool stopped = false;
+    for (uint32_t seq = log->tail_seq; seq <= log->head_seq && !stopped; seq++) {
+        bool clean;
+        segment_walk(log, seq, cb, ctx, &clean, &stopped);
+    }
+    return ESP_OK;
+}
+
+static inline bool pos_before(const storage_pos_t *a, const storage_pos_t *b)
+{
+    return a->seq < b->seq || (a->seq == b->seq && a->off < b->off);
+}
+
+// Read the block at *pos or the first one after it, before end
+static esp_err_t read_block(const storage_log_t *log, storage_pos_t *pos, const storage_pos_t *end,
+                            uint8_t *buf, size_t max_len, size_t *len, storage_pos_t *at)
+{
+    storage_block_header_t hdr;
+
+    if (pos->off < STORAGE_SEGMENT_HEADER_SIZE) {
+        pos->off = STORAGE_SEGMENT_HEADER_SIZE;
+    }
+    while (pos_before(pos, end)) {
+        uint32_t seg_off = storage_log_segment_offset(log, pos->seq);
+        bool next_segment = pos->off + STORAGE_BLOCK_HEADER_SIZE > STORAGE_SEGMENT_DATA_END;
+
+        if (!next_segment) {
+            esp_err_t err = storage_backend_read(log->backend, seg_off + pos->off, buf, STORAGE_BLOCK_HEADER_SIZE);
+            if (err != ESP_OK) {
+                return err;
+            }
+            next_segment = storage_block_parse_header(buf, STORAGE_BLOCK_HEADER_SIZE, &hdr) != ESP_OK ||
+                           pos->off + STORAGE_BLOCK_HEADER_SIZE + hdr.payload_len > STORAGE_SEGMENT_DATA_END;
+        }
+
+        if (next_segment) {
+            // Erased tail or damage: the rest of this segment holds nothing usable
+            pos->seq++;
+            pos->off = STORAGE_SEGMENT_HEADER_SIZE;
+            continue;
+        }
+
+        size_t payload = hdr.payload_len;
+        if (STORAGE_BLOCK_HEADER_SIZE + payload > max_len) {
+            payload = max_len > STORAGE_BLOCK_HEADER_SIZE ? max_len - STORAGE_BLOCK_HEADER_SIZE : 0;
+        }
+        esp_err_t err = storage_backend_read(log->backend, seg_off + pos->off + STORAGE_BLOCK_HEADER_SIZE,
+                                             &buf[STORAGE_BLOCK_HEADER_SIZE], payload);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (at != NULL) {
+            *at = *pos;
+        }
+        *len = STORAGE_BLOCK_HEADER_SIZE + hdr.payload_len;
+        pos->off += *len;
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t storage_log_read_block(storage_log_t *log, storage_pos_t *pos, const storage_pos_t *end,
+                                 uint8_t *buf, size_t max_len, size_t *len, storage_pos_t *at)
+{
+    storage_pos_t head = storage_log_head(log);
+
+    if (end == NULL || pos_before(&head, end)) {
+        end = &head;
+    }
+    if (pos->seq < log->tail_seq) {
+        *pos = storage_log_tail(log);
+    }
+    return read_block(log, pos, end, buf, max_len, len, at);
+}
+
+esp_err_t storage_log_read_snapshot(const storage_log_t *log, storage_pos_t *pos, const storage_pos_t *end,
+                                    uint8_t *buf, size_t max_len, size_t *len, storage_pos_t *at)
+{
+    storage_pos_t from;
+
+    while (1) {
+        uint32_t tail = __atomic_load_n(&log->tail_seq, __ATOMIC_ACQUIRE);
+        if (pos->seq < tail || !storage_log_segment_readable(log, pos->seq)) {
+            // Trimmed or reused behind our back; continue at whatever is live now
+            uint32_t floor = storage_log_oldest_readable(log);
+            pos->seq = tail > floor ? tail : floor;
+            pos->off = STORAGE_SEGMENT_HEADER_SIZE;
+        }
+
+        esp_err_t err = read_block(log, pos, end, buf, max_len, len, &from);
+        if (err != ESP_OK) {
+            return err;
+        }
+        // The writer may have started erasing the segment while we read it
+        if (storage_log_segment_readable(log, from.seq)) {
+            if (at != NULL) {
+                *at = from;
+            }
+            return ESP_OK;
+        }
+    }
+}
+
+bool storage_log_scratch_region(const storage_log_t *log, uint32_t *offset, uint32_t *len)
+{
+    uint32_t live = log->head_seq - log->tail_seq + 1;
+    if (live + 1 >= log->segment_count) {
+        return false;
+    }
+
+    // Segments after head+1 up to (but excluding) the tail, possibly wrapping;
+    // only the contiguous part up to the end of the region is handed out.
+    uint32_t first = (log->head_seq + 2) % log->segment_count;
+    uint32_t count = log->segment_count - live - 1;
+    if (first + count > log->segment_count) {
+        count = log->segment_count - first;
+    }
+    *offset = log->base + first * STORAGE_SEGMENT_SIZE;
+    *len = count * STORAGE_SEGMENT_SIZE;
+    return true;
+}
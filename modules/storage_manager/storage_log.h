@@ -0,0 +1,191 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "storage_manager.h"
+#include "storage_format.h"
+#include "storage_backend.h"
+
+/*
+ * Append-only ring of fixed-size segments on a storage backend (normally
+ * the raw data partition, see storage_backend.h).
+ *
+ * Segment sequence numbers only grow and segment `seq` always lives at
+ * index `seq % segment_count`, so the live range [tail_seq, head_seq] is
+ * enough to locate every segment. Each segment starts with a small header
+ * followed by storage_format blocks written back to back; erased flash
+ * (0xFF) marks the end of the head segment. A segment is sealed as soon as
+ * a newer one is opened, and the oldest sealed segment is erased when the
+ * ring runs out of room.
+ *
+ * Bytes below the append position never change until the head wraps
+ * around and erases their segment, so readers can work on a snapshot (the
+ * head position taken under the storage lock) and read without the lock:
+ * see storage_log_read_snapshot().
+ *
+ * Sealing writes a footer with the segment's time range, sensor bitmap and
+ * per-sensor sample counts into the last STORAGE_SEGMENT_FOOTER_SIZE bytes. Those summaries are kept
+ * in RAM as a sparse index, so queries can skip whole segments; mount only
+ * has to decode segments whose footer is missing (normally just the head).
+ */
+
+#define STORAGE_SEGMENT_SIZE (16 * 1024)
+#define STORAGE_SEGMENT_HEADER_SIZE 32
+#define STORAGE_SEGMENT_MAGIC 0x47534C53 // "SLSG"
+#define STORAGE_SEGMENT_VERSION 1
+#define STORAGE_SEGMENT_FOOTER_SIZE 32
+#define STORAGE_SEGMENT_FOOTER_MAGIC 0x32464C53 // "SLF2", "SLFT" footers had no per-sensor counts
+#define STORAGE_SEGMENT_DATA_END (STORAGE_SEGMENT_SIZE - STORAGE_SEGMENT_FOOTER_SIZE)
+
+typedef struct {
+    storage_backend_t *backend;
+    uint32_t base;
+    uint32_t segment_count;
+    uint32_t head_seq;
+    uint32_t tail_seq;
+    uint32_t open_seq; // head_seq, or head_seq + 1 while the next segment is erased
+    uint32_t write_off;
+    uint32_t reclaimed;
+    storage_span_t *index; // segment_count entries, segment seq at seq % segment_count
+} storage_log_t;
+
+/**
+ * @brief Called for every valid block in the log, oldest first.
+ *
+ * @return false to stop the walk
+ */
+typedef bool (*storage_log_block_cb_t)(const uint8_t *block, size_t len, uint32_t seq, uint32_t off, void *ctx);
+
+/**
+ * @brief Recover head and tail by scanning segment headers, formatting
+ * the region if it holds no log yet.
+ *
+ * @param base  Offset of the first segment on the backend
+ * @param index Caller-owned array of segment_count entries for the segment index
+ */
+esp_err_t storage_log_mount(storage_log_t *log, storage_backend_t *backend, uint32_t base, uint32_t segment_count,
+                            storage_span_t *index);
+
+/**
+ * @brief Append one sealed block, opening (and if needed reclaiming) the
+ * next segment when the head is full.
+ *
+ * @param span Time range and sensors of the block, merged into the index
+ */
+esp_err_t storage_log_append(storage_log_t *log, const uint8_t *block, size_t len, const storage_span_t *span);
+
+/**
+ * @brief Drop all data by starting a fresh segment; only one segment is erased.
+ */
+esp_err_t storage_log_clear(storage_log_t *log);
+
+/**
+ * @brief Release every segment older than `seq` without erasing it; the
+ * space is reused as the head wraps around. Never trims the head segment.
+ */
+void storage_log_trim(storage_log_t *log, uint32_t seq);
+
+/**
+ * @brief Release sealed segments at the tail whose newest record is older
+ * than before_ts (retention by age).
+ *
+ * @return number of segments released
+ */
+uint32_t storage_log_expire(storage_log_t *log, uint32_t before_ts);
+
+/**
+ * @brief Whether storage_log_append() of len bytes would reclaim a live
+ * segment because the ring is full, and which one.
+ */
+static inline bool storage_log_append_reclaims(const storage_log_t *log, size_t len, uint32_t *victim)
+{
+    uint32_t next = log->head_seq + 1;
+    if (log->write_off + len <= STORAGE_SEGMENT_DATA_END || next - log->tail_seq < log->segment_count) {
+        return false;
+    }
+    *victim = next - log->segment_count;
+    return true;
+}
+
+size_t storage_log_free_bytes(const storage_log_t *log);
+size_t storage_log_used_bytes(const storage_log_t *log);
+
+static inline uint32_t storage_log_segment_offset(const storage_log_t *log, uint32_t seq)
+{
+    return log->base + (seq % log->segment_count) * STORAGE_SEGMENT_SIZE;
+}
+
+/**
+ * @brief Whether a reader without the storage lock may read segment seq.
+ * Segments released by trim or expiry stay readable until the head wraps
+ * onto them; the one being erased for the next head counts as gone from
+ * the moment the open starts, so a read that passes this check both
+ * before and after it saw stable bytes.
+ */
+static inline bool storage_log_segment_readable(const storage_log_t *log, uint32_t seq)
+{
+    uint32_t open = __atomic_load_n(&log->open_seq, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&log->head_seq, __ATOMIC_ACQUIRE);
+    return seq <= head && seq + log->segment_count > open;
+}
+
+// Oldest segment storage_log_segment_readable() accepts right now
+static inline uint32_t storage_log_oldest_readable(const storage_log_t *log)
+{
+    uint32_t open = __atomic_load_n(&log->open_seq, __ATOMIC_ACQUIRE);
+    return open + 1 > log->segment_count ? open + 1 - log->segment_count : 0;
+}
+
+static inline const storage_span_t *storage_log_segment_span(const storage_log_t *log, uint32_t seq)
+{
+    return &log->index[seq % log->segment_count];
+}
+
+/**
+ * @brief Walk every valid block from the tail to the head.
+ */
+esp_err_t storage_log_for_each_block(storage_log_t *log, storage_log_block_cb_t cb, void *ctx);
+
+static inline storage_pos_t storage_log_head(const storage_log_t *log)
+{
+    storage_pos_t pos = { .seq = log->head_seq, .off = log->write_off };
+    return pos;
+}
+
+static inline storage_pos_t storage_log_tail(const storage_log_t *log)
+{
+    storage_pos_t pos = { .seq = log->tail_seq, .off = STORAGE_SEGMENT_HEADER_SIZE };
+    return pos;
+}
+
+/**
+ * @brief Read the block at *pos (or the first one after it) and advance *pos
+ * past it. Positions in reclaimed segments continue at the tail.
+ *
+ * @param end      Stop before this position (NULL for the current head)
+ * @param max_len  Read at most this many bytes of the block into buf
+ * @param len      Set to the full length of the block
+ * @param at       Set to the position the block was read from (may be NULL)
+ * @return ESP_ERR_NOT_FOUND when there are no more blocks
+ */
+esp_err_t storage_log_read_block(storage_log_t *log, storage_pos_t *pos, const storage_pos_t *end,
+                                 uint8_t *buf, size_t max_len, size_t *len, storage_pos_t *at);
+
+/**
+ * @brief storage_log_read_block() for readers that do not hold the storage
+ * lock, bounded by a snapshot of the head (end, required). Blocks come from
+ * segments the writer is done with or from below the snapshot in the head
+ * segment, and each is checked after the read against the head having
+ * wrapped onto it meanwhile; such positions continue at the live tail.
+ * Concurrent calls are safe if the backend's reads are (shared_reads).
+ */
+esp_err_t storage_log_read_snapshot(const storage_log_t *log, storage_pos_t *pos, const storage_pos_t *end,
+                                    uint8_t *buf, size_t max_len, size_t *len, storage_pos_t *at);
+
+/**
+ * @brief Byte range covering the segments that hold no live data and are
+ * not the next one to be opened; it is erased before the log reuses it.
+ */
+bool storage_log_scratch_region(const storage_log_t *log, uint32_t *offset, uint32_t *len);
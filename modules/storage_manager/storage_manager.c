@@ -1,344 +1,245 @@
-// #include "storage_manager.h"
-// #include "project_config.h"
-// #include <stdio.h>
-// #include <string.h>
-// #include <sys/stat.h>
-// #include <unistd.h>
-
-// #include "esp_err.h"
-// #include "esp_log.h"
-// #include "esp_vfs_fat.h"
-// #include "freertos/FreeRTOS.h"
-// #include "freertos/task.h"
-
-// #include "driver/gpio.h"
-// #include "driver/spi_master.h"
-// #include "driver/sdspi_host.h"
-// #include "sdmmc_cmd.h"
-// #include "spi_bus_mutex.h"
-
-// static const char *TAG = "STORAGE_MGR";
-
-
-// #define MOUNT_POINT "/sdcard"
-// #define FILE_PATH   "/sdcard/data.txt"
-
-// #define PIN_NUM_MISO  SPI_MISO_PIN
-// #define PIN_NUM_MOSI  SPI_MOSI_PIN
-// #define PIN_NUM_CLK   SPI_SCK_PIN
-// #define PIN_NUM_CS    CS_SD_CARD_PIN
-
-// #define SD_INIT_RETRIES 3
-// #define SD_INIT_RETRY_DELAY_MS 500
-
-// static sdmmc_card_t *card;
-// static bool sd_card_mounted = false;
-
-// static size_t storage_get_free_space_unlocked(void);
-
-
-// void storage_init(void)
-// {
-//     esp_err_t ret;
-//     int retry_count = 0;
-    
-//     ESP_LOGI(TAG, "Configuring SD card on existing SPI3_HOST bus...");
-    
-//     sdmmc_host_t host = SDSPI_HOST_DEFAULT();
-//     host.slot = SPI_HOST_USED;
-//     host.max_freq_khz = 1000;
-
-//     gpio_set_pull_mode(PIN_NUM_MISO, GPIO_PULLUP_ONLY);
-//     gpio_set_pull_mode(PIN_NUM_CS, GPIO_PULLUP_ONLY);
-//     gpio_set_direction(PIN_NUM_CS, GPIO_MODE_OUTPUT);
-//     gpio_set_level(PIN_NUM_CS, 1);
-    
-//     vTaskDelay(pdMS_TO_TICKS(100));
-
-//     sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
-//     slot_config.gpio_cs = PIN_NUM_CS;
-//     slot_config.host_id = SPI_HOST_USED;
-
-//     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-//         .format_if_mount_failed = false,
-//         .max_files = 5,
-//         .allocation_unit_size = 16 * 1024
-//     };
-
-//     for (retry_count = 0; retry_count < SD_INIT_RETRIES; retry_count++) {
-//         ESP_LOGI(TAG, "SD card mount attempt %d/%d", retry_count + 1, SD_INIT_RETRIES);
-        
-//         spi_bus_mutex_lock();
-//         ret = esp_vfs_fat_sdspi_mount(
-//             MOUNT_POINT,
-//             &host,
-//             &slot_config,
-//             &mount_config,
-//             &card
-//         );
-
-//         if (ret == ESP_OK) {
-//             sd_card_mounted = true;
-//             ESP_LOGI(TAG, "SD card mounted successfully");
-//             size_t free_space = storage_get_free_space_unlocked();
-//             spi_bus_mutex_unlock();
-//             ESP_LOGI(TAG, "Free space: %zu bytes", free_space);
-//             if (card != NULL) {
-//                 sdmmc_card_print_info(stdout, card);
-//             }
-//             return;
-//         }
-
-//         spi_bus_mutex_unlock();
-
-//         ESP_LOGW(TAG, "SD card mount failed (%s), retry in %dms", 
-//                  esp_err_to_name(ret), SD_INIT_RETRY_DELAY_MS);
-        
-//         vTaskDelay(pdMS_TO_TICKS(SD_INIT_RETRY_DELAY_MS));
-//     }
-
-//     ESP_LOGE(TAG, "Failed to mount SD card after %d attempts", SD_INIT_RETRIES);
-//     sd_card_mounted = false;
-//     ESP_LOGW(TAG, "HINT: Please verify SD card is inserted. Continuing without SD card storage.");
-// }
-
-
-// static size_t storage_get_free_space_unlocked(void)
-// {
-//     if (!sd_card_mounted) {
-//         ESP_LOGW(TAG, "SD card not mounted, cannot get free space");
-//         return 0;
-//     }
-
-//     FATFS *fs;
-//     DWORD free_clusters;
-
-//     FRESULT res = f_getfree("0:", &free_clusters, &fs);
-//     if (res != FR_OK) {
-//         ESP_LOGE(TAG, "Failed to get free space (err=%d)", res);
-//         return 0;
-//     }
-
-//     return (size_t)free_clusters * fs->csize * 512;
-// }
-
-// size_t storage_get_free_space(void)
-// {
-//     if (!sd_card_mounted) {
-//         ESP_LOGW(TAG, "SD card not mounted, cannot get free space");
-//         return 0;
-//     }
-
-//     spi_bus_mutex_lock();
-//     size_t free_space = storage_get_free_space_unlocked();
-//     spi_bus_mutex_unlock();
-
-//     return free_space;
-// }
-
-
-// void storage_clear_all(void)
-// {
-//     if (!sd_card_mounted) {
-//         ESP_LOGW(TAG, "SD card not mounted, cannot clear all");
-//         return;
-//     }
-
-//     ESP_LOGI(TAG, "[CLEAR] Task %s requesting SPI mutex to clear SD", pcTaskGetName(NULL));
-//     spi_bus_mutex_lock();
-//     ESP_LOGI(TAG, "[CLEAR] Task %s acquired SPI mutex, deleting file", pcTaskGetName(NULL));
-    
-//     struct stat st;
-//     if (stat(FILE_PATH, &st) == 0) {
-//         unlink(FILE_PATH);
-//         ESP_LOGI(TAG, "File deleted");
-//     } else {
-//         ESP_LOGW(TAG, "File does not exist");
-//     }
-    
-//     ESP_LOGI(TAG, "[CLEAR] Task %s releasing SPI mutex after clear", pcTaskGetName(NULL));
-//     spi_bus_mutex_unlock();
-// }
-
-// bool storage_write_line(const char *text)
-// {
-//     if (!sd_card_mounted) {
-//         ESP_LOGW(TAG, "SD card not mounted, cannot write line");
-//         return false;
-//     }
-
-//     ESP_LOGI(TAG, "[WRITE] Task %s requesting SPI mutex to write to SD", pcTaskGetName(NULL));
-//     spi_bus_mutex_lock();
-//     ESP_LOGI(TAG, "[WRITE] Task %s acquired SPI mutex, writing: %.20s...", pcTaskGetName(NULL), text);
-    
-//     if (storage_get_free_space_unlocked() < 512) {
-//         ESP_LOGW(TAG, "Not enough space on SD card");
-//         spi_bus_mutex_unlock();
-//         return false;
-//     }
-
-//     FILE *f = fopen(FILE_PATH, "a");
-//     if (!f) {
-//         ESP_LOGE(TAG, "Failed to open file");
-//         spi_bus_mutex_unlock();
-//         return false;
-//     }
-
-//     int res = fprintf(f, "%s\n", text);
-//     fclose(f);
-    
-//     ESP_LOGI(TAG, "[WRITE] Task %s releasing SPI mutex after write", pcTaskGetName(NULL));
-//     spi_bus_mutex_unlock();
-
-//     return (res >= 0);
-// }
-
-// char *storage_read_all(void)
-// {
-//     if (!sd_card_mounted) {
-//         ESP_LOGW(TAG, "SD card not mounted, cannot read all");
-//         return NULL;
-//     }
-
-//     ESP_LOGI(TAG, "[READ] Task %s requesting SPI mutex to read from SD", pcTaskGetName(NULL));
-//     spi_bus_mutex_lock();
-//     ESP_LOGI(TAG, "[READ] Task %s acquired SPI mutex, reading file", pcTaskGetName(NULL));
-    
-//     FILE *f = fopen(FILE_PATH, "r");
-//     if (!f) {
-//         ESP_LOGI(TAG, "[READ] Task %s releasing SPI mutex (file not found)", pcTaskGetName(NULL));
-//         spi_bus_mutex_unlock();
-//         return NULL;
-//     }
-
-//     fseek(f, 0, SEEK_END);
-//     long size = ftell(f);
-//     rewind(f);
-
-//     if (size <= 0) {
-//         fclose(f);
-//         ESP_LOGI(TAG, "[READ] Task %s releasing SPI mutex (empty file)", pcTaskGetName(NULL));
-//         spi_bus_mutex_unlock();
-//         return NULL;
-//     }
-
-//     char *buf = malloc(size + 1);
-//     if (!buf) {
-//         fclose(f);
-//         ESP_LOGI(TAG, "[READ] Task %s releasing SPI mutex (malloc failed)", pcTaskGetName(NULL));
-//         spi_bus_mutex_unlock();
-//         return NULL;
-//     }
-
-//     fread(buf, 1, size, f);
-//     buf[size] = '\0';
-//     fclose(f);
-    
-//     ESP_LOGI(TAG, "[READ] Task %s releasing SPI mutex after reading %ld bytes", pcTaskGetName(NULL), size);
-//     spi_bus_mutex_unlock();
-
-//     return buf;
-// }
-
-
-
 #include "storage_manager.h"
+#include "storage_internal.h"
+#include "storage_format.h"
+#include "storage_backend.h"
+#include "project_config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/unistd.h>
-#include <sys/stat.h>
+#include <time.h>
 #include "esp_err.h"
 #include "esp_log.h"
-#include "esp_spiffs.h"
 
 // --- Konfiguracja prywatna modułu ---
 static const char *TAG = "STORAGE_MGR";
-#define FILE_PATH "/spiffs/notatki.txt"
-#define PARTITION_NAME "storage"
+
+// Below this the raw log keeps the whole partition and rollups are disabled
+#define STORAGE_MIN_RAW_SEGMENTS 4
+
+static storage_backend_t s_backend;
+static storage_log_t s_log;
+static storage_span_t* s_log_index = NULL;
+static bool s_mounted = false;
+// Cached copy of the log's free space, readable without the storage lock
+static volatile size_t s_free_bytes = 0;
+
+// Stamps notes; see storage_set_clock()
+static uint32_t (*s_clock)(void) = NULL;
+
+static const char *s_sensor_names[STORAGE_SENSOR_COUNT] = {
+    [STORAGE_SENSOR_BMP280] = "BMP280",
+    [STORAGE_SENSOR_VEML7700] = "VEML7700",
+    [STORAGE_SENSOR_MAX6675_NORMAL] = "MAX6675_NORMAL",
+    [STORAGE_SENSOR_MAX6675_PROFILE] = "MAX6675_PROFILE",
+    [STORAGE_SENSOR_HCSR04] = "HC-SR04",
+    [STORAGE_SENSOR_ADXL345] = "ADXL345",
+};
+
+const char* storage_sensor_name(uint8_t sensor_id) {
+    if (sensor_id >= STORAGE_SENSOR_COUNT) {
+        return "UNKNOWN";
+    }
+    return s_sensor_names[sensor_id];
+}
+
+static int sensor_id_from_name(const char* name, size_t len) {
+    for (int i = 0; i < STORAGE_SENSOR_COUNT; i++) {
+        if (strlen(s_sensor_names[i]) == len && strncmp(s_sensor_names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int storage_sensor_from_name(const char* name) {
+    return sensor_id_from_name(name, strlen(name));
+}
+
+// Lines in the old "NAME;timestamp;value" shape become sensor records,
+// anything else (e.g. BLE notes) is kept verbatim as a note record.
+static bool append_text_line(const char* text) {
+    const char* sep1 = strchr(text, ';');
+    const char* sep2 = sep1 ? strchr(sep1 + 1, ';') : NULL;
+
+    if (sep2 != NULL) {
+        int id = sensor_id_from_name(text, sep1 - text);
+        char* end_ts = NULL;
+        char* end_val = NULL;
+        unsigned long ts = strtoul(sep1 + 1, &end_ts, 10);
+        float value = strtof(sep2 + 1, &end_val);
+
+        if (id >= 0 && end_ts == sep2 && end_val != sep2 + 1) {
+            storage_sample_t sample = { .sensor_id = id, .timestamp = ts, .value = value };
+            return storage_block_append_sample(&sample);
+        }
+    }
+    return storage_block_append_note(s_clock != NULL ? s_clock() : (uint32_t)time(NULL), text);
+}
+
+storage_log_t* storage_main_log(void) {
+    return &s_log;
+}
+
+bool storage_mounted(void) {
+    return s_mounted;
+}
+
+void storage_space_refresh(void) {
+    s_free_bytes = storage_log_free_bytes(&s_log);
+    storage_quota_refresh(&s_log);
+}
 
 void storage_init(void) {
-    esp_vfs_spiffs_conf_t conf = {
-      .base_path = "/spiffs",
-      .partition_label = PARTITION_NAME,
-      .max_files = 5,
-      .format_if_mount_failed = true
-    };
-    
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    storage_backend_close(&s_backend);
+    esp_err_t ret = storage_backend_open(&s_backend, STORAGE_BACKEND, STORAGE_PARTITION_NAME,
+                                         STORAGE_BACKEND_FS_BASE "/log.bin", 0);
     if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE(TAG, "Błąd montowania SPIFFS");
-        } else if (ret == ESP_ERR_NOT_FOUND) {
-            ESP_LOGE(TAG, "Nie znaleziono partycji SPIFFS");
-        } else {
-            ESP_LOGE(TAG, "Błąd inicjalizacji (%s)", esp_err_to_name(ret));
-        }
+        ESP_LOGE(TAG, "Nie można otworzyć nośnika na partycji %s (%s)", STORAGE_PARTITION_NAME, esp_err_to_name(ret));
+        return;
+    }
+
+    uint32_t segments = s_backend.stats.size / STORAGE_SEGMENT_SIZE;
+    uint32_t rollup_segments = storage_rollup_segments();
+    bool rollups = segments >= rollup_segments + STORAGE_MIN_RAW_SEGMENTS;
+    if (rollups) {
+        // Rollup tiers take the end of the partition, raw samples the rest
+        segments -= rollup_segments;
     } else {
-        ESP_LOGI(TAG, "System plików zamontowany.");
+        ESP_LOGW(TAG, "Partycja za mała na agregaty, zapisuję tylko surowe próbki");
+    }
+    if (s_log_index == NULL) {
+        s_log_index = calloc(segments, sizeof(storage_span_t));
+    }
+    if (s_log_index == NULL) {
+        ESP_LOGE(TAG, "Brak pamięci na indeks logu");
+        return;
     }
-}
 
-size_t storage_get_free_space(void) {
-    size_t total = 0, used = 0;
-    esp_err_t ret = esp_spiffs_info(PARTITION_NAME, &total, &used);
-    
+    ret = storage_log_mount(&s_log, &s_backend, 0, segments, s_log_index);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Błąd odczytu info partycji");
-        return 0;
+        ESP_LOGE(TAG, "Błąd inicjalizacji logu (%s)", esp_err_to_name(ret));
+        return;
+    }
+
+    if (rollups) {
+        ret = storage_rollup_mount(&s_backend, segments * STORAGE_SEGMENT_SIZE);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Błąd inicjalizacji agregatów (%s)", esp_err_to_name(ret));
+        }
     }
-    return total - used;
+
+    s_mounted = true;
+    storage_calib_restore();
+    storage_upload_restore();
+    storage_archive_restore();
+    storage_space_refresh();
+    ESP_LOGI(TAG, "Log zamontowany, wolne: %zu bajtów", s_free_bytes);
+    storage_writer_start();
+    storage_archive_start();
+}
+
+size_t storage_get_free_space(void) {
+    return s_mounted ? s_free_bytes : 0;
+}
+
+size_t storage_get_capacity(void) {
+    return s_mounted ? (size_t)s_log.segment_count * STORAGE_SEGMENT_SIZE : 0;
 }
 
 void storage_clear_all(void) {
-    struct stat st;
-    if (stat(FILE_PATH, &st) == 0) {
-        unlink(FILE_PATH);
-        ESP_LOGI(TAG, "Plik usunięty.");
+    if (!s_mounted) {
+        return;
+    }
+    storage_lock();
+    bool cleared = storage_log_clear(&s_log) == ESP_OK && storage_rollup_clear() == ESP_OK;
+    if (cleared) {
+        ESP_LOGI(TAG, "Log wyczyszczony.");
+        // Cleared segments are not copied to the SD archive any more
+        storage_archive_skip(s_log.head_seq);
     } else {
-        ESP_LOGW(TAG, "Plik nie istnieje.");
+        ESP_LOGE(TAG, "Błąd czyszczenia logu.");
+    }
+    storage_space_refresh();
+    storage_pos_t head = storage_log_head(&s_log);
+    storage_unlock();
+
+    // ...nor uploaded; the position is persisted outside the lock
+    if (cleared) {
+        storage_upload_ack(&head);
     }
 }
 
+void storage_set_clock(uint32_t (*now)(void)) {
+    s_clock = now;
+}
+
 bool storage_write_line(const char* text) {
-    size_t free_space = storage_get_free_space();
-    
-    // Zabezpieczenie: 512 bajtów
-    if (free_space < 512) {
-        ESP_LOGW(TAG, "BRAK MIEJSCA! Anulowano zapis.");
+    if (!s_mounted) {
         return false;
     }
+    storage_lock();
+    bool ok = append_text_line(text) && storage_block_commit();
+    storage_unlock();
+
+    return ok;
+}
 
-    FILE* f = fopen(FILE_PATH, "a");
-    if (f == NULL) return false;
-    
-    int result = fprintf(f, "%s\n", text);
-    fclose(f);
+esp_err_t storage_cursor_open(storage_cursor_t* cur) {
+    memset(cur, 0, sizeof(*cur));
+    if (!s_mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    return (result >= 0);
+    storage_lock();
+    // Push the writer's open block to flash first
+    storage_block_commit();
+    cur->next = storage_log_tail(&s_log);
+    cur->end = storage_log_head(&s_log);
+    storage_unlock();
+    return ESP_OK;
 }
 
-char* storage_read_all(void) {
-    FILE* f = fopen(FILE_PATH, "r");
-    if (f == NULL) return NULL;
+esp_err_t storage_cursor_next(storage_cursor_t* cur, storage_record_t* record) {
+    while (1) {
+        esp_err_t err = cur->iter.remaining ? storage_calib_next(&cur->iter, record) : ESP_ERR_NOT_FOUND;
+        if (err == ESP_OK) {
+            return ESP_OK;
+        }
 
-    fseek(f, 0, SEEK_END);
-    long file_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+        size_t len;
+        storage_read_begin(&s_log);
+        err = storage_log_read_snapshot(&s_log, &cur->next, &cur->end, cur->buf, sizeof(cur->buf), &len, &cur->block);
+        storage_read_end(&s_log);
+        if (err != ESP_OK) {
+            return err;
+        }
 
-    if (file_size <= 0) {
-        fclose(f);
-        return NULL;
+        if (storage_block_iter_init(&cur->iter, cur->buf, len) != ESP_OK) {
+            ESP_LOGW(TAG, "Pominięto uszkodzony blok %lu:%lu",
+                     (unsigned long)cur->block.seq, (unsigned long)cur->block.off);
+            cur->iter.remaining = 0;
+        }
     }
+}
+
+int storage_cursor_next_line(storage_cursor_t* cur, char* buf, size_t len) {
+    storage_record_t record;
+    if (storage_cursor_next(cur, &record) != ESP_OK) {
+        return -1;
+    }
+    int n = storage_record_to_csv(&record, buf, len);
+    return (n >= 0 && (size_t)n >= len) ? (int)len - 1 : n;
+}
 
-    char* buffer = (char*)malloc(file_size + 1);
-    if (buffer == NULL) {
-        fclose(f);
-        return NULL;
+bool storage_cursor_block_done(const storage_cursor_t* cur, storage_pos_t* pos) {
+    if (cur->iter.remaining) {
+        return false;
     }
+    *pos = cur->next;
+    return true;
+}
 
-    fread(buffer, 1, file_size, f);
-    buffer[file_size] = '\0';
-    fclose(f);
-    
-    return buffer;
+void storage_cursor_close(storage_cursor_t* cur) {
+    cur->iter.remaining = 0;
+    cur->next = cur->end;
 }
\ No newline at end of file
@@ -2,13 +2,427 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    STORAGE_SENSOR_BMP280 = 0,
+    STORAGE_SENSOR_VEML7700,
+    STORAGE_SENSOR_MAX6675_NORMAL,
+    STORAGE_SENSOR_MAX6675_PROFILE,
+    STORAGE_SENSOR_HCSR04,
+    STORAGE_SENSOR_ADXL345,
+    STORAGE_SENSOR_COUNT
+} storage_sensor_id_t;
+
+#define STORAGE_BLOCK_SIZE 512
+
+// Matches every sensor (and notes) in storage_query()
+#define STORAGE_SENSOR_ANY 0xFF
+
+// Sensor codes as the driver read them (storage_enqueue_raw). The log
+// keeps the code and converts it to units whenever it is read, with the
+// calibration the sensor had at the sample's timestamp.
+typedef enum {
+    STORAGE_RAW_NONE = 0,        // value is in units already
+    STORAGE_RAW_BMP280_T,        // 20-bit adc_T
+    STORAGE_RAW_VEML7700,        // 16-bit ALS count
+    STORAGE_RAW_MAX6675_NORMAL,  // 12-bit code, 0.25 °C per step
+    STORAGE_RAW_MAX6675_PROFILE,
+    STORAGE_RAW_ADXL345_X,       // int16 axes, always stored X, Y, Z together
+    STORAGE_RAW_ADXL345_Y,
+    STORAGE_RAW_ADXL345_Z,
+    STORAGE_RAW_CHANNEL_COUNT
+} storage_raw_channel_t;
+
+typedef struct {
+    uint8_t sensor_id;
+    uint8_t raw;        // storage_raw_channel_t of code/axes, STORAGE_RAW_NONE for value
+    uint32_t timestamp;
+    union {
+        float value;
+        int32_t code;
+        int16_t axes[3]; // STORAGE_RAW_ADXL345_X
+    };
+} storage_sample_t;
+
+typedef struct {
+    uint8_t sensor_id;  // storage_sensor_id_t, or STORAGE_RECORD_NOTE
+    uint32_t timestamp; // bucket start for rollup records
+    float value;        // mean for rollup records
+    float min;          // equal to value for raw samples
+    float max;
+    uint32_t count;     // samples aggregated into the record, 1 for raw samples
+    const char* note;   // note records only, not NUL-terminated
+    uint8_t note_len;
+    uint8_t raw;        // storage_raw_channel_t when value is still a sensor code
+} storage_record_t;
+
+// Calibration of one sensor from `since` on (storage_set_calibration).
+// Raw codes are converted with the newest entry not newer than the sample.
+typedef struct {
+    uint8_t sensor_id;
+    uint32_t since;
+    union {
+        struct {
+            uint16_t t1; // dig_T1..dig_T3 trimming of the temperature
+            int16_t t2;
+            int16_t t3;
+        } bmp280;
+        struct {
+            uint16_t conf;       // ALS_CONF register, gain and integration time
+            float lux_per_count; // resolution at that setting
+        } veml7700;
+        struct {
+            float ms2_per_lsb;
+            float offset[3];     // m/s², subtracted before scaling
+            float scale[3];
+        } adxl345;
+    };
+} storage_calib_t;
+
+// Position of a block in the log: segment sequence number and byte offset
+typedef struct {
+    uint32_t seq;
+    uint32_t off;
+} storage_pos_t;
+
+// Per-sensor decoder state of a bit-packed (series) block
+typedef struct {
+    uint32_t ts;
+    uint32_t delta;
+    int32_t value;
+} storage_series_ctx_t;
+
+typedef struct {
+    const uint8_t* payload;
+    size_t pos;           // in bits for series blocks
+    size_t len;
+    uint32_t ts;
+    uint16_t remaining;
+    uint8_t encoding;
+    // one per sensor, notes and every raw channel
+    storage_series_ctx_t series[STORAGE_SENSOR_COUNT + STORAGE_RAW_CHANNEL_COUNT];
+} storage_block_iter_t;
+
+/**
+ * Streaming reader over the log. Holds one block in RAM regardless of how
+ * much data is stored; the log is only locked while a block is fetched.
+ */
+typedef struct {
+    storage_pos_t next;   // next block to fetch
+    storage_pos_t end;    // log head when the cursor was opened
+    storage_pos_t block;  // block currently being decoded
+    storage_block_iter_t iter;
+    uint8_t buf[STORAGE_BLOCK_SIZE];
+} storage_cursor_t;
+
+/**
+ * @brief Called for every record matching a query, in log order.
+ *
+ * @return false to stop the query
+ */
+typedef bool (*storage_query_cb_t)(const storage_record_t* record, void* ctx);
+
+typedef enum {
+    STORAGE_MATCH_ANY = 0, // no condition on the value
+    STORAGE_MATCH_ABOVE,   // value > threshold (max for rollup records)
+    STORAGE_MATCH_BELOW,   // value < threshold (min for rollup records)
+} storage_match_t;
+
+// Resolution a query reads from; rollup tiers keep one record per sensor
+// and bucket with count/min/max/mean of the raw samples it covers
+typedef enum {
+    STORAGE_TIER_RAW = 0,
+    STORAGE_TIER_MINUTE,
+    STORAGE_TIER_HOUR,
+    STORAGE_TIER_COUNT
+} storage_tier_t;
+
+typedef struct {
+    uint8_t sensor_id;     // storage_sensor_id_t or STORAGE_SENSOR_ANY
+    uint32_t t_from;       // inclusive time window
+    uint32_t t_to;
+    storage_match_t match;
+    float threshold;
+    uint8_t tier;          // storage_tier_t, raw samples by default
+} storage_predicate_t;
+
+typedef struct {
+    uint32_t segments_skipped; // ruled out by the segment index alone
+    uint32_t segments_read;
+    uint32_t blocks_skipped;   // ruled out by the block header and summary
+    uint32_t blocks_read;
+    uint32_t records;          // handed to the callback
+} storage_query_stats_t;
+
+typedef struct {
+    uint32_t queue_depth;
+    uint32_t queue_high_water;
+    uint32_t enqueued;
+    uint32_t dropped;
+    uint32_t written;
+    uint32_t write_errors;
+    uint32_t reclaimed_segments;
+    uint32_t flushes;
+    uint32_t last_flush_us;
+    uint32_t max_flush_us;
+    uint64_t total_flush_us;
+    uint32_t stack_free_min;   // bytes of the writer task's stack never used
+} storage_writer_stats_t;
+
+// What happens to a sensor's raw samples once the log is under pressure
+// and the sensor holds more than its quota (STORAGE_POLICY_* in
+// project_config.h). Rollups always see every sample.
+typedef enum {
+    STORAGE_PRIO_LOW = 0, // not stored at all
+    STORAGE_PRIO_NORMAL,  // decimated, one sample in STORAGE_QUOTA_DECIMATE kept
+    STORAGE_PRIO_HIGH,    // never shed
+} storage_priority_t;
+
+typedef struct {
+    uint8_t priority;  // storage_priority_t
+    uint8_t quota_pct; // share of the samples in the raw log
+    uint32_t stored;   // samples in the raw log right now
+    uint32_t dropped;  // writer queue full, or its reserve kept for high priority
+    uint32_t shed;     // not stored because of the quota (rollups still have them)
+    uint32_t evicted;  // lost when the full log reclaimed their segment
+} storage_sensor_stats_t;
+
+typedef struct {
+    bool pressure;       // free space below STORAGE_QUOTA_PRESSURE_PCT, quotas apply
+    bool session_active; // STORAGE_SESSION_SENSOR samples are protected from reclaiming
+    uint32_t session_seq; // first raw segment of the active session
+    storage_sensor_stats_t sensors[STORAGE_SENSOR_COUNT];
+} storage_quota_stats_t;
+
+typedef enum {
+    STORAGE_ARCHIVE_DISABLED,
+    STORAGE_ARCHIVE_NO_CARD, // not mounted, probed again every STORAGE_ARCHIVE_RETRY_MS
+    STORAGE_ARCHIVE_IDLE,
+    STORAGE_ARCHIVE_COPYING,
+} storage_archive_state_t;
+
+typedef struct {
+    uint8_t state;           // storage_archive_state_t
+    uint32_t next_seq;       // oldest raw segment not on the card yet
+    uint32_t pending;        // sealed segments waiting to be copied
+    uint32_t segments;       // copied since boot
+    uint32_t missed;         // reused in flash before they could be copied
+    uint32_t errors;         // card errors, each one unmounts the card
+    uint64_t bytes;
+    uint64_t card_bytes;     // capacity of the mounted card
+    uint32_t bus_holds;
+    uint32_t max_hold_us;    // longest single hold of the SPI bus while copying
+    uint64_t total_hold_us;
+    uint32_t mount_us;       // bus hold of the last mount attempt
+    uint32_t freq_khz;       // SPI clock of the card once initialized
+    uint32_t prealloc_failed; // archive files that could not be made contiguous
+} storage_archive_stats_t;
 
 void storage_init(void);
 
+/**
+ * @brief Free bytes in the log. Served from a counter that is updated on
+ * every append, clear and trim, so it is cheap enough to poll.
+ */
 size_t storage_get_free_space(void);
 
+/**
+ * @brief Size of the log, free space included.
+ */
+size_t storage_get_capacity(void);
+
 void storage_clear_all(void);
 
+/**
+ * @brief Clock for records the storage stamps itself (notes from
+ * storage_write_line). main sets get_timestamp, so notes and samples share
+ * a clock; until then time(NULL) is used.
+ */
+void storage_set_clock(uint32_t (*now)(void));
+
 bool storage_write_line(const char* text);
 
-char* storage_read_all(void);
\ No newline at end of file
+/**
+ * @brief Start reading at the oldest record. Commits the writer's open block
+ * first so everything stored so far is visible; records appended after this
+ * call are not returned.
+ */
+esp_err_t storage_cursor_open(storage_cursor_t* cur);
+
+/**
+ * @brief Fetch the next record.
+ *
+ * @return ESP_ERR_NOT_FOUND when the cursor reached the end
+ */
+esp_err_t storage_cursor_next(storage_cursor_t* cur, storage_record_t* record);
+
+/**
+ * @brief Fetch the next record formatted as a NAME;timestamp;value line.
+ *
+ * @return line length, or -1 at the end of the log
+ */
+int storage_cursor_next_line(storage_cursor_t* cur, char* buf, size_t len);
+
+void storage_cursor_close(storage_cursor_t* cur);
+
+/**
+ * @brief Check whether the last record returned came from the end of its
+ * block, and if so where the following block starts.
+ *
+ * Acknowledging that position covers every record read so far.
+ */
+bool storage_cursor_block_done(const storage_cursor_t* cur, storage_pos_t* pos);
+
+/**
+ * @brief Like storage_cursor_open(), but starts right after the last
+ * acknowledged upload position instead of at the oldest record.
+ */
+esp_err_t storage_upload_open(storage_cursor_t* cur);
+
+/**
+ * @brief Mark everything before pos as delivered. The position is kept in
+ * NVS so uploads resume there after a reboot, and segments that lie
+ * entirely behind it are released for reuse.
+ */
+esp_err_t storage_upload_ack(const storage_pos_t* pos);
+
+/**
+ * @brief Sealed raw log segments that hold data not acknowledged yet, for
+ * transfers that send whole segments: seq in [*first, *end). The first one
+ * may be partly acknowledged already.
+ *
+ * @return ESP_ERR_NOT_FOUND when there is none
+ */
+esp_err_t storage_upload_segments(uint32_t* first, uint32_t* end);
+
+/**
+ * @brief Read part of a sealed raw log segment as it is stored, without
+ * holding the storage lock.
+ *
+ * @return ESP_ERR_NOT_FOUND if the log reused the segment (before or while
+ *         reading), ESP_ERR_INVALID_ARG for the head segment
+ */
+esp_err_t storage_segment_read(uint32_t seq, uint32_t off, void* buf, size_t len);
+
+/**
+ * @brief Acknowledge everything up to the end of segment seq, like
+ * storage_upload_ack() with the position of the next segment.
+ */
+esp_err_t storage_upload_ack_segment(uint32_t seq);
+
+/**
+ * @brief Call cb for every record of one sensor with t_from <= timestamp <= t_to.
+ *
+ * Uses the per-segment time index to seek past everything outside the
+ * window, so a short window costs a few block reads regardless of how much
+ * is stored. The log is only locked while a block is fetched; the callback
+ * runs unlocked.
+ *
+ * @param sensor_id storage_sensor_id_t or STORAGE_SENSOR_ANY
+ * @param stats     Optional, filled with how much of the log was touched
+ */
+esp_err_t storage_query(uint8_t sensor_id, uint32_t t_from, uint32_t t_to,
+                        storage_query_cb_t cb, void* ctx, storage_query_stats_t* stats);
+
+/**
+ * @brief Call cb for every record matching the predicate, e.g. every
+ * MAX6675 sample above 105 °C.
+ *
+ * Blocks whose summary (per-sensor count/min/max/sum) rules out a match are
+ * skipped after reading only their header and summary.
+ *
+ * @return ESP_ERR_NOT_SUPPORTED if the requested rollup tier is not mounted
+ */
+esp_err_t storage_scan(const storage_predicate_t* pred, storage_query_cb_t cb, void* ctx,
+                       storage_query_stats_t* stats);
+
+/**
+ * @brief Fill a scratch log with a synthetic trace until it wraps, then run
+ * threshold scans with and without block summaries and print how many
+ * blocks were skipped and how long each scan took. Sampling is paused
+ * while it runs.
+ */
+void storage_bench_scan(void);
+
+/**
+ * @brief Run the append/read/clear workload of storage_backend_bench.h on
+ * free segments of the active backend and print throughput, write
+ * amplification and latency percentiles. Sampling is paused while it runs.
+ */
+void storage_bench_backend(void);
+
+/**
+ * @brief Compare SD card write strategies on the mounted archive card: the
+ * old open/append/close per line with a free space check, against whole
+ * chunks through the ping-pong buffers with and without preallocation.
+ */
+void storage_bench_sd(void);
+
+const char* storage_sensor_name(uint8_t sensor_id);
+
+/**
+ * @return the storage_sensor_id_t with this name, or -1
+ */
+int storage_sensor_from_name(const char* name);
+
+/**
+ * @brief Format a record the way the old text log stored it: NAME;timestamp;value
+ */
+int storage_record_to_csv(const storage_record_t* record, char* out, size_t len);
+
+/**
+ * @brief Queue a sample for the storage writer task. Never blocks.
+ *
+ * @return false if the queue is full and the sample was dropped
+ */
+bool storage_enqueue_sample(uint8_t sensor_id, uint32_t timestamp, float value);
+
+/**
+ * @brief Queue the code a driver read instead of a converted value, for
+ * sensors with a single raw channel. It is stored as is and converted on
+ * read, so data already logged follows a better calibration later on.
+ */
+bool storage_enqueue_raw(uint8_t sensor_id, uint32_t timestamp, int32_t code);
+
+/**
+ * @brief Queue raw ADXL345 axes; read back as the acceleration magnitude.
+ */
+bool storage_enqueue_axes(uint8_t sensor_id, uint32_t timestamp, const int16_t axes[3]);
+
+/**
+ * @brief Record the calibration a sensor uses from cal->since on. Kept in
+ * NVS (the last STORAGE_CALIB_HISTORY per sensor) and written to the log as
+ * a CAL note, so host tools can convert raw codes as well. Does nothing if
+ * it equals the sensor's current calibration.
+ */
+esp_err_t storage_set_calibration(const storage_calib_t* cal);
+
+/**
+ * @return false if the sensor has no calibration for that time
+ */
+bool storage_get_calibration(uint8_t sensor_id, uint32_t timestamp, storage_calib_t* out);
+
+/**
+ * @brief Ask the writer task to flush everything it has pending right now.
+ */
+void storage_request_flush(void);
+
+void storage_get_writer_stats(storage_writer_stats_t* out);
+
+void storage_get_archive_stats(storage_archive_stats_t* out);
+
+void storage_get_quota_stats(storage_quota_stats_t* out);
+
+/**
+ * @brief Wake the archive task now instead of at its next interval; a card
+ * that was missing is probed again right away.
+ */
+void storage_archive_request(void);
+
+/**
+ * @brief Write the same synthetic trace in the old text and the binary
+ * format and print bytes per sample and write throughput for both.
+ */
+void storage_bench_format(uint32_t samples);
@@ -0,0 +1,243 @@
+#include "storage_manager.h"
+#include "storage_internal.h"
+#include "storage_format.h"
+#include <stdlib.h>
+#include "esp_log.h"
+
+static const char *TAG = "STORAGE_QUERY";
+
+// Enough of a block to decide from its summary whether to read the rest
+#define SCAN_PEEK_SIZE (STORAGE_BLOCK_HEADER_SIZE + STORAGE_SUMMARY_MAX_SIZE)
+
+static inline bool pos_before(const storage_pos_t *a, const storage_pos_t *b)
+{
+    return a->seq < b->seq || (a->seq == b->seq && a->off < b->off);
+}
+
+static bool value_matches(const storage_predicate_t *pred, float value)
+{
+    switch (pred->match) {
+    case STORAGE_MATCH_ABOVE:
+        return value > pred->threshold;
+    case STORAGE_MATCH_BELOW:
+        return value < pred->threshold;
+    default:
+        return true;
+    }
+}
+
+static bool record_matches(const storage_predicate_t *pred, const storage_record_t *record)
+{
+    if (record->timestamp < pred->t_from || record->timestamp > pred->t_to) {
+        return false;
+    }
+    if (pred->sensor_id != STORAGE_SENSOR_ANY && record->sensor_id != pred->sensor_id) {
+        return false;
+    }
+    if (pred->match == STORAGE_MATCH_ANY) {
+        return true;
+    }
+    if (record->sensor_id >= STORAGE_SENSOR_COUNT) {
+        return false;
+    }
+    // A rollup matches if any sample it aggregates would have
+    return value_matches(pred, pred->match == STORAGE_MATCH_ABOVE ? record->max : record->min);
+}
+
+static bool zone_matches(const storage_predicate_t *pred, const storage_zone_t *zone)
+{
+    // Decoded the same way as record values, so the bounds compare exactly
+    float min = (float)zone->min / STORAGE_VALUE_SCALE;
+    float max = (float)zone->max / STORAGE_VALUE_SCALE;
+
+    switch (pred->match) {
+    case STORAGE_MATCH_ABOVE:
+        return max > pred->threshold;
+    case STORAGE_MATCH_BELOW:
+        return min < pred->threshold;
+    default:
+        return true;
+    }
+}
+
+// Decide from the header and summary alone whether a block can hold a match
+static bool block_may_match(const storage_predicate_t *pred, const uint8_t *peek, size_t peek_len)
+{
+    storage_block_header_t hdr;
+    storage_block_summary_t summary;
+
+    if (storage_block_parse_header(peek, peek_len, &hdr) != ESP_OK) {
+        return true;
+    }
+    // Records of a block are in timestamp order
+    if (hdr.base_ts > pred->t_to) {
+        return false;
+    }
+    if (hdr.version < 2 ||
+        storage_block_summary_parse(&peek[STORAGE_BLOCK_HEADER_SIZE], peek_len - STORAGE_BLOCK_HEADER_SIZE,
+                                    &summary) == 0) {
+        return true;
+    }
+    if (hdr.base_ts + summary.ts_span < pred->t_from) {
+        return false;
+    }
+    if (pred->sensor_id == STORAGE_RECORD_NOTE) {
+        return true;
+    }
+    if (pred->sensor_id != STORAGE_SENSOR_ANY) {
+        const storage_zone_t *zone = storage_block_summary_zone(&summary, pred->sensor_id);
+        return zone != NULL && zone_matches(pred, zone);
+    }
+    if (pred->match == STORAGE_MATCH_ANY) {
+        return true;
+    }
+    for (int i = 0; i < summary.zone_count; i++) {
+        if (zone_matches(pred, &summary.zones[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decode one block and hand matching records to the callback.
+// Returns false once the callback asked to stop.
+static bool scan_block(const storage_predicate_t *pred, const uint8_t *block, size_t len,
+                       storage_query_cb_t cb, void *ctx, storage_query_stats_t *stats)
+{
+    storage_block_iter_t it;
+    storage_record_t record;
+
+    if (storage_block_iter_init(&it, block, len) != ESP_OK) {
+        return true;
+    }
+
+    stats->blocks_read++;
+    while (storage_calib_next(&it, &record) == ESP_OK) {
+        if (record.timestamp > pred->t_to) {
+            break;
+        }
+        if (record_matches(pred, &record)) {
+            stats->records++;
+            if (!cb(&record, ctx)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+esp_err_t storage_scan_log(storage_log_t *log, const storage_predicate_t *pred, bool use_summaries,
+                           storage_query_cb_t cb, void *ctx, storage_query_stats_t *stats)
+{
+    storage_query_stats_t local_stats;
+    uint32_t sensors = pred->sensor_id == STORAGE_SENSOR_ANY ? UINT32_MAX : STORAGE_SENSOR_BIT(pred->sensor_id);
+    esp_err_t err = ESP_OK;
+    bool more = true;
+
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    *stats = (storage_query_stats_t){0};
+
+    uint8_t *buf = malloc(STORAGE_BLOCK_SIZE);
+    if (buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    storage_lock();
+    storage_commit_pending(log);
+    storage_pos_t pos = storage_log_tail(log);
+    storage_pos_t end = storage_log_head(log);
+    storage_unlock();
+
+    while (more && pos.seq <= end.seq) {
+        storage_lock();
+        if (pos.seq < log->tail_seq) {
+            // Reclaimed while we were reading
+            pos = storage_log_tail(log);
+        }
+        storage_span_t span = *storage_log_segment_span(log, pos.seq);
+        storage_unlock();
+
+        uint32_t seq = pos.seq;
+        storage_pos_t seg_end = { .seq = seq + 1, .off = STORAGE_SEGMENT_HEADER_SIZE };
+        const storage_pos_t *bound = pos_before(&end, &seg_end) ? &end : &seg_end;
+
+        if (seq > end.seq) {
+            break;
+        }
+        if (!storage_span_overlaps(&span, sensors, pred->t_from, pred->t_to)) {
+            stats->segments_skipped++;
+            pos = seg_end;
+            continue;
+        }
+
+        stats->segments_read++;
+        while (more) {
+            storage_pos_t at;
+            size_t len;
+
+            storage_read_begin(log);
+            err = storage_log_read_snapshot(log, &pos, bound, buf, use_summaries ? SCAN_PEEK_SIZE : STORAGE_BLOCK_SIZE,
+                                            &len, &at);
+            if (err == ESP_OK && use_summaries && !block_may_match(pred, buf, len < SCAN_PEEK_SIZE ? len : SCAN_PEEK_SIZE)) {
+                stats->blocks_skipped++;
+                storage_read_end(log);
+                continue;
+            }
+            if (err == ESP_OK && use_summaries && len > SCAN_PEEK_SIZE) {
+                // Re-read the whole block; if its segment went meanwhile this
+                // moves on to the live tail like any other read
+                storage_pos_t again = at;
+                err = storage_log_read_snapshot(log, &again, bound, buf, STORAGE_BLOCK_SIZE, &len, &at);
+                if (err == ESP_OK) {
+                    pos = again;
+                }
+            }
+            storage_read_end(log);
+
+            if (err != ESP_OK) {
+                break;
+            }
+            more = scan_block(pred, buf, len, cb, ctx, stats);
+        }
+        if (err == ESP_ERR_NOT_FOUND) {
+            err = ESP_OK;
+        } else if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Read failed in segment %lu (%s)", (unsigned long)seq, esp_err_to_name(err));
+            break;
+        }
+        pos = seg_end;
+    }
+
+    free(buf);
+    ESP_LOGD(TAG, "Scan: %lu segments skipped, %lu read, %lu blocks skipped, %lu decoded",
+             (unsigned long)stats->segments_skipped, (unsigned long)stats->segments_read,
+             (unsigned long)stats->blocks_skipped, (unsigned long)stats->blocks_read);
+    return err;
+}
+
+esp_err_t storage_scan(const storage_predicate_t *pred, storage_query_cb_t cb, void *ctx,
+                       storage_query_stats_t *stats)
+{
+    if (!storage_mounted()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    storage_log_t *log = pred->tier < STORAGE_TIER_COUNT ? storage_tier_log(pred->tier) : NULL;
+    if (log == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return storage_scan_log(log, pred, true, cb, ctx, stats);
+}
+
+esp_err_t storage_query(uint8_t sensor_id, uint32_t t_from, uint32_t t_to,
+                        storage_query_cb_t cb, void *ctx, storage_query_stats_t *stats)
+{
+    storage_predicate_t pred = {
+        .sensor_id = sensor_id,
+        .t_from = t_from,
+        .t_to = t_to,
+        .match = STORAGE_MATCH_ANY,
+    };
+    return storage_scan(&pred, cb, ctx, stats);
+}
@@ -0,0 +1,203 @@
+#include "storage_manager.h"
+#include "storage_internal.h"
+#include "storage_format.h"
+#include "project_config.h"
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "STORAGE_QUOTA";
+
+/*
+ * Per-sensor quotas and load shedding for the raw log.
+ *
+ * The log can only give up space a whole segment at a time, oldest first,
+ * so priorities act on samples as they come in. Once less than
+ * STORAGE_QUOTA_PRESSURE_PCT of the raw log is free, a sensor holding more
+ * than its quota of the stored samples is decimated or shed according to
+ * its priority, which leaves what room there is to the sensors that matter
+ * and makes the segments reclaimed later mostly theirs. Shed samples still
+ * reach the rollup tiers.
+ *
+ * Samples of STORAGE_SESSION_SENSOR form a session while they keep coming
+ * (gaps up to STORAGE_SESSION_IDLE_S). The log never reclaims a segment of
+ * an active session: once the next reclaim would hit one, every other
+ * sensor is shed, and a block that would still need it is not written.
+ * Segments released by an upload ack or a clear are not protected.
+ */
+
+typedef struct {
+    uint8_t priority;
+    uint8_t quota_pct;
+} quota_policy_t;
+
+static const quota_policy_t s_policy[STORAGE_SENSOR_COUNT] = {
+    [STORAGE_SENSOR_BMP280] = { STORAGE_POLICY_BMP280 },
+    [STORAGE_SENSOR_VEML7700] = { STORAGE_POLICY_VEML7700 },
+    [STORAGE_SENSOR_MAX6675_NORMAL] = { STORAGE_POLICY_MAX6675_NORMAL },
+    [STORAGE_SENSOR_MAX6675_PROFILE] = { STORAGE_POLICY_MAX6675_PROFILE },
+    [STORAGE_SENSOR_HCSR04] = { STORAGE_POLICY_HCSR04 },
+    [STORAGE_SENSOR_ADXL345] = { STORAGE_POLICY_ADXL345 },
+};
+
+static storage_quota_stats_t s_stats;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Writer state, under the storage lock
+static uint32_t s_stored_total;
+static uint32_t s_quota_total; // quotas of the sensors that have samples stored
+static uint32_t s_warned_victim = UINT32_MAX;
+static uint32_t s_decimate[STORAGE_SENSOR_COUNT];
+static uint32_t s_session_last_ts;
+
+uint8_t storage_quota_priority(uint8_t sensor_id)
+{
+    return sensor_id < STORAGE_SENSOR_COUNT ? s_policy[sensor_id].priority : STORAGE_PRIO_HIGH;
+}
+
+void storage_quota_count_dropped(uint8_t sensor_id)
+{
+    if (sensor_id >= STORAGE_SENSOR_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.sensors[sensor_id].dropped++;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+void storage_quota_refresh(const storage_log_t *log)
+{
+    uint32_t stored[STORAGE_SENSOR_COUNT] = {0};
+    uint32_t total = 0, quota_total = 0;
+
+    for (uint32_t seq = log->tail_seq; seq <= log->head_seq; seq++) {
+        const storage_span_t *span = storage_log_segment_span(log, seq);
+        for (int i = 0; i < STORAGE_SENSOR_COUNT; i++) {
+            stored[i] += span->counts[i];
+        }
+    }
+    for (int i = 0; i < STORAGE_SENSOR_COUNT; i++) {
+        total += stored[i];
+        quota_total += stored[i] > 0 ? s_policy[i].quota_pct : 0;
+    }
+
+    uint64_t capacity = (uint64_t)log->segment_count * STORAGE_SEGMENT_SIZE;
+    bool pressure = (uint64_t)storage_log_free_bytes(log) * 100 < capacity * STORAGE_QUOTA_PRESSURE_PCT;
+    bool changed = pressure != s_stats.pressure;
+
+    portENTER_CRITICAL(&s_stats_lock);
+    for (int i = 0; i < STORAGE_SENSOR_COUNT; i++) {
+        s_stats.sensors[i].stored = stored[i];
+    }
+    s_stats.pressure = pressure;
+    portEXIT_CRITICAL(&s_stats_lock);
+    s_stored_total = total;
+    s_quota_total = quota_total;
+
+    if (changed) {
+        ESP_LOGW(TAG, pressure ? "Raw log almost full, quotas apply" : "Raw log has room again");
+    }
+}
+
+// First segment of the active session that is still live
+static uint32_t session_first(const storage_log_t *log)
+{
+    return s_stats.session_seq > log->tail_seq ? s_stats.session_seq : log->tail_seq;
+}
+
+// Opening the next segment would reclaim one of the session's
+static bool session_at_risk(const storage_log_t *log)
+{
+    return s_stats.session_active && log->head_seq + 1 >= session_first(log) + log->segment_count;
+}
+
+static void session_track(const storage_log_t *log, const storage_sample_t *sample)
+{
+    bool active = s_stats.session_active;
+
+    if (active && sample->timestamp > s_session_last_ts + STORAGE_SESSION_IDLE_S) {
+        ESP_LOGI(TAG, "%s session ended", storage_sensor_name(STORAGE_SESSION_SENSOR));
+        active = false;
+    }
+    if (sample->sensor_id == STORAGE_SESSION_SENSOR) {
+        if (!active) {
+            ESP_LOGI(TAG, "%s session started in segment %lu", storage_sensor_name(STORAGE_SESSION_SENSOR),
+                     (unsigned long)log->head_seq);
+            s_stats.session_seq = log->head_seq;
+            active = true;
+        }
+        s_session_last_ts = sample->timestamp;
+    }
+    s_stats.session_active = active;
+}
+
+// Quotas of sensors with nothing stored are shared out among the others
+static bool over_quota(uint8_t id)
+{
+    return (uint64_t)s_stats.sensors[id].stored * s_quota_total > (uint64_t)s_stored_total * s_policy[id].quota_pct;
+}
+
+bool storage_quota_admit(const storage_sample_t *sample)
+{
+    uint8_t id = sample->sensor_id;
+    storage_log_t *log = storage_main_log();
+    bool admit = true;
+
+    session_track(log, sample);
+    if (id >= STORAGE_SENSOR_COUNT || id == STORAGE_SESSION_SENSOR) {
+        return true;
+    }
+
+    if (session_at_risk(log)) {
+        admit = false;
+    } else if (s_stats.pressure && s_policy[id].priority != STORAGE_PRIO_HIGH && over_quota(id)) {
+        admit = s_policy[id].priority == STORAGE_PRIO_NORMAL && s_decimate[id]++ % STORAGE_QUOTA_DECIMATE == 0;
+    }
+
+    if (!admit) {
+        portENTER_CRITICAL(&s_stats_lock);
+        s_stats.sensors[id].shed++;
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+    return admit;
+}
+
+bool storage_quota_before_append(const storage_log_t *log, size_t len, const storage_span_t *span)
+{
+    uint32_t victim;
+
+    if (!storage_log_append_reclaims(log, len, &victim)) {
+        return true;
+    }
+
+    bool keep = !(s_stats.session_active && victim >= session_first(log));
+    const storage_span_t *lost = keep ? storage_log_segment_span(log, victim) : span;
+
+    portENTER_CRITICAL(&s_stats_lock);
+    for (int i = 0; i < STORAGE_SENSOR_COUNT; i++) {
+        if (keep) {
+            s_stats.sensors[i].evicted += lost->counts[i];
+        } else {
+            s_stats.sensors[i].shed += lost->counts[i];
+        }
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    if (!keep && victim != s_warned_victim) {
+        ESP_LOGW(TAG, "Log full of the active session from segment %lu, new blocks are not stored",
+                 (unsigned long)victim);
+        s_warned_victim = victim;
+    }
+    return keep;
+}
+
+void storage_get_quota_stats(storage_quota_stats_t *out)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *out = s_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+    for (int i = 0; i < STORAGE_SENSOR_COUNT; i++) {
+        out->sensors[i].priority = s_policy[i].priority;
+        out->sensors[i].quota_pct = s_policy[i].quota_pct;
+    }
+}
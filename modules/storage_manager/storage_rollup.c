@@ -0,0 +1,230 @@
+#include "storage_manager.h"
+#include "storage_internal.h"
+#include "storage_format.h"
+#include "project_config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "STORAGE_ROLLUP";
+
+/*
+ * Rollup tiers. Every raw sample updates the open 1-minute bucket of its
+ * sensor; a closed minute bucket is written to the minute tier and merged
+ * into the open hour bucket, and so on. Each step is O(1) and nothing is
+ * ever re-read from flash. Buckets still open at a reboot are lost.
+ */
+
+typedef struct {
+    uint32_t bucket_ts;
+    uint32_t count; // 0 = no open bucket
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+} rollup_acc_t;
+
+typedef struct {
+    const char *name;
+    uint32_t bucket_s;
+    uint32_t segments;
+    uint32_t retention_s;
+    bool mounted;
+    storage_log_t log;
+    storage_span_t *index;
+    uint8_t buf[STORAGE_BLOCK_SIZE];
+    storage_block_builder_t block;
+    int64_t block_started_us;
+    rollup_acc_t acc[STORAGE_SENSOR_COUNT];
+} rollup_tier_t;
+
+static rollup_tier_t s_tiers[] = {
+    { .name = "1min", .bucket_s = 60, .segments = STORAGE_MINUTE_SEGMENTS, .retention_s = STORAGE_MINUTE_RETENTION_S },
+    { .name = "1h", .bucket_s = 3600, .segments = STORAGE_HOUR_SEGMENTS, .retention_s = STORAGE_HOUR_RETENTION_S },
+};
+
+#define TIER_COUNT (sizeof(s_tiers) / sizeof(s_tiers[0]))
+
+// Newest sample timestamp seen, used as "now" for bucket closing and retention
+static uint32_t s_latest_ts;
+
+uint32_t storage_rollup_segments(void)
+{
+    uint32_t total = 0;
+    for (size_t i = 0; i < TIER_COUNT; i++) {
+        total += s_tiers[i].segments;
+    }
+    return total;
+}
+
+esp_err_t storage_rollup_mount(storage_backend_t *backend, uint32_t base)
+{
+    for (size_t i = 0; i < TIER_COUNT; i++) {
+        rollup_tier_t *t = &s_tiers[i];
+
+        if (t->index == NULL) {
+            t->index = calloc(t->segments, sizeof(storage_span_t));
+        }
+        if (t->index == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        esp_err_t err = storage_log_mount(&t->log, backend, base, t->segments, t->index);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Tier %s mount failed (%s)", t->name, esp_err_to_name(err));
+            return err;
+        }
+        storage_block_begin(&t->block, t->buf, sizeof(t->buf));
+        t->mounted = true;
+        base += t->segments * STORAGE_SEGMENT_SIZE;
+    }
+    return ESP_OK;
+}
+
+static void tier_commit(rollup_tier_t *t)
+{
+    if (storage_block_empty(&t->block)) {
+        return;
+    }
+
+    storage_span_t span;
+    storage_block_span(&t->block, &span);
+    esp_err_t err = storage_log_append(&t->log, t->buf, storage_block_seal(&t->block), &span);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Tier %s write failed (%s)", t->name, esp_err_to_name(err));
+    }
+    storage_block_begin(&t->block, t->buf, sizeof(t->buf));
+
+    if (t->retention_s > 0 && s_latest_ts > t->retention_s) {
+        storage_log_expire(&t->log, s_latest_ts - t->retention_s);
+    }
+}
+
+static void tier_accumulate(size_t level, uint8_t sensor_id, uint32_t ts, const rollup_acc_t *in);
+
+static void tier_emit(size_t level, uint8_t sensor_id, const rollup_acc_t *acc)
+{
+    rollup_tier_t *t = &s_tiers[level];
+
+    if (t->mounted) {
+        if (storage_block_empty(&t->block)) {
+            t->block_started_us = esp_timer_get_time();
+        }
+        if (!storage_block_add_rollup(&t->block, sensor_id, acc->bucket_ts, acc->count, acc->min, acc->max, acc->sum)) {
+            tier_commit(t);
+            t->block_started_us = esp_timer_get_time();
+            storage_block_add_rollup(&t->block, sensor_id, acc->bucket_ts, acc->count, acc->min, acc->max, acc->sum);
+        }
+    }
+    if (level + 1 < TIER_COUNT) {
+        tier_accumulate(level + 1, sensor_id, acc->bucket_ts, acc);
+    }
+}
+
+static void tier_accumulate(size_t level, uint8_t sensor_id, uint32_t ts, const rollup_acc_t *in)
+{
+    rollup_tier_t *t = &s_tiers[level];
+    rollup_acc_t *acc = &t->acc[sensor_id];
+    uint32_t bucket = ts - ts % t->bucket_s;
+
+    if (acc->count > 0 && acc->bucket_ts != bucket) {
+        tier_emit(level, sensor_id, acc);
+        acc->count = 0;
+    }
+    if (acc->count == 0) {
+        *acc = *in;
+        acc->bucket_ts = bucket;
+        return;
+    }
+    acc->count += in->count;
+    acc->min = in->min < acc->min ? in->min : acc->min;
+    acc->max = in->max > acc->max ? in->max : acc->max;
+    acc->sum += in->sum;
+}
+
+void storage_rollup_add(const storage_sample_t *sample)
+{
+    if (sample->sensor_id >= STORAGE_SENSOR_COUNT) {
+        return;
+    }
+    int32_t scaled = (int32_t)lroundf(sample->value * STORAGE_VALUE_SCALE);
+    rollup_acc_t in = {
+        .count = 1,
+        .min = scaled,
+        .max = scaled,
+        .sum = scaled,
+    };
+    if (sample->timestamp > s_latest_ts) {
+        s_latest_ts = sample->timestamp;
+    }
+    tier_accumulate(0, sample->sensor_id, sample->timestamp, &in);
+}
+
+void storage_rollup_flush(bool force)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    for (size_t level = 0; level < TIER_COUNT; level++) {
+        rollup_tier_t *t = &s_tiers[level];
+
+        // Close buckets of sensors that went quiet once time moved past them
+        for (uint8_t id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+            rollup_acc_t *acc = &t->acc[id];
+            if (acc->count > 0 && acc->bucket_ts + t->bucket_s <= s_latest_ts) {
+                tier_emit(level, id, acc);
+                acc->count = 0;
+            }
+        }
+
+        if (!storage_block_empty(&t->block) &&
+            (force || (now_us - t->block_started_us) / 1000 >= STORAGE_ROLLUP_FLUSH_AGE_MS)) {
+            tier_commit(t);
+        }
+    }
+}
+
+esp_err_t storage_rollup_clear(void)
+{
+    esp_err_t ret = ESP_OK;
+
+    for (size_t i = 0; i < TIER_COUNT; i++) {
+        rollup_tier_t *t = &s_tiers[i];
+        memset(t->acc, 0, sizeof(t->acc));
+        if (!t->mounted) {
+            continue;
+        }
+        storage_block_begin(&t->block, t->buf, sizeof(t->buf));
+        esp_err_t err = storage_log_clear(&t->log);
+        if (err != ESP_OK) {
+            ret = err;
+        }
+    }
+    s_latest_ts = 0;
+    return ret;
+}
+
+storage_log_t *storage_tier_log(storage_tier_t tier)
+{
+    if (tier == STORAGE_TIER_RAW) {
+        return storage_main_log();
+    }
+    size_t level = tier - STORAGE_TIER_MINUTE;
+    if (level >= TIER_COUNT || !s_tiers[level].mounted) {
+        return NULL;
+    }
+    return &s_tiers[level].log;
+}
+
+void storage_commit_pending(storage_log_t *log)
+{
+    if (log == storage_main_log()) {
+        storage_block_commit();
+        return;
+    }
+    for (size_t i = 0; i < TIER_COUNT; i++) {
+        if (log == &s_tiers[i].log) {
+            tier_commit(&s_tiers[i]);
+        }
+    }
+}
@@ -0,0 +1,262 @@
+#include "storage_series.h"
+#include "storage_format.h"
+#include <string.h>
+
+#define TAG_BITS 3
+#define CHANNEL_BITS 3
+#define NOTE_LEN_BITS 7
+
+// Prefix codes shared by timestamps and values: bucket i is written as i
+// one-bits, a terminating zero (except for the last bucket) and width[i]
+// payload bits. Bucket 0 has no payload and means "zero".
+typedef struct {
+    uint8_t count;
+    uint8_t width[5];
+} bucket_code_t;
+
+static const bucket_code_t s_ts_code = { 5, { 0, 7, 9, 12, 32 } };
+static const bucket_code_t s_value_code = { 5, { 0, 6, 12, 20, 32 } };
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static void put_bits(uint8_t *out, uint32_t *pos, uint32_t v, unsigned n)
+{
+    while (n > 0) {
+        uint32_t p = *pos;
+        unsigned free = 8 - (p & 7);
+        unsigned take = n < free ? n : free;
+        uint32_t chunk = (v >> (n - take)) & ((1u << take) - 1);
+
+        if ((p & 7) == 0) {
+            out[p >> 3] = 0;
+        }
+        out[p >> 3] |= (uint8_t)(chunk << (free - take));
+        *pos += take;
+        n -= take;
+    }
+}
+
+static bool get_bits(const uint8_t *in, size_t len, uint32_t *pos, unsigned n, uint32_t *v)
+{
+    if (*pos + n > len * 8) {
+        return false;
+    }
+    uint32_t r = 0;
+    while (n > 0) {
+        uint32_t p = *pos;
+        unsigned avail = 8 - (p & 7);
+        unsigned take = n < avail ? n : avail;
+
+        r = (r << take) | ((in[p >> 3] >> (avail - take)) & ((1u << take) - 1));
+        *pos += take;
+        n -= take;
+    }
+    *v = r;
+    return true;
+}
+
+static unsigned bucket_of(const bucket_code_t *code, uint32_t zz)
+{
+    if (zz == 0) {
+        return 0;
+    }
+    for (unsigned i = 1; i < code->count - 1u; i++) {
+        if (zz < (1u << code->width[i])) {
+            return i;
+        }
+    }
+    return code->count - 1;
+}
+
+static size_t bucket_bits(const bucket_code_t *code, uint32_t zz)
+{
+    unsigned i = bucket_of(code, zz);
+    unsigned prefix = i + (i < code->count - 1u ? 1 : 0);
+    return prefix + code->width[i];
+}
+
+static void bucket_put(const bucket_code_t *code, uint8_t *out, uint32_t *pos, uint32_t zz)
+{
+    unsigned i = bucket_of(code, zz);
+    if (i < code->count - 1u) {
+        put_bits(out, pos, ((1u << i) - 1) << 1, i + 1); // i ones and a zero
+    } else {
+        put_bits(out, pos, (1u << i) - 1, i);
+    }
+    if (code->width[i] > 0) {
+        put_bits(out, pos, zz, code->width[i]);
+    }
+}
+
+static bool bucket_get(const bucket_code_t *code, const uint8_t *in, size_t len, uint32_t *pos, uint32_t *zz)
+{
+    unsigned i = 0;
+    uint32_t bit = 1;
+
+    while (i < code->count - 1u) {
+        if (!get_bits(in, len, pos, 1, &bit)) {
+            return false;
+        }
+        if (bit == 0) {
+            break;
+        }
+        i++;
+    }
+    if (code->width[i] == 0) {
+        *zz = 0;
+        return true;
+    }
+    return get_bits(in, len, pos, code->width[i], zz);
+}
+
+// Delta-of-delta of a timestamp against its context, modulo 2^32
+static inline uint32_t ts_dod(const storage_series_ctx_t *c, uint32_t timestamp)
+{
+    return zigzag((int32_t)((timestamp - c->ts) - c->delta));
+}
+
+static inline void ts_advance(storage_series_ctx_t *c, uint32_t timestamp)
+{
+    c->delta = timestamp - c->ts;
+    c->ts = timestamp;
+}
+
+void storage_series_reset(storage_series_ctx_t *ctx, uint32_t base_ts)
+{
+    for (int i = 0; i < STORAGE_SERIES_CONTEXTS; i++) {
+        ctx[i].ts = base_ts;
+        ctx[i].delta = 0;
+        ctx[i].value = 0;
+    }
+}
+
+static inline size_t value_bits(const storage_series_ctx_t *c, uint32_t timestamp, int32_t v)
+{
+    return bucket_bits(&s_ts_code, ts_dod(c, timestamp)) +
+           bucket_bits(&s_value_code, zigzag((int32_t)((uint32_t)v - (uint32_t)c->value)));
+}
+
+static void value_put(uint8_t *out, uint32_t *pos, storage_series_ctx_t *c, uint32_t timestamp, int32_t v)
+{
+    bucket_put(&s_ts_code, out, pos, ts_dod(c, timestamp));
+    bucket_put(&s_value_code, out, pos, zigzag((int32_t)((uint32_t)v - (uint32_t)c->value)));
+    ts_advance(c, timestamp);
+    c->value = v;
+}
+
+size_t storage_series_sample_bits(const storage_series_ctx_t *ctx, uint8_t sensor_id,
+                                  uint32_t timestamp, int32_t scaled)
+{
+    return TAG_BITS + value_bits(&ctx[sensor_id], timestamp, scaled);
+}
+
+size_t storage_series_raw_bits(const storage_series_ctx_t *ctx, uint8_t channel, uint32_t timestamp,
+                               int32_t code)
+{
+    return TAG_BITS + CHANNEL_BITS + value_bits(&ctx[STORAGE_SERIES_NOTE_TAG + channel], timestamp, code);
+}
+
+size_t storage_series_note_bits(const storage_series_ctx_t *ctx, uint32_t timestamp,
+                                size_t text_len, uint32_t pos)
+{
+    uint32_t end = pos + TAG_BITS + bucket_bits(&s_ts_code, ts_dod(&ctx[STORAGE_SERIES_NOTE_TAG], timestamp)) +
+                   NOTE_LEN_BITS;
+    end = (end + 7) & ~7u;
+    return end - pos + text_len * 8;
+}
+
+void storage_series_put_sample(uint8_t *out, uint32_t *pos, storage_series_ctx_t *ctx, uint8_t sensor_id,
+                               uint32_t timestamp, int32_t scaled)
+{
+    put_bits(out, pos, sensor_id, TAG_BITS);
+    value_put(out, pos, &ctx[sensor_id], timestamp, scaled);
+}
+
+void storage_series_put_raw(uint8_t *out, uint32_t *pos, storage_series_ctx_t *ctx, uint8_t channel,
+                            uint32_t timestamp, int32_t code)
+{
+    put_bits(out, pos, STORAGE_SERIES_RAW_TAG, TAG_BITS);
+    put_bits(out, pos, channel - 1u, CHANNEL_BITS);
+    value_put(out, pos, &ctx[STORAGE_SERIES_NOTE_TAG + channel], timestamp, code);
+}
+
+void storage_series_put_note(uint8_t *out, uint32_t *pos, storage_series_ctx_t *ctx, uint32_t timestamp,
+                             const char *text, size_t text_len)
+{
+    storage_series_ctx_t *c = &ctx[STORAGE_SERIES_NOTE_TAG];
+
+    put_bits(out, pos, STORAGE_SERIES_NOTE_TAG, TAG_BITS);
+    bucket_put(&s_ts_code, out, pos, ts_dod(c, timestamp));
+    put_bits(out, pos, (uint32_t)text_len, NOTE_LEN_BITS);
+    *pos = (*pos + 7) & ~7u;
+    memcpy(&out[*pos >> 3], text, text_len);
+    *pos += text_len * 8;
+    ts_advance(c, timestamp);
+}
+
+esp_err_t storage_series_get(const uint8_t *in, size_t len, uint32_t *pos, storage_series_ctx_t *ctx,
+                             storage_record_t *rec)
+{
+    uint32_t tag, zz, channel = STORAGE_RAW_NONE;
+
+    if (!get_bits(in, len, pos, TAG_BITS, &tag) ||
+        (tag > STORAGE_SERIES_NOTE_TAG && tag != STORAGE_SERIES_RAW_TAG)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (tag == STORAGE_SERIES_RAW_TAG) {
+        if (!get_bits(in, len, pos, CHANNEL_BITS, &channel) || ++channel >= STORAGE_RAW_CHANNEL_COUNT) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    storage_series_ctx_t *c = &ctx[channel ? STORAGE_SERIES_NOTE_TAG + channel : tag];
+    if (!bucket_get(&s_ts_code, in, len, pos, &zz)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint32_t delta = c->delta + (uint32_t)unzigzag(zz);
+    c->delta = delta;
+    c->ts += delta;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->timestamp = c->ts;
+
+    if (tag == STORAGE_SERIES_NOTE_TAG) {
+        uint32_t text_len;
+        if (!get_bits(in, len, pos, NOTE_LEN_BITS, &text_len)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        *pos = (*pos + 7) & ~7u;
+        if ((*pos >> 3) + text_len > len) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        rec->sensor_id = STORAGE_RECORD_NOTE;
+        rec->note = (const char *)&in[*pos >> 3];
+        rec->note_len = (uint8_t)text_len;
+        *pos += text_len * 8;
+        return ESP_OK;
+    }
+
+    if (!bucket_get(&s_value_code, in, len, pos, &zz)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    c->value = (int32_t)((uint32_t)c->value + (uint32_t)unzigzag(zz));
+    if (channel != STORAGE_RAW_NONE) {
+        rec->sensor_id = storage_raw_sensor(channel);
+        rec->raw = (uint8_t)channel;
+        rec->value = (float)c->value;
+    } else {
+        rec->sensor_id = (uint8_t)tag;
+        rec->value = (float)c->value / STORAGE_VALUE_SCALE;
+    }
+    rec->min = rec->value;
+    rec->max = rec->value;
+    rec->count = 1;
+    return ESP_OK;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "storage_manager.h"
+
+/*
+ * Bit-packed record stream of STORAGE_ENCODING_SERIES blocks, in the
+ * spirit of Gorilla (Pelkonen et al., VLDB 2015). Records stay in
+ * timestamp order, but every sensor has its own context, so a sensor
+ * sampled at a steady interval costs a single bit per timestamp and
+ * slowly changing values only a few bits each. Bits are written MSB first.
+ *
+ * Per record:
+ *  3 bits  tag: sensor id, STORAGE_SERIES_NOTE_TAG or STORAGE_SERIES_RAW_TAG
+ *  raw:    3 bits channel - 1 (storage_raw_channel_t); each channel has
+ *          its own context and its value is the code itself
+ *  timestamp, delta-of-delta to the previous record of the same context:
+ *   '0'                      dod == 0
+ *   '10'   + 7 bits          zig-zag(dod) < 2^7
+ *   '110'  + 9 bits          zig-zag(dod) < 2^9
+ *   '1110' + 12 bits         zig-zag(dod) < 2^12
+ *   '1111' + 32 bits         anything else
+ *  sensor: value * STORAGE_VALUE_SCALE as a delta to the previous value
+ *          of the same sensor (0 for the first one):
+ *   '0'                      delta == 0
+ *   '10'   + 6 bits          zig-zag(delta) < 2^6
+ *   '110'  + 12 bits         zig-zag(delta) < 2^12
+ *   '1110' + 20 bits         zig-zag(delta) < 2^20
+ *   '1111' + 32 bits         anything else
+ *  note:   7 bits length, padding to a byte boundary, then the raw text
+ *
+ * Every context starts the block with ts = base_ts, delta 0 and value 0.
+ * The last byte is zero-padded.
+ */
+
+#define STORAGE_SERIES_NOTE_TAG STORAGE_SENSOR_COUNT
+#define STORAGE_SERIES_RAW_TAG 7
+// Contexts: sensors, notes, then raw channels 1.. at NOTE_TAG + channel
+#define STORAGE_SERIES_CONTEXTS (STORAGE_SENSOR_COUNT + STORAGE_RAW_CHANNEL_COUNT)
+
+_Static_assert(STORAGE_SERIES_NOTE_TAG < STORAGE_SERIES_RAW_TAG, "series tags are 3 bits wide");
+_Static_assert(STORAGE_RAW_CHANNEL_COUNT - 1 <= 8, "raw channels are 3 bits wide");
+
+void storage_series_reset(storage_series_ctx_t *ctx, uint32_t base_ts);
+
+// Bits the record would take at bit position pos (notes are byte aligned)
+size_t storage_series_sample_bits(const storage_series_ctx_t *ctx, uint8_t sensor_id,
+                                  uint32_t timestamp, int32_t scaled);
+size_t storage_series_raw_bits(const storage_series_ctx_t *ctx, uint8_t channel, uint32_t timestamp,
+                               int32_t code);
+size_t storage_series_note_bits(const storage_series_ctx_t *ctx, uint32_t timestamp,
+                                size_t text_len, uint32_t pos);
+
+// The caller checked the record fits; bits after *pos must be zero
+void storage_series_put_sample(uint8_t *out, uint32_t *pos, storage_series_ctx_t *ctx, uint8_t sensor_id,
+                               uint32_t timestamp, int32_t scaled);
+void storage_series_put_raw(uint8_t *out, uint32_t *pos, storage_series_ctx_t *ctx, uint8_t channel,
+                            uint32_t timestamp, int32_t code);
+void storage_series_put_note(uint8_t *out, uint32_t *pos, storage_series_ctx_t *ctx, uint32_t timestamp,
+                             const char *text, size_t text_len);
+
+/**
+ * @brief Decode the record at bit position *pos of a len-byte stream.
+ * Note text points into the stream.
+ */
+esp_err_t storage_series_get(const uint8_t *in, size_t len, uint32_t *pos, storage_series_ctx_t *ctx,
+                             storage_record_t *rec);
@@ -0,0 +1,149 @@
+#include "storage_manager.h"
+#include "storage_internal.h"
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+
+static const char *TAG = "STORAGE_UPLOAD";
+
+#define NVS_NAMESPACE "storage_mgr"
+#define NVS_UPLOAD_POS_KEY "upload_pos"
+
+// Everything before this position has been acknowledged by the broker
+static storage_pos_t s_upload_pos;
+
+static inline bool pos_after(const storage_pos_t *a, const storage_pos_t *b)
+{
+    return a->seq > b->seq || (a->seq == b->seq && a->off > b->off);
+}
+
+static void upload_pos_persist(const storage_pos_t *pos)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_u64(handle, NVS_UPLOAD_POS_KEY, ((uint64_t)pos->seq << 32) | pos->off);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to persist upload position (%s)", esp_err_to_name(err));
+    }
+}
+
+void storage_upload_restore(void)
+{
+    storage_log_t *log = storage_main_log();
+    storage_pos_t head = storage_log_head(log);
+    nvs_handle_t handle;
+    uint64_t raw = 0;
+
+    s_upload_pos = storage_log_tail(log);
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = nvs_get_u64(handle, NVS_UPLOAD_POS_KEY, &raw);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return;
+    }
+
+    storage_pos_t pos = { .seq = (uint32_t)(raw >> 32), .off = (uint32_t)raw };
+    if (pos_after(&pos, &head)) {
+        // Left over from a log that has since been reformatted
+        ESP_LOGW(TAG, "Stored upload position %lu:%lu is past the head, ignoring",
+                 (unsigned long)pos.seq, (unsigned long)pos.off);
+        return;
+    }
+    if (pos_after(&pos, &s_upload_pos)) {
+        s_upload_pos = pos;
+        storage_log_trim(log, pos.seq);
+    }
+    ESP_LOGI(TAG, "Upload resumes at %lu:%lu", (unsigned long)s_upload_pos.seq, (unsigned long)s_upload_pos.off);
+}
+
+esp_err_t storage_upload_open(storage_cursor_t *cur)
+{
+    esp_err_t err = storage_cursor_open(cur);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    storage_lock();
+    // Positions in segments reclaimed since the ack continue at the tail
+    if (pos_after(&s_upload_pos, &cur->next)) {
+        cur->next = s_upload_pos;
+    }
+    storage_unlock();
+    return ESP_OK;
+}
+
+esp_err_t storage_upload_ack(const storage_pos_t *pos)
+{
+    if (!storage_mounted()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    storage_lock();
+    if (!pos_after(pos, &s_upload_pos)) {
+        storage_unlock();
+        return ESP_OK;
+    }
+    s_upload_pos = *pos;
+    storage_log_trim(storage_main_log(), pos->seq);
+    storage_space_refresh();
+    storage_unlock();
+
+    upload_pos_persist(pos);
+    return ESP_OK;
+}
+
+esp_err_t storage_upload_segments(uint32_t *first, uint32_t *end)
+{
+    if (!storage_mounted()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    storage_lock();
+    storage_log_t *log = storage_main_log();
+    // Segments behind the tail were released (by a clear, for one) even
+    // when their bytes are still readable
+    uint32_t oldest = storage_log_oldest_readable(log);
+    *first = s_upload_pos.seq > log->tail_seq ? s_upload_pos.seq : log->tail_seq;
+    *first = *first > oldest ? *first : oldest;
+    *end = log->head_seq;
+    storage_unlock();
+    return *first < *end ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t storage_segment_read(uint32_t seq, uint32_t off, void *buf, size_t len)
+{
+    storage_log_t *log = storage_main_log();
+
+    if (!storage_mounted() || off + len > STORAGE_SEGMENT_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (seq >= __atomic_load_n(&log->head_seq, __ATOMIC_ACQUIRE)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!storage_log_segment_readable(log, seq)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    storage_read_begin(log);
+    esp_err_t err = storage_backend_read(log->backend, storage_log_segment_offset(log, seq) + off, buf, len);
+    storage_read_end(log);
+    // The writer may have started erasing the slot for a new head meanwhile
+    if (err == ESP_OK && !storage_log_segment_readable(log, seq)) {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    return err;
+}
+
+esp_err_t storage_upload_ack_segment(uint32_t seq)
+{
+    storage_pos_t pos = { .seq = seq + 1, .off = STORAGE_SEGMENT_HEADER_SIZE };
+    return storage_upload_ack(&pos);
+}
@@ -0,0 +1,330 @@
+#include "storage_manager.h"
+#include "storage_internal.h"
+#include "storage_format.h"
+#include "project_config.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "STORAGE_WRITER";
+
+// Queued by storage_request_flush(), never written to the log
+#define STORAGE_FLUSH_MARKER 0xFF
+
+#if STORAGE_COMPRESS_SERIES
+#define WRITER_ENCODING STORAGE_ENCODING_SERIES
+#else
+#define WRITER_ENCODING STORAGE_ENCODING_PLAIN
+#endif
+
+static QueueHandle_t s_sample_queue = NULL;
+static SemaphoreHandle_t s_storage_mutex = NULL;
+static TaskHandle_t s_writer_task = NULL;
+
+static uint8_t s_block_buf[STORAGE_BLOCK_SIZE];
+static storage_block_builder_t s_block;
+
+static uint32_t s_uncalibrated; // sensors already warned about
+
+static storage_writer_stats_t s_stats;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void storage_lock(void)
+{
+    if (s_storage_mutex != NULL) {
+        xSemaphoreTakeRecursive(s_storage_mutex, portMAX_DELAY);
+    }
+}
+
+void storage_unlock(void)
+{
+    if (s_storage_mutex != NULL) {
+        xSemaphoreGiveRecursive(s_storage_mutex);
+    }
+}
+
+void storage_read_begin(const storage_log_t *log)
+{
+    if (!log->backend->ops->shared_reads) {
+        storage_lock();
+    }
+}
+
+void storage_read_end(const storage_log_t *log)
+{
+    if (!log->backend->ops->shared_reads) {
+        storage_unlock();
+    }
+}
+
+static bool enqueue(const storage_sample_t *sample)
+{
+    // The last STORAGE_QUEUE_RESERVE slots are kept for high priority samples
+    bool queued = s_sample_queue != NULL &&
+                  (storage_quota_priority(sample->sensor_id) == STORAGE_PRIO_HIGH ||
+                   uxQueueSpacesAvailable(s_sample_queue) > STORAGE_QUEUE_RESERVE) &&
+                  xQueueSend(s_sample_queue, sample, 0) == pdTRUE;
+
+    portENTER_CRITICAL(&s_stats_lock);
+    if (queued) {
+        s_stats.enqueued++;
+        uint32_t depth = uxQueueMessagesWaiting(s_sample_queue);
+        if (depth > s_stats.queue_high_water) {
+            s_stats.queue_high_water = depth;
+        }
+    } else {
+        s_stats.dropped++;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    if (!queued) {
+        storage_quota_count_dropped(sample->sensor_id);
+    }
+    return queued;
+}
+
+bool storage_enqueue_sample(uint8_t sensor_id, uint32_t timestamp, float value)
+{
+    storage_sample_t sample = {
+        .sensor_id = sensor_id,
+        .timestamp = timestamp,
+        .value = value,
+    };
+    return enqueue(&sample);
+}
+
+bool storage_enqueue_raw(uint8_t sensor_id, uint32_t timestamp, int32_t code)
+{
+    static const uint8_t channels[STORAGE_SENSOR_COUNT] = {
+        [STORAGE_SENSOR_BMP280] = STORAGE_RAW_BMP280_T,
+        [STORAGE_SENSOR_VEML7700] = STORAGE_RAW_VEML7700,
+        [STORAGE_SENSOR_MAX6675_NORMAL] = STORAGE_RAW_MAX6675_NORMAL,
+        [STORAGE_SENSOR_MAX6675_PROFILE] = STORAGE_RAW_MAX6675_PROFILE,
+    };
+    storage_sample_t sample = {
+        .sensor_id = sensor_id,
+        .raw = sensor_id < STORAGE_SENSOR_COUNT ? channels[sensor_id] : STORAGE_RAW_NONE,
+        .timestamp = timestamp,
+        .code = code,
+    };
+
+    if (sample.raw == STORAGE_RAW_NONE) {
+        ESP_LOGE(TAG, "%s has no single raw channel", storage_sensor_name(sensor_id));
+        return false;
+    }
+    return enqueue(&sample);
+}
+
+bool storage_enqueue_axes(uint8_t sensor_id, uint32_t timestamp, const int16_t axes[3])
+{
+    storage_sample_t sample = {
+        .sensor_id = sensor_id,
+        .raw = STORAGE_RAW_ADXL345_X,
+        .timestamp = timestamp,
+        .axes = { axes[0], axes[1], axes[2] },
+    };
+
+    if (sensor_id != STORAGE_SENSOR_ADXL345) {
+        ESP_LOGE(TAG, "%s has no raw axes", storage_sensor_name(sensor_id));
+        return false;
+    }
+    return enqueue(&sample);
+}
+
+void storage_request_flush(void)
+{
+    storage_sample_t marker = { .sensor_id = STORAGE_FLUSH_MARKER };
+    if (s_sample_queue != NULL) {
+        xQueueSend(s_sample_queue, &marker, 0);
+    }
+}
+
+bool storage_writer_idle(void)
+{
+    return s_sample_queue == NULL || uxQueueMessagesWaiting(s_sample_queue) == 0;
+}
+
+void storage_get_writer_stats(storage_writer_stats_t *out)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *out = s_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+    out->queue_depth = s_sample_queue ? uxQueueMessagesWaiting(s_sample_queue) : 0;
+    out->stack_free_min = s_writer_task ? uxTaskGetStackHighWaterMark(s_writer_task) : 0;
+}
+
+bool storage_block_commit(void)
+{
+    if (storage_block_empty(&s_block)) {
+        return true;
+    }
+
+    uint16_t count = s_block.count;
+    storage_span_t span;
+    storage_block_span(&s_block, &span);
+    size_t len = storage_block_seal(&s_block);
+    storage_log_t *log = storage_main_log();
+    uint32_t reclaimed = log->reclaimed;
+
+    // Counted as shed by the quota code when refused
+    bool stored = storage_quota_before_append(log, len, &span);
+    bool ok = !stored || storage_log_append(log, s_block_buf, len, &span) == ESP_OK;
+    storage_space_refresh();
+
+    portENTER_CRITICAL(&s_stats_lock);
+    if (!ok) {
+        s_stats.write_errors += count;
+    } else if (stored) {
+        s_stats.written += count;
+    }
+    s_stats.reclaimed_segments += log->reclaimed - reclaimed;
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    storage_block_begin_encoded(&s_block, s_block_buf, sizeof(s_block_buf), WRITER_ENCODING);
+    return ok;
+}
+
+static bool block_add(const storage_sample_t *sample, float value)
+{
+    if (sample->raw != STORAGE_RAW_NONE) {
+        return storage_block_add_raw(&s_block, sample, value);
+    }
+    return storage_block_add_sample(&s_block, sample->sensor_id, sample->timestamp, value);
+}
+
+// Raw samples are converted here only for the rollups and the zone map;
+// the block keeps the codes. Without a calibration yet they are stored all
+// the same and converted on read once one is set; the rollups miss them.
+bool storage_block_append_sample(const storage_sample_t *sample)
+{
+    storage_sample_t units;
+
+    if (storage_calib_to_units(sample, &units)) {
+        storage_rollup_add(&units);
+    } else {
+        if (!(s_uncalibrated & STORAGE_SENSOR_BIT(sample->sensor_id))) {
+            ESP_LOGW(TAG, "No calibration for %s, storing raw samples unconverted",
+                     storage_sensor_name(sample->sensor_id));
+            s_uncalibrated |= STORAGE_SENSOR_BIT(sample->sensor_id);
+        }
+        units.value = NAN;
+    }
+    if (block_add(sample, units.value)) {
+        return true;
+    }
+    storage_block_commit();
+    return block_add(sample, units.value);
+}
+
+bool storage_block_append_note(uint32_t timestamp, const char *text)
+{
+    if (storage_block_add_note(&s_block, timestamp, text)) {
+        return true;
+    }
+    storage_block_commit();
+    return storage_block_add_note(&s_block, timestamp, text);
+}
+
+static void writer_flush(void)
+{
+    int64_t start_us = esp_timer_get_time();
+
+    storage_lock();
+    uint16_t pending = s_block.count;
+    storage_block_commit();
+    storage_rollup_flush(false);
+    storage_unlock();
+
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.flushes++;
+    s_stats.last_flush_us = elapsed_us;
+    s_stats.total_flush_us += elapsed_us;
+    if (elapsed_us > s_stats.max_flush_us) {
+        s_stats.max_flush_us = elapsed_us;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    ESP_LOGD(TAG, "Flushed %u samples in %lu us", pending, (unsigned long)elapsed_us);
+}
+
+static void storage_writer_task(void *arg)
+{
+    storage_sample_t sample;
+    int64_t oldest_pending_us = 0;
+
+    while (1) {
+        bool flush_requested = false;
+        TickType_t wait = portMAX_DELAY;
+        if (!storage_block_empty(&s_block)) {
+            int64_t age_ms = (esp_timer_get_time() - oldest_pending_us) / 1000;
+            wait = age_ms >= STORAGE_FLUSH_AGE_MS ? 0 : pdMS_TO_TICKS(STORAGE_FLUSH_AGE_MS - age_ms);
+        }
+
+        if (xQueueReceive(s_sample_queue, &sample, wait) == pdTRUE) {
+            // Drain whatever else is already waiting under a single lock
+            uint32_t batch = 0, failed = 0;
+
+            storage_lock();
+            if (storage_block_empty(&s_block)) {
+                oldest_pending_us = esp_timer_get_time();
+            }
+            do {
+                if (sample.sensor_id == STORAGE_FLUSH_MARKER) {
+                    flush_requested = true;
+                } else if (!storage_quota_admit(&sample)) {
+                    storage_sample_t units;
+                    if (storage_calib_to_units(&sample, &units)) {
+                        storage_rollup_add(&units);
+                    }
+                } else if (!storage_block_append_sample(&sample)) {
+                    failed++;
+                }
+                batch++;
+            } while (!flush_requested && batch < STORAGE_FLUSH_COUNT &&
+                     xQueueReceive(s_sample_queue, &sample, 0) == pdTRUE);
+            storage_unlock();
+
+            if (failed > 0) {
+                portENTER_CRITICAL(&s_stats_lock);
+                s_stats.write_errors += failed;
+                portEXIT_CRITICAL(&s_stats_lock);
+            }
+        }
+
+        if (storage_block_empty(&s_block)) {
+            continue;
+        }
+
+        bool too_old = (esp_timer_get_time() - oldest_pending_us) / 1000 >= STORAGE_FLUSH_AGE_MS;
+        if (s_block.count >= STORAGE_FLUSH_COUNT || too_old || flush_requested) {
+            writer_flush();
+        }
+    }
+}
+
+void storage_writer_start(void)
+{
+    if (s_writer_task != NULL) {
+        return;
+    }
+
+    storage_block_begin_encoded(&s_block, s_block_buf, sizeof(s_block_buf), WRITER_ENCODING);
+    s_storage_mutex = xSemaphoreCreateRecursiveMutex();
+    s_sample_queue = xQueueCreate(STORAGE_QUEUE_LENGTH, sizeof(storage_sample_t));
+    if (s_storage_mutex == NULL || s_sample_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate writer queue");
+        return;
+    }
+
+    xTaskCreate(storage_writer_task, "storage_writer", STORAGE_WRITER_STACK_SIZE, NULL, 4, &s_writer_task);
+    ESP_LOGI(TAG, "Writer task started (queue=%d, flush_count=%d, flush_age=%dms)",
+             STORAGE_QUEUE_LENGTH, STORAGE_FLUSH_COUNT, STORAGE_FLUSH_AGE_MS);
+}
@@ -0,0 +1,8 @@
+/*
+ * Minimal stand-in for ESP-IDF's esp_timer.h; the host tool provides it.
+ */
+#pragma once
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,216 @@
+/*
+ * Host-side benchmark of the MQTT bulk transfer
+ * (modules/mqtt_client/mqtt_bulk.h).
+ *
+ * Sends a storage partition through the bulk encoder chunk by chunk,
+ * expands every chunk again and checks it against the original bytes. It
+ * reports compression ratio, encode time, and the bytes on the wire and
+ * airtime at an assumed link rate next to the line-by-line upload, one
+ * "ts;value" QoS 1 message per record on its sensor topic.
+ *
+ * Build and run from the repository root:
+ *   cc -O2 -Itools/host -Imodules/mqtt_client -Imodules/storage_manager -Iinclude \
+ *      tools/mqtt_bulk_bench.c modules/mqtt_client/mqtt_bulk.c \
+ *      modules/storage_manager/storage_format.c modules/storage_manager/storage_series.c \
+ *      -lm -o mqtt_bulk_bench
+ *   ./mqtt_bulk_bench [partition.bin [kbit/s]]
+ *
+ * partition.bin is a raw dump of the storage partition. Without it a full
+ * 1 MB partition of series blocks is generated from the measurement
+ * intervals in project_config.h. The default link rate is 1000 kbit/s of
+ * MQTT payload.
+ *
+ * Airtime is an estimate: wire bytes over the assumed rate, without
+ * PUBACK round trips, outbox pauses or flash reads. No drain time has
+ * been measured against a broker yet; the upload logs it on the device
+ * ("All stored data sent: ... ms").
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mqtt_bulk.h"
+#include "project_config.h"
+#include "storage_format.h"
+#include "storage_log.h"
+#include "storage_manager.h"
+
+#define PARTITION_SIZE (1024 * 1024)
+#define TOPIC_PREFIX "user/a0b1c2d3e4f5"
+
+static const char *s_names[STORAGE_SENSOR_COUNT] = {
+    "BMP280", "VEML7700", "MAX6675_NORMAL", "MAX6675_PROFILE", "HC-SR04", "ADXL345",
+};
+
+const char *storage_sensor_name(uint8_t sensor_id)
+{
+    return sensor_id < STORAGE_SENSOR_COUNT ? s_names[sensor_id] : "UNKNOWN";
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Size of a QoS 1 PUBLISH carrying len payload bytes on topic
+static size_t wire_bytes(const char *topic, size_t len)
+{
+    size_t remaining = 2 + strlen(topic) + 2 + len;
+    size_t length_bytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : 3;
+    return 1 + length_bytes + remaining;
+}
+
+// Fills every segment with series blocks of all sensors at their intervals
+static void partition_synthetic(uint8_t *part, size_t size)
+{
+    static const struct {
+        uint32_t interval_ms;
+        float start, step, resolution;
+    } sensors[STORAGE_SENSOR_COUNT] = {
+        [STORAGE_SENSOR_BMP280] = { (BMP280_MEASUREMENT_INTERVAL_MS), 21.0f, 0.02f, 0.01f },
+        [STORAGE_SENSOR_VEML7700] = { (VEML7700_MEASUREMENT_INTERVAL_MS), 400.0f, 5.0f, 0.1f },
+        [STORAGE_SENSOR_MAX6675_NORMAL] = { (MAX6675_MEASUREMENT_INTERVAL_MS), 85.0f, 0.5f, 0.25f },
+        [STORAGE_SENSOR_MAX6675_PROFILE] = { (MAX6675_PROFILE_INTERVAL_MS), 85.0f, 0.5f, 0.25f },
+        [STORAGE_SENSOR_HCSR04] = { (HCSR04_SLOWMODE_INTERVAL_MS), 120.0f, 1.0f, 0.1f },
+        [STORAGE_SENSOR_ADXL345] = { (FREQUENT_MEASUREMENT_INTERVAL_MS), 0.0f, 0.05f, 0.001f },
+    };
+    uint32_t next_ms[STORAGE_SENSOR_COUNT] = { 0 };
+    float value[STORAGE_SENSOR_COUNT];
+    uint8_t block[STORAGE_BLOCK_SIZE];
+    storage_block_builder_t b;
+    size_t seg = 0, off = STORAGE_SEGMENT_HEADER_SIZE;
+
+    for (int id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        value[id] = sensors[id].start;
+    }
+    memset(part, 0xFF, size);
+    srand(1);
+    storage_block_begin_encoded(&b, block, sizeof(block), STORAGE_ENCODING_SERIES);
+    while (seg < size / STORAGE_SEGMENT_SIZE) {
+        int id = 0;
+        for (int i = 1; i < STORAGE_SENSOR_COUNT; i++) {
+            if (next_ms[i] < next_ms[id]) {
+                id = i;
+            }
+        }
+        uint32_t ts = 1700000000 + next_ms[id] / 1000;
+        next_ms[id] += sensors[id].interval_ms;
+        value[id] += sensors[id].step * ((rand() % 1000) / 500.0f - 1.0f);
+        float v = roundf(value[id] / sensors[id].resolution) * sensors[id].resolution;
+
+        if (storage_block_add_sample(&b, id, ts, v)) {
+            continue;
+        }
+        size_t len = storage_block_seal(&b);
+        if (off + len > STORAGE_SEGMENT_DATA_END) {
+            seg++;
+            off = STORAGE_SEGMENT_HEADER_SIZE;
+        }
+        if (seg < size / STORAGE_SEGMENT_SIZE) {
+            memcpy(&part[seg * STORAGE_SEGMENT_SIZE + off], block, len);
+            off += len;
+        }
+        storage_block_begin_encoded(&b, block, sizeof(block), STORAGE_ENCODING_SERIES);
+        storage_block_add_sample(&b, id, ts, v);
+    }
+}
+
+// What the line-by-line upload sends for every valid block in the data
+static void line_by_line(const uint8_t *data, size_t len, size_t *records, size_t *wire)
+{
+    char topics[STORAGE_SENSOR_COUNT][64];
+
+    for (int id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        snprintf(topics[id], sizeof(topics[id]), TOPIC_PREFIX "/sensor/%s", s_names[id]);
+    }
+    for (size_t pos = 0; pos + STORAGE_BLOCK_HEADER_SIZE <= len;) {
+        storage_block_header_t hdr;
+        storage_block_iter_t it;
+        storage_record_t rec;
+
+        if (storage_block_parse_header(&data[pos], len - pos, &hdr) != ESP_OK ||
+            storage_block_iter_init(&it, &data[pos], len - pos) != ESP_OK) {
+            pos++;
+            continue;
+        }
+        while (storage_block_iter_next(&it, &rec) == ESP_OK) {
+            if (rec.sensor_id < STORAGE_SENSOR_COUNT) {
+                char line[32];
+                int n = snprintf(line, sizeof(line), "%lu;%.3f", (unsigned long)rec.timestamp, rec.value);
+                (*records)++;
+                *wire += wire_bytes(topics[rec.sensor_id], n);
+            }
+        }
+        pos += STORAGE_BLOCK_HEADER_SIZE + hdr.payload_len;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static mqtt_bulk_lzss_t lz;
+    static uint8_t msg[MQTT_BULK_HEADER_SIZE + MQTT_BULK_CHUNK_MAX];
+    static uint8_t back[MQTT_BULK_CHUNK_MAX];
+    double kbps = argc > 2 ? strtod(argv[2], NULL) : 1000;
+    size_t size = PARTITION_SIZE;
+    uint8_t *part = malloc(size);
+
+    if (part == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    if (argc > 1) {
+        FILE *f = fopen(argv[1], "rb");
+        if (f == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+        size = fread(part, 1, size, f) / STORAGE_SEGMENT_SIZE * STORAGE_SEGMENT_SIZE;
+        fclose(f);
+    } else {
+        partition_synthetic(part, size);
+    }
+
+    size_t records = 0, line_wire = 0;
+    line_by_line(part, size, &records, &line_wire);
+
+    char topic[] = TOPIC_PREFIX "/bulk";
+    size_t chunks = 0, packed = 0, bulk_wire = 0, failed = 0;
+    double start = now_ms();
+    for (size_t off = 0; off < size; off += MQTT_BULK_CHUNK_SIZE) {
+        size_t len = mqtt_bulk_encode(&lz, off / STORAGE_SEGMENT_SIZE, off % STORAGE_SEGMENT_SIZE, &part[off],
+                                      MQTT_BULK_CHUNK_SIZE, msg);
+        chunks++;
+        packed += len;
+        bulk_wire += wire_bytes(topic, len);
+    }
+    double encode_ms = now_ms() - start;
+
+    for (size_t off = 0; off < size; off += MQTT_BULK_CHUNK_SIZE) {
+        mqtt_bulk_header_t hdr;
+        size_t len = mqtt_bulk_encode(&lz, off / STORAGE_SEGMENT_SIZE, off % STORAGE_SEGMENT_SIZE, &part[off],
+                                      MQTT_BULK_CHUNK_SIZE, msg);
+        if (mqtt_bulk_decode(msg, len, &hdr, back, sizeof(back)) != ESP_OK ||
+            hdr.segment * STORAGE_SEGMENT_SIZE + hdr.offset != off || memcmp(back, &part[off], hdr.length) != 0) {
+            failed++;
+        }
+    }
+
+    printf("%s: %zu segments, %zu bytes, %zu records\n", argc > 1 ? argv[1] : "synthetic partition",
+           size / STORAGE_SEGMENT_SIZE, size, records);
+    printf("  %-12s %9s %10s %8s %14s\n", "", "messages", "wire", "vs raw", "est. airtime s");
+    printf("  %-12s %9zu %10zu %7.2fx %14.1f\n", "line-by-line", records, line_wire, (double)line_wire / size,
+           line_wire * 8 / (kbps * 1000));
+    printf("  %-12s %9zu %10zu %7.2fx %14.1f\n", "bulk", chunks, bulk_wire, (double)bulk_wire / size,
+           bulk_wire * 8 / (kbps * 1000));
+    printf("  LZSS: %.2fx over the raw partition, %.2f ms per segment on this host\n", (double)size / packed,
+           encode_ms / (size / STORAGE_SEGMENT_SIZE));
+    printf("  Airtime estimated at %.0f kbit/s of payload, not measured\n", kbps);
+    if (failed > 0) {
+        printf("  ROUND TRIP FAILED (%zu chunks)\n", failed);
+    }
+    free(part);
+    return failed > 0;
+}
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Reassemble log segments sent by the MQTT bulk transfer
+(modules/mqtt_client/mqtt_bulk.h) into a file storage_decode.py reads.
+
+Usage:
+  mosquitto_sub -h BROKER -t 'user/+/bulk' -F %x | mqtt_bulk_receive.py -o segments.bin
+  storage_decode.py segments.bin
+
+Input is one chunk message per line, hex encoded. Every chunk is expanded
+and checked against its CRC; complete segments are written in sequence
+order, and incomplete ones or bad chunks are reported on stderr.
+"""
+import argparse
+import struct
+import sys
+import zlib
+
+BULK_VERSION = 1
+BULK_HEADER = struct.Struct("<BBHIII")  # version, flags, length, segment, offset, crc32
+FLAG_LZSS = 0x01
+MIN_MATCH = 3
+
+SEGMENT_SIZE = 16 * 1024
+
+
+def lzss_expand(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        flags = data[i]
+        i += 1
+        for bit in range(8):
+            if i >= len(data):
+                break
+            if flags & (1 << bit):
+                out.append(data[i])
+                i += 1
+                continue
+            token = data[i] | data[i + 1] << 8
+            i += 2
+            distance = (token & 0x0FFF) + 1
+            n = (token >> 12) + MIN_MATCH
+            if n == 15 + MIN_MATCH:
+                n += data[i]
+                i += 1
+            if distance > len(out):
+                raise ValueError("match before the start of the chunk")
+            for _ in range(n):
+                out.append(out[-distance])
+    return bytes(out)
+
+
+def decode_chunk(msg):
+    version, flags, length, segment, offset, crc = BULK_HEADER.unpack_from(msg)
+    if version != BULK_VERSION:
+        raise ValueError("unsupported version %d" % version)
+    data = msg[BULK_HEADER.size:]
+    if flags & FLAG_LZSS:
+        data = lzss_expand(data)
+    if len(data) != length or zlib.crc32(data) != crc:
+        raise ValueError("segment %d offset %d: CRC mismatch" % (segment, offset))
+    if offset + length > SEGMENT_SIZE:
+        raise ValueError("segment %d: chunk past the segment end" % segment)
+    return segment, offset, data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", nargs="?", help="hex encoded messages, one per line (default: stdin)")
+    parser.add_argument("-o", "--output", required=True, help="file for the complete segments")
+    args = parser.parse_args()
+
+    segments = {}
+    bad = 0
+    src = open(args.input) if args.input else sys.stdin
+    for line in src:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            segment, offset, data = decode_chunk(bytes.fromhex(line))
+        except (ValueError, IndexError, struct.error) as e:
+            print("bad chunk: %s" % e, file=sys.stderr)
+            bad += 1
+            continue
+        buf, covered = segments.setdefault(segment, (bytearray(SEGMENT_SIZE), {}))
+        buf[offset:offset + len(data)] = data
+        covered[offset] = len(data)
+
+    written = 0
+    with open(args.output, "wb") as out:
+        for segment in sorted(segments):
+            buf, covered = segments[segment]
+            if sum(covered.values()) != SEGMENT_SIZE:
+                print("segment %d incomplete (%d of %d bytes)" % (segment, sum(covered.values()), SEGMENT_SIZE),
+                      file=sys.stderr)
+                continue
+            out.write(buf)
+            written += 1
+    print("%d segments written, %d bad chunks" % (written, bad), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,277 @@
+/*
+ * Host-side check of the MQTT batch payloads
+ * (modules/mqtt_client/mqtt_payload.h).
+ *
+ * Splits a sensor trace into batches the way the backlog upload does
+ * (MQTT_BATCH_MAX_BYTES, MQTT_BATCH_MAX_SPAN_S), encodes them as text and
+ * as binary, decodes both and checks that the binary payloads give the
+ * same samples as the text ones. It reports payload and wire bytes per
+ * sample for each format next to the old one-message-per-sample upload.
+ * Wire bytes count the QoS 1 PUBLISH packet: fixed header, topic and
+ * packet id, and with MQTT 5 topic aliases the property block, the topic
+ * going in full only with the first message on it.
+ *
+ * These are byte counts computed on the host, not measured uploads: they
+ * estimate what batching saves on the wire. Upload throughput is only
+ * measured on the device, in the summary the backlog upload logs
+ * (samples, messages, bytes, ms and samples/s).
+ *
+ * Build and run from the repository root:
+ *   cc -O2 -Itools/host -Imodules/mqtt_client -Imodules/storage_manager -Iinclude \
+ *      tools/mqtt_payload_bench.c modules/mqtt_client/mqtt_payload.c -lm -o mqtt_payload_bench
+ *   ./mqtt_payload_bench [trace.csv ...]
+ *
+ * A trace is a NAME;timestamp;value file as printed by the `read` console
+ * command or tools/storage_decode.py. Without arguments one hour of every
+ * sensor at its measurement interval is generated.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mqtt_payload.h"
+#include "project_config.h"
+#include "storage_manager.h"
+
+// Topic prefix as the device builds it: user and a 12 digit MAC
+#define TOPIC_PREFIX "user/a0b1c2d3e4f5"
+
+static const char *s_names[STORAGE_SENSOR_COUNT] = {
+    "BMP280", "VEML7700", "MAX6675_NORMAL", "MAX6675_PROFILE", "HC-SR04", "ADXL345",
+};
+
+typedef struct {
+    uint32_t ts;
+    float value;
+} sample_t;
+
+typedef struct {
+    sample_t *samples;
+    size_t count;
+    size_t cap;
+} series_t;
+
+typedef struct {
+    size_t samples;
+    size_t messages;
+    size_t payload;
+    size_t wire;
+    size_t mismatches;
+    bool topic_sent; // aliases are only measured for binary, on its one topic
+} result_t;
+
+static void series_add(series_t *s, uint32_t ts, float value)
+{
+    if (s->count == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->samples = realloc(s->samples, s->cap * sizeof(*s->samples));
+        if (s->samples == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->samples[s->count++] = (sample_t){ ts, value };
+}
+
+static int trace_load(series_t *series, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *sep1 = strchr(line, ';');
+        char *sep2 = sep1 ? strchr(sep1 + 1, ';') : NULL;
+        if (sep2 == NULL) {
+            continue; // notes
+        }
+        *sep1 = '\0';
+        for (int id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+            if (strcmp(line, s_names[id]) == 0) {
+                series_add(&series[id], strtoul(sep1 + 1, NULL, 10), strtof(sep2 + 1, NULL));
+                break;
+            }
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// A random walk per sensor, quantised like the drivers' output
+static void trace_synthetic(series_t *series)
+{
+    static const struct {
+        uint32_t interval_ms;
+        float start, step, resolution;
+    } sensors[STORAGE_SENSOR_COUNT] = {
+        [STORAGE_SENSOR_BMP280] = { (BMP280_MEASUREMENT_INTERVAL_MS), 21.0f, 0.02f, 0.01f },
+        [STORAGE_SENSOR_VEML7700] = { (VEML7700_MEASUREMENT_INTERVAL_MS), 400.0f, 5.0f, 0.1f },
+        [STORAGE_SENSOR_MAX6675_NORMAL] = { (MAX6675_MEASUREMENT_INTERVAL_MS), 85.0f, 0.5f, 0.25f },
+        [STORAGE_SENSOR_MAX6675_PROFILE] = { (MAX6675_PROFILE_INTERVAL_MS), 85.0f, 0.5f, 0.25f },
+        [STORAGE_SENSOR_HCSR04] = { (HCSR04_SLOWMODE_INTERVAL_MS), 120.0f, 1.0f, 0.1f },
+        [STORAGE_SENSOR_ADXL345] = { (FREQUENT_MEASUREMENT_INTERVAL_MS), 0.0f, 0.05f, 0.001f },
+    };
+    const uint32_t base_ts = 1700000000;
+
+    srand(1);
+    for (int id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        float v = sensors[id].start;
+        for (uint32_t ms = 0; ms < 3600 * 1000u; ms += sensors[id].interval_ms) {
+            v += sensors[id].step * ((rand() % 1000) / 500.0f - 1.0f);
+            series_add(&series[id], base_ts + ms / 1000,
+                       roundf(v / sensors[id].resolution) * sensors[id].resolution);
+        }
+    }
+}
+
+// Size of a QoS 1 PUBLISH carrying len payload bytes on a topic of
+// topic_len bytes; an MQTT 5 alias adds the property length and the
+// 3-byte Topic Alias property
+static size_t wire_bytes(size_t topic_len, size_t len, bool alias)
+{
+    size_t remaining = 2 + topic_len + 2 + (alias ? 4 : 0) + len;
+    size_t length_bytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : 3;
+    return 1 + length_bytes + remaining;
+}
+
+static void batch_check(const uint8_t *buf, size_t len, uint8_t format, const sample_t *expected,
+                        size_t count, result_t *res)
+{
+    mqtt_payload_iter_t it;
+    uint32_t ts;
+    float value;
+    size_t n = 0;
+
+    if (mqtt_payload_iter_init(&it, buf, len, format) != ESP_OK) {
+        res->mismatches += count;
+        return;
+    }
+    while (mqtt_payload_iter_next(&it, &ts, &value) == ESP_OK) {
+        if (n >= count || ts != expected[n].ts ||
+            lroundf(value * MQTT_PAYLOAD_VALUE_SCALE) != lroundf(expected[n].value * MQTT_PAYLOAD_VALUE_SCALE)) {
+            res->mismatches++;
+        }
+        n++;
+    }
+    if (n != count) {
+        res->mismatches += n > count ? n - count : count - n;
+    }
+}
+
+// Text samples are what a receiver got so far; binary has to match them
+static void run(uint8_t id, const series_t *s, uint8_t format, size_t batch_bytes, bool alias,
+                sample_t *text_ref, result_t *res)
+{
+    uint8_t buf[MQTT_BATCH_MAX_BYTES];
+    char topic[64];
+    mqtt_payload_t p;
+    size_t first = 0;
+
+    if (format == MQTT_PAYLOAD_BINARY) {
+        snprintf(topic, sizeof(topic), TOPIC_PREFIX "/bin");
+    } else {
+        snprintf(topic, sizeof(topic), TOPIC_PREFIX "/sensor/%s", s_names[id]);
+    }
+
+    mqtt_payload_begin(&p, buf, batch_bytes, format, id);
+    for (size_t i = 0; i <= s->count; i++) {
+        bool flush = i == s->count;
+        if (!flush && p.count > 0 &&
+            (s->samples[i].ts - p.first_ts > MQTT_BATCH_MAX_SPAN_S ||
+             !mqtt_payload_add(&p, s->samples[i].ts, s->samples[i].value))) {
+            flush = true;
+        } else if (!flush && p.count == 0) {
+            mqtt_payload_add(&p, s->samples[i].ts, s->samples[i].value);
+        }
+        if (!flush || p.count == 0) {
+            continue;
+        }
+
+        size_t len = mqtt_payload_finish(&p);
+        size_t count = p.count;
+        batch_check(buf, len, format, &text_ref[first], count, res);
+        if (format == MQTT_PAYLOAD_TEXT && batch_bytes == sizeof(buf)) {
+            // Keep what the text receiver decoded as the reference
+            mqtt_payload_iter_t it;
+            mqtt_payload_iter_init(&it, buf, len, format);
+            for (size_t k = 0; k < count; k++) {
+                mqtt_payload_iter_next(&it, &text_ref[first + k].ts, &text_ref[first + k].value);
+            }
+        }
+        res->samples += count;
+        res->messages++;
+        res->payload += len;
+        res->wire += wire_bytes(alias && res->topic_sent ? 0 : strlen(topic), len, alias);
+        res->topic_sent = true;
+        first += count;
+
+        mqtt_payload_begin(&p, buf, batch_bytes, format, id);
+        if (i < s->count) {
+            mqtt_payload_add(&p, s->samples[i].ts, s->samples[i].value);
+        }
+    }
+}
+
+static void report(const char *name, const result_t *r)
+{
+    printf("  %-12s %8zu %9zu %9.2f %9zu %9.2f", name, r->messages, r->payload,
+           (double)r->payload / r->samples, r->wire, (double)r->wire / r->samples);
+    if (r->mismatches > 0) {
+        printf("  ROUND TRIP FAILED (%zu mismatches)", r->mismatches);
+    }
+    printf("\n");
+}
+
+static void bench(const char *name, const series_t *series)
+{
+    result_t line = { 0 }, text = { 0 }, binary = { 0 }, aliased = { 0 };
+
+    for (uint8_t id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+        const series_t *s = &series[id];
+        sample_t *ref = malloc((s->count + 1) * sizeof(*ref));
+        if (ref == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        memcpy(ref, s->samples, s->count * sizeof(*ref));
+
+        // A one line budget gives the old upload, one message per sample
+        run(id, s, MQTT_PAYLOAD_TEXT, 24, false, ref, &line);
+        run(id, s, MQTT_PAYLOAD_TEXT, MQTT_BATCH_MAX_BYTES, false, ref, &text);
+        run(id, s, MQTT_PAYLOAD_BINARY, MQTT_BATCH_MAX_BYTES, false, ref, &binary);
+        run(id, s, MQTT_PAYLOAD_BINARY, MQTT_BATCH_MAX_BYTES, true, ref, &aliased);
+        free(ref);
+    }
+
+    printf("%s: %zu samples (host estimate of PUBLISH bytes)\n", name, text.samples);
+    printf("  %-12s %8s %9s %9s %9s %9s\n", "", "messages", "payload", "B/sample", "wire", "B/sample");
+    report("text/sample", &line);
+    report("text", &text);
+    report("binary", &binary);
+    report("binary+alias", &aliased);
+}
+
+int main(int argc, char **argv)
+{
+    int rc = 0;
+
+    for (int i = 1; i <= (argc < 2 ? 1 : argc - 1); i++) {
+        series_t series[STORAGE_SENSOR_COUNT] = { 0 };
+
+        if (argc < 2) {
+            trace_synthetic(series);
+            bench("synthetic hour", series);
+        } else if (trace_load(series, argv[i]) == 0) {
+            bench(argv[i], series);
+        } else {
+            rc = 1;
+        }
+        for (int id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+            free(series[id].samples);
+        }
+    }
+    return rc;
+}
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Ask a device for stored samples over the MQTT query channel
+(modules/mqtt_client/mqtt_client_app.c) and print them as NAME;timestamp;value.
+
+Usage:
+  mqtt_query.py -H BROKER -p user/a0b1c2d3e4f5 MAX6675_PROFILE 1700000000 1700003600 --step 1
+
+SENSOR may be '*' for all sensors. Needs mosquitto_pub and mosquitto_sub.
+Messages are printed in the order the device numbered them; a missing or
+repeated message number is reported on stderr.
+"""
+import argparse
+import random
+import struct
+import subprocess
+import sys
+import time
+
+QUERY_VERSION = 1
+QUERY_HEADER = struct.Struct("<BBHI")  # version, status, seq, request id
+QUERY_DATA, QUERY_DONE, QUERY_BAD_REQUEST, QUERY_FAILED = range(4)
+
+PAYLOAD_VERSION = 1
+PAYLOAD_HEADER = struct.Struct("<BBHI")  # version, sensor id, count, base_ts
+VALUE_SCALE = 1000
+
+SENSOR_NAMES = [
+    "BMP280",
+    "VEML7700",
+    "MAX6675_NORMAL",
+    "MAX6675_PROFILE",
+    "HC-SR04",
+    "ADXL345",
+]
+
+
+def read_varint(buf, pos):
+    result = shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        result |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return result, pos
+        shift += 7
+
+
+def zigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def decode_batch(buf):
+    version, sensor_id, count, ts = PAYLOAD_HEADER.unpack_from(buf)
+    if version != PAYLOAD_VERSION:
+        raise ValueError("unsupported payload version %d" % version)
+    name = SENSOR_NAMES[sensor_id] if sensor_id < len(SENSOR_NAMES) else "UNKNOWN"
+    pos = PAYLOAD_HEADER.size
+    value = 0
+    for _ in range(count):
+        delta, pos = read_varint(buf, pos)
+        ts += delta
+        delta, pos = read_varint(buf, pos)
+        value += zigzag(delta)
+        yield name, ts, value / VALUE_SCALE
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-H", "--host", required=True, help="broker address")
+    parser.add_argument("-p", "--prefix", required=True, help="device topic prefix, <user>/<mac>")
+    parser.add_argument("sensor")
+    parser.add_argument("t_from", type=int)
+    parser.add_argument("t_to", type=int)
+    parser.add_argument("--step", type=int, default=0, help="keep one sample per STEP seconds and sensor")
+    parser.add_argument("--timeout", type=float, default=30, help="seconds without a message before giving up")
+    args = parser.parse_args()
+
+    request_id = random.getrandbits(32)
+    sub = subprocess.Popen(["mosquitto_sub", "-h", args.host, "-q", "1", "-t", args.prefix + "/response",
+                            "-F", "%x", "-W", str(int(args.timeout))], stdout=subprocess.PIPE, text=True)
+    time.sleep(0.5)  # subscribed before the device can answer
+    request = "%d %s %d %d %d" % (request_id, args.sensor, args.t_from, args.t_to, args.step)
+    subprocess.run(["mosquitto_pub", "-h", args.host, "-q", "1", "-t", args.prefix + "/query", "-m", request],
+                   check=True)
+
+    status, expected, samples = None, 0, 0
+    for line in sub.stdout:
+        msg = bytes.fromhex(line.strip())
+        if len(msg) < QUERY_HEADER.size:
+            continue
+        version, status, seq, rid = QUERY_HEADER.unpack_from(msg)
+        if version != QUERY_VERSION or rid != request_id:
+            continue
+        if seq != expected:
+            print("message %d where %d was expected" % (seq, expected), file=sys.stderr)
+        expected = seq + 1
+        body = msg[QUERY_HEADER.size:]
+        if status != QUERY_DATA:
+            break
+        for name, ts, value in decode_batch(body):
+            print("%s;%d;%.3f" % (name, ts, value))
+            samples += 1
+    sub.terminate()
+
+    if status == QUERY_DONE:
+        sent, = struct.unpack_from("<I", body)
+        print("%d samples in %d messages%s" % (samples, expected, "" if sent == samples else
+                                               ", device sent %d" % sent), file=sys.stderr)
+        return 0 if sent == samples else 1
+    reasons = {QUERY_BAD_REQUEST: "bad request", QUERY_FAILED: "query failed on the device", None: "no answer"}
+    print("%s after %d samples" % (reasons.get(status, "timed out"), samples), file=sys.stderr)
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
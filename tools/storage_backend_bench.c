@@ -0,0 +1,168 @@
+/*
+ * Host-side benchmark of the storage backends
+ * (modules/storage_manager/storage_backend.h).
+ *
+ * Runs the same workload as the `bench backend` console command: series
+ * blocks are appended through the segment log until the ring wraps, read
+ * back and cleared. It reports append/read throughput, clear time, write
+ * amplification and per-block latency percentiles.
+ *
+ *  raw   esp_partition emulated over a RAM NOR flash image. It enforces
+ *        1 -> 0 programming and sector aligned erases, and counts bytes.
+ *  file  A host file, which is the code path the spiffs and littlefs
+ *        backends share once their file system is mounted.
+ *
+ * SPIFFS and LittleFS themselves only run on the device; use
+ * `bench backend` there with STORAGE_BACKEND set in project_config.h.
+ * That comparison has not been measured yet, so no figures for either
+ * file system are recorded here.
+ *
+ * Build and run from the repository root:
+ *   cc -O2 -Itools/host -Imodules/storage_manager -Iinclude tools/storage_backend_bench.c \
+ *      modules/storage_manager/storage_backend.c modules/storage_manager/storage_backend_file.c \
+ *      modules/storage_manager/storage_backend_bench.c modules/storage_manager/storage_log.c \
+ *      modules/storage_manager/storage_format.c modules/storage_manager/storage_series.c \
+ *      -lm -o storage_backend_bench
+ *   ./storage_backend_bench [segments] [file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "storage_backend.h"
+#include "storage_backend_bench.h"
+#include "storage_log.h"
+#include "storage_manager.h"
+
+#define FLASH_SECTOR 4096
+
+static esp_partition_t s_part = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = ESP_PARTITION_SUBTYPE_ANY,
+    .erase_size = FLASH_SECTOR,
+    .label = "storage",
+};
+static uint8_t *s_flash;
+
+const char *storage_sensor_name(uint8_t sensor_id)
+{
+    static const char *names[STORAGE_SENSOR_COUNT] = {
+        "BMP280", "VEML7700", "MAX6675_NORMAL", "MAX6675_PROFILE", "HC-SR04", "ADXL345",
+    };
+    return sensor_id < STORAGE_SENSOR_COUNT ? names[sensor_id] : "UNKNOWN";
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static char buf[16];
+    snprintf(buf, sizeof(buf), "0x%x", code);
+    return buf;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    (void)subtype;
+    if (type != s_part.type || s_flash == NULL || strcmp(label, s_part.label) != 0) {
+        return NULL;
+    }
+    return &s_part;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t src_offset, void *dst, size_t size)
+{
+    if (src_offset + size > part->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, s_flash + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t dst_offset, const void *src, size_t size)
+{
+    const uint8_t *p = src;
+
+    if (dst_offset + size > part->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < size; i++) {
+        // NOR flash can only clear bits
+        if ((s_flash[dst_offset + i] & p[i]) != p[i]) {
+            fprintf(stderr, "program over unerased byte at 0x%zx\n", dst_offset + i);
+            return ESP_FAIL;
+        }
+        s_flash[dst_offset + i] = p[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t offset, size_t size)
+{
+    if (offset % FLASH_SECTOR != 0 || size % FLASH_SECTOR != 0 || offset + size > part->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(s_flash + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+static int run(storage_backend_t *be, uint32_t segments)
+{
+    storage_backend_bench_result_t res;
+
+    esp_err_t err = storage_backend_bench_run(be, 0, segments, &res);
+    if (err != ESP_OK) {
+        fprintf(stderr, "%s: benchmark failed (%s)\n", be->ops->name, esp_err_to_name(err));
+        return 1;
+    }
+    storage_backend_bench_print(be->ops->name, &res);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t segments = argc > 1 ? strtoul(argv[1], NULL, 10) : 16;
+    const char *path = argc > 2 ? argv[2] : "storage_backend_bench.bin";
+    uint32_t size = segments * STORAGE_SEGMENT_SIZE;
+    storage_backend_t be;
+    int rc = 0;
+
+    if (segments < 2) {
+        fprintf(stderr, "need at least 2 segments\n");
+        return 2;
+    }
+    printf("Backend benchmark, %lu segments of %u bytes:\n", (unsigned long)segments, STORAGE_SEGMENT_SIZE);
+
+    s_flash = malloc(size);
+    if (s_flash == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    memset(s_flash, 0xFF, size);
+    s_part.size = size;
+    if (storage_backend_open(&be, STORAGE_BACKEND_RAW, s_part.label, NULL, 0) == ESP_OK) {
+        rc |= run(&be, segments);
+        storage_backend_close(&be);
+    } else {
+        rc = 1;
+    }
+    free(s_flash);
+
+    if (storage_backend_open(&be, STORAGE_BACKEND_FILE, NULL, path, size) == ESP_OK) {
+        rc |= run(&be, segments);
+        storage_backend_close(&be);
+        unlink(path);
+    } else {
+        rc = 1;
+    }
+    return rc;
+}
@@ -0,0 +1,283 @@
+/*
+ * Host-side benchmark of the storage block encodings
+ * (modules/storage_manager/storage_format.h).
+ *
+ * Encodes a sensor trace with every sample encoding, decodes it back,
+ * checks the round trip and reports bytes per sample, the compression ratio
+ * against the old text log and encode/decode time per sample.
+ *
+ * Build and run from the repository root:
+ *   cc -O2 -Itools/host -Imodules/storage_manager -Iinclude tools/storage_codec_bench.c \
+ *      modules/storage_manager/storage_format.c modules/storage_manager/storage_series.c \
+ *      -lm -o storage_codec_bench
+ *   ./storage_codec_bench [trace.csv ...]
+ *
+ * A trace is a NAME;timestamp;value file as printed by the `read` console
+ * command or tools/storage_decode.py. Without arguments a synthetic trace
+ * is generated from the measurement intervals in project_config.h.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "project_config.h"
+#include "storage_format.h"
+#include "storage_manager.h"
+
+#define REPEAT 20
+
+static const char *s_names[STORAGE_SENSOR_COUNT] = {
+    "BMP280", "VEML7700", "MAX6675_NORMAL", "MAX6675_PROFILE", "HC-SR04", "ADXL345",
+};
+
+const char *storage_sensor_name(uint8_t sensor_id)
+{
+    return sensor_id < STORAGE_SENSOR_COUNT ? s_names[sensor_id] : "UNKNOWN";
+}
+
+typedef struct {
+    storage_sample_t *samples;
+    size_t count;
+    size_t cap;
+    size_t text_bytes;
+} trace_t;
+
+static void trace_add(trace_t *t, uint8_t sensor_id, uint32_t ts, float value)
+{
+    if (t->count == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 4096;
+        t->samples = realloc(t->samples, t->cap * sizeof(*t->samples));
+        if (t->samples == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    t->samples[t->count++] = (storage_sample_t){ .sensor_id = sensor_id, .timestamp = ts, .value = value };
+    t->text_bytes += snprintf(NULL, 0, "%s;%lu;%.3f\n", s_names[sensor_id], (unsigned long)ts, value);
+}
+
+static int sample_cmp(const void *a, const void *b)
+{
+    const storage_sample_t *x = a, *y = b;
+    return x->timestamp < y->timestamp ? -1 : x->timestamp > y->timestamp;
+}
+
+static int trace_load(trace_t *t, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *sep1 = strchr(line, ';');
+        char *sep2 = sep1 ? strchr(sep1 + 1, ';') : NULL;
+        if (sep2 == NULL) {
+            continue; // notes
+        }
+        *sep1 = '\0';
+        for (int id = 0; id < STORAGE_SENSOR_COUNT; id++) {
+            if (strcmp(line, s_names[id]) == 0) {
+                trace_add(t, id, strtoul(sep1 + 1, NULL, 10), strtof(sep2 + 1, NULL));
+                break;
+            }
+        }
+    }
+    fclose(f);
+    // The writer stores samples in arrival order, which is timestamp order
+    qsort(t->samples, t->count, sizeof(*t->samples), sample_cmp);
+    return 0;
+}
+
+// One day of every sensor at its configured interval, with slow drifts,
+// a little noise and quantisation like the real drivers produce.
+static void trace_synthetic(trace_t *t)
+{
+    static const struct {
+        uint8_t id;
+        uint32_t interval_ms;
+    } sensors[] = {
+        { STORAGE_SENSOR_BMP280, BMP280_MEASUREMENT_INTERVAL_MS },
+        { STORAGE_SENSOR_VEML7700, VEML7700_MEASUREMENT_INTERVAL_MS },
+        { STORAGE_SENSOR_MAX6675_NORMAL, MAX6675_MEASUREMENT_INTERVAL_MS },
+        { STORAGE_SENSOR_MAX6675_PROFILE, MAX6675_PROFILE_INTERVAL_MS },
+        { STORAGE_SENSOR_HCSR04, HCSR04_SLOWMODE_INTERVAL_MS },
+        { STORAGE_SENSOR_ADXL345, FREQUENT_MEASUREMENT_INTERVAL_MS },
+    };
+    const uint32_t base_ts = 1700000000;
+    const uint32_t duration_ms = 24 * 3600 * 1000u;
+    uint32_t next_ms[sizeof(sensors) / sizeof(sensors[0])] = { 0 };
+
+    srand(1);
+    for (;;) {
+        size_t s = 0;
+        for (size_t i = 1; i < sizeof(sensors) / sizeof(sensors[0]); i++) {
+            if (next_ms[i] < next_ms[s]) {
+                s = i;
+            }
+        }
+        uint32_t ms = next_ms[s];
+        if (ms >= duration_ms) {
+            break;
+        }
+        next_ms[s] += sensors[s].interval_ms;
+
+        // The profile is only sampled while a 10 minute session runs each hour
+        if (sensors[s].id == STORAGE_SENSOR_MAX6675_PROFILE && ms % 3600000 >= 600000) {
+            continue;
+        }
+
+        double hours = ms / 3600000.0;
+        double noise = (rand() % 1000) / 1000.0 - 0.5;
+        float value;
+        switch (sensors[s].id) {
+        case STORAGE_SENSOR_BMP280:
+            value = roundf((float)(21.0 + 3.0 * sin(hours / 24 * 2 * M_PI) + 0.05 * noise) * 100) / 100;
+            break;
+        case STORAGE_SENSOR_VEML7700:
+            value = roundf((float)fmax(0, 800 * sin((hours - 6) / 24 * 2 * M_PI) + 5 * noise) * 10) / 10;
+            break;
+        case STORAGE_SENSOR_MAX6675_NORMAL:
+        case STORAGE_SENSOR_MAX6675_PROFILE:
+            // MAX6675 resolution is 0.25 °C
+            value = roundf((float)(85 + 15 * sin(ms / 7200000.0) + noise) * 4) / 4;
+            break;
+        case STORAGE_SENSOR_HCSR04:
+            value = roundf((float)(120 + 2 * noise) * 10) / 10;
+            break;
+        default:
+            value = roundf((float)(0.05 * sin(ms / 700.0) + 0.01 * noise) * 1000) / 1000;
+            break;
+        }
+        trace_add(t, sensors[s].id, base_ts + ms / 1000, value);
+    }
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Encodes the whole trace into out (blocks back to back), returns its size
+static size_t encode(const trace_t *t, uint8_t encoding, uint8_t *out)
+{
+    uint8_t buf[STORAGE_BLOCK_SIZE];
+    storage_block_builder_t b;
+    size_t used = 0;
+
+    storage_block_begin_encoded(&b, buf, sizeof(buf), encoding);
+    for (size_t i = 0; i < t->count; i++) {
+        const storage_sample_t *s = &t->samples[i];
+        if (!storage_block_add_sample(&b, s->sensor_id, s->timestamp, s->value)) {
+            size_t len = storage_block_seal(&b);
+            memcpy(&out[used], buf, len);
+            used += len;
+            storage_block_begin_encoded(&b, buf, sizeof(buf), encoding);
+            storage_block_add_sample(&b, s->sensor_id, s->timestamp, s->value);
+        }
+    }
+    if (!storage_block_empty(&b)) {
+        size_t len = storage_block_seal(&b);
+        memcpy(&out[used], buf, len);
+        used += len;
+    }
+    return used;
+}
+
+// Decodes every block; returns the number of records that differ from the trace
+static size_t decode(const trace_t *t, const uint8_t *data, size_t len, size_t *records)
+{
+    size_t pos = 0, n = 0, mismatches = 0;
+
+    while (pos < len) {
+        storage_block_header_t hdr;
+        storage_block_iter_t it;
+        storage_record_t rec;
+
+        if (storage_block_parse_header(&data[pos], len - pos, &hdr) != ESP_OK ||
+            storage_block_iter_init(&it, &data[pos], len - pos) != ESP_OK) {
+            fprintf(stderr, "corrupt block at %zu\n", pos);
+            break;
+        }
+        while (storage_block_iter_next(&it, &rec) == ESP_OK) {
+            const storage_sample_t *s = &t->samples[n++];
+            if (rec.sensor_id != s->sensor_id || rec.timestamp != s->timestamp ||
+                lroundf(rec.value * STORAGE_VALUE_SCALE) != lroundf(s->value * STORAGE_VALUE_SCALE)) {
+                mismatches++;
+            }
+        }
+        pos += STORAGE_BLOCK_HEADER_SIZE + hdr.payload_len;
+    }
+    *records = n;
+    return mismatches;
+}
+
+static void bench(const char *name, const trace_t *t)
+{
+    static const struct {
+        const char *name;
+        uint8_t encoding;
+    } encodings[] = {
+        { "plain", STORAGE_ENCODING_PLAIN },
+        { "series", STORAGE_ENCODING_SERIES },
+    };
+
+    // Worst case is one sample per block
+    uint8_t *out = malloc(t->count * STORAGE_BLOCK_HEADER_SIZE * 4 + t->count * 16);
+    if (out == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    printf("%s: %zu samples, text %zu B (%.2f B/sample)\n", name, t->count, t->text_bytes,
+           (double)t->text_bytes / t->count);
+    printf("  %-7s %10s %9s %7s %10s %10s\n", "", "bytes", "B/sample", "ratio", "enc ns/s", "dec ns/s");
+
+    for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+        size_t len = 0, records = 0, mismatches = 0;
+
+        double start = now_ns();
+        for (int r = 0; r < REPEAT; r++) {
+            len = encode(t, encodings[e].encoding, out);
+        }
+        double enc_ns = (now_ns() - start) / REPEAT / t->count;
+
+        start = now_ns();
+        for (int r = 0; r < REPEAT; r++) {
+            mismatches = decode(t, out, len, &records);
+        }
+        double dec_ns = (now_ns() - start) / REPEAT / t->count;
+
+        printf("  %-7s %10zu %9.2f %6.1fx %10.1f %10.1f", encodings[e].name, len, (double)len / t->count,
+               (double)t->text_bytes / len, enc_ns, dec_ns);
+        if (records != t->count || mismatches > 0) {
+            printf("  ROUND TRIP FAILED (%zu/%zu records, %zu mismatches)", records, t->count, mismatches);
+        }
+        printf("\n");
+    }
+    free(out);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        trace_t t = { 0 };
+        trace_synthetic(&t);
+        bench("synthetic day", &t);
+        free(t.samples);
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        trace_t t = { 0 };
+        if (trace_load(&t, argv[i]) == 0 && t.count > 0) {
+            bench(argv[i], &t);
+        }
+        free(t.samples);
+    }
+    return 0;
+}
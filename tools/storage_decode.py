@@ -0,0 +1,332 @@
+#!/usr/bin/env python3
+"""Convert the binary sensor log (modules/storage_manager/storage_format.h)
+back to the old NAME;timestamp;value text format. Rollup blocks (minute and
+hour tiers) come out as NAME;bucket_start;mean;min;max;count.
+
+Usage: storage_decode.py log.bin [-o out.csv]
+
+SD card archive files (/sdcard/slog/XXXXXXXX.SLG) hold copies of whole
+segments. They are preallocated, so only segments whose header matches
+their slot are decoded; the rest of the file is whatever the card held.
+
+Raw sensor codes (format version 3) are converted with the CAL notes the
+device writes to the log once per boot; codes logged before any CAL note
+of their sensor come out as NAME;timestamp;code;raw.
+
+Anything that is not a valid block (erased flash, torn writes) is skipped.
+"""
+import argparse
+import math
+import os
+import re
+import struct
+import sys
+import zlib
+
+BLOCK_MAGIC = 0x4C53
+FORMAT_VERSION = 3
+FORMAT_VERSION_MIN = 1
+HEADER = struct.Struct("<HBBIHHI")
+MAX_PAYLOAD = 512 - HEADER.size
+
+ENCODING_PLAIN = 0
+ENCODING_ROLLUP = 1
+ENCODING_SERIES = 2
+
+# storage_series.h: bucket payload widths for timestamps and values
+SERIES_TS_WIDTHS = (0, 7, 9, 12, 32)
+SERIES_VALUE_WIDTHS = (0, 6, 12, 20, 32)
+
+# storage_log.h / project_config.h
+SEGMENT_SIZE = 16 * 1024
+SEGMENT_HEADER = struct.Struct("<IB3sIII")  # magic, version, reserved, seq, epoch_seq, crc
+SEGMENT_MAGIC = 0x47534C53
+ARCHIVE_FILE_SEGMENTS = 64
+ARCHIVE_NAME = re.compile(r"^([0-9A-Fa-f]{8})\.SLG$", re.IGNORECASE)
+
+RECORD_NOTE = 0x7F
+RECORD_RAW = 0x40
+VALUE_SCALE = 1000
+
+SENSOR_NAMES = [
+    "BMP280",
+    "VEML7700",
+    "MAX6675_NORMAL",
+    "MAX6675_PROFILE",
+    "HC-SR04",
+    "ADXL345",
+]
+
+
+SERIES_NOTE_TAG = len(SENSOR_NAMES)
+SERIES_RAW_TAG = 7
+
+# storage_raw_channel_t: sensor id of every raw channel (0 is "none")
+RAW_BMP280_T, RAW_VEML7700, RAW_MAX6675_NORMAL, RAW_MAX6675_PROFILE, RAW_ADXL345_X, RAW_ADXL345_Y, \
+    RAW_ADXL345_Z = range(1, 8)
+RAW_SENSOR = {RAW_BMP280_T: 0, RAW_VEML7700: 1, RAW_MAX6675_NORMAL: 2, RAW_MAX6675_PROFILE: 3,
+              RAW_ADXL345_X: 5, RAW_ADXL345_Y: 5, RAW_ADXL345_Z: 5}
+RAW_CHANNEL_COUNT = 8
+
+VEML7700_COEFS = (6.0135e-13, -9.3924e-9, 8.1488e-5, 1.0023)
+ADXL345_GRAVITY_MS2 = 9.81
+
+
+def sensor_name(sensor_id):
+    return SENSOR_NAMES[sensor_id] if sensor_id < len(SENSOR_NAMES) else "UNKNOWN"
+
+
+def read_varint(buf, pos):
+    result = shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        result |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return result, pos
+        shift += 7
+
+
+def zigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def skip_summary(payload):
+    """Return the offset of the first record in a version 2 payload."""
+    _, pos = read_varint(payload, 0)  # ts_span
+    zones = payload[pos]
+    pos += 1
+    for _ in range(zones):
+        pos += 1  # sensor id
+        for _ in range(4):  # count, min, max, sum
+            _, pos = read_varint(payload, pos)
+    return pos
+
+
+class RawConverter:
+    """Turns raw code records into lines, mirroring storage_calib.c."""
+
+    def __init__(self):
+        self.calib = {}  # sensor name -> [(since, fields)], oldest first
+        self.axes = []
+        self.collecting = True
+
+    def note(self, ts, text):
+        fields = text.split(";")
+        if self.collecting and len(fields) > 2 and fields[0] == "CAL":
+            history = self.calib.setdefault(fields[1], [])
+            history.append((ts, [float(f) for f in fields[2:]]))
+            history.sort(key=lambda entry: entry[0])
+        return text
+
+    def lookup(self, sensor_id, ts):
+        history = self.calib.get(sensor_name(sensor_id))
+        if not history:
+            return None
+        best = history[0][1]
+        for since, fields in history:
+            if since <= ts:
+                best = fields
+        return best
+
+    def convert(self, channel, ts, codes):
+        if channel in (RAW_MAX6675_NORMAL, RAW_MAX6675_PROFILE):
+            return codes[0] * 0.25
+        cal = self.lookup(RAW_SENSOR[channel], ts)
+        if cal is None:
+            return None
+        if channel == RAW_BMP280_T:
+            t1, t2, t3 = (int(f) for f in cal[:3])
+            adc = codes[0]
+            var1 = (((adc >> 3) - (t1 << 1)) * t2) >> 11
+            var2 = ((((adc >> 4) - t1) * ((adc >> 4) - t1) >> 12) * t3) >> 14
+            return (((var1 + var2) * 5 + 128) >> 8) / 100.0
+        if channel == RAW_VEML7700:
+            lux = codes[0] * cal[1]
+            if lux > 1000.0:
+                a, b, c, d = VEML7700_COEFS
+                lux = a * lux ** 4 + b * lux ** 3 + c * lux ** 2 + d * lux
+            return lux
+        lsb, offsets, scales = cal[0], cal[1:4], cal[4:7]
+        total = sum((s * (code * lsb - o)) ** 2 for code, o, s in zip(codes, offsets, scales))
+        return math.sqrt(total) - ADXL345_GRAVITY_MS2
+
+    def record(self, channel, ts, code):
+        """Return the line for a raw record, or None while ADXL345 axes are pending."""
+        name = sensor_name(RAW_SENSOR[channel])
+        if channel == RAW_ADXL345_X:
+            self.axes = [code]
+        elif channel in (RAW_ADXL345_Y, RAW_ADXL345_Z):
+            self.axes.append(code)
+        if channel == RAW_ADXL345_Z and len(self.axes) == 3:
+            codes = self.axes
+            channel = RAW_ADXL345_X
+        elif channel in (RAW_ADXL345_X, RAW_ADXL345_Y):
+            return None
+        else:
+            codes = [code]
+        value = self.convert(channel, ts, codes)
+        if value is None:
+            return "\n".join("%s;%d;%d;raw" % (name, ts, c) for c in codes)
+        return "%s;%d;%.3f" % (name, ts, value)
+
+
+def decode_plain(payload, base_ts, count, version, raw):
+    pos, ts = (skip_summary(payload) if version >= 2 else 0), base_ts
+    for _ in range(count):
+        sensor_id = payload[pos]
+        pos += 1
+        delta, pos = read_varint(payload, pos)
+        ts += delta
+        v, pos = read_varint(payload, pos)
+        if sensor_id == RECORD_NOTE:
+            yield raw.note(ts, payload[pos:pos + v].decode("utf-8", "replace"))
+            pos += v
+        elif RECORD_RAW < sensor_id < RECORD_RAW + RAW_CHANNEL_COUNT:
+            line = raw.record(sensor_id - RECORD_RAW, ts, zigzag(v))
+            if line is not None:
+                yield line
+        else:
+            yield "%s;%d;%.3f" % (sensor_name(sensor_id), ts, zigzag(v) / VALUE_SCALE)
+
+
+class BitReader:
+    def __init__(self, buf):
+        self.buf = buf
+        self.pos = 0
+
+    def read(self, n):
+        v = 0
+        for _ in range(n):
+            v = (v << 1) | ((self.buf[self.pos >> 3] >> (7 - (self.pos & 7))) & 1)
+            self.pos += 1
+        return v
+
+    def bucket(self, widths):
+        i = 0
+        while i < len(widths) - 1 and self.read(1):
+            i += 1
+        return self.read(widths[i])
+
+    def align(self):
+        self.pos = (self.pos + 7) & ~7
+
+
+def to_int32(v):
+    v &= 0xFFFFFFFF
+    return v - (1 << 32) if v & 0x80000000 else v
+
+
+def decode_series(payload, base_ts, count, raw):
+    bits = BitReader(payload)
+    bits.pos = skip_summary(payload) * 8
+    # Contexts: sensors, notes, then raw channels at SERIES_NOTE_TAG + channel
+    contexts = SERIES_NOTE_TAG + RAW_CHANNEL_COUNT
+    ts = [base_ts] * contexts
+    delta = [0] * contexts
+    value = [0] * contexts
+    for _ in range(count):
+        tag = bits.read(3)
+        channel = bits.read(3) + 1 if tag == SERIES_RAW_TAG else 0
+        ctx = SERIES_NOTE_TAG + channel if channel else tag
+        delta[ctx] = (delta[ctx] + zigzag(bits.bucket(SERIES_TS_WIDTHS))) & 0xFFFFFFFF
+        ts[ctx] = (ts[ctx] + delta[ctx]) & 0xFFFFFFFF
+        if tag == SERIES_NOTE_TAG:
+            n = bits.read(7)
+            bits.align()
+            start = bits.pos >> 3
+            yield raw.note(ts[ctx], payload[start:start + n].decode("utf-8", "replace"))
+            bits.pos += n * 8
+            continue
+        value[ctx] = to_int32(value[ctx] + zigzag(bits.bucket(SERIES_VALUE_WIDTHS)))
+        if channel:
+            line = raw.record(channel, ts[ctx], value[ctx])
+            if line is not None:
+                yield line
+        else:
+            yield "%s;%d;%.3f" % (sensor_name(tag), ts[ctx], value[ctx] / VALUE_SCALE)
+
+
+def decode_rollup(payload, base_ts, count):
+    pos, ts = skip_summary(payload), base_ts
+    for _ in range(count):
+        sensor_id = payload[pos]
+        pos += 1
+        delta, pos = read_varint(payload, pos)
+        ts += delta
+        fields = []
+        for _ in range(4):  # count, min, max, sum
+            v, pos = read_varint(payload, pos)
+            fields.append(v)
+        n, vmin, vmax, vsum = fields[0], zigzag(fields[1]), zigzag(fields[2]), zigzag(fields[3])
+        yield "%s;%d;%.3f;%.3f;%.3f;%d" % (sensor_name(sensor_id), ts, vsum / n / VALUE_SCALE,
+                                           vmin / VALUE_SCALE, vmax / VALUE_SCALE, n)
+
+
+def iter_blocks(data):
+    pos = 0
+    while pos + HEADER.size <= len(data):
+        magic, version, encoding, base_ts, count, payload_len, crc = HEADER.unpack_from(data, pos)
+        end = pos + HEADER.size + payload_len
+        if (magic != BLOCK_MAGIC or not FORMAT_VERSION_MIN <= version <= FORMAT_VERSION or
+                payload_len > MAX_PAYLOAD or end > len(data)):
+            pos += 1
+            continue
+        payload = data[pos + HEADER.size:end]
+        if zlib.crc32(payload, zlib.crc32(data[pos:pos + 12])) != crc:
+            pos += 1
+            continue
+        yield version, encoding, base_ts, count, payload
+        pos = end
+
+
+def archive_segments(data, first_seq):
+    for slot in range(len(data) // SEGMENT_SIZE):
+        segment = data[slot * SEGMENT_SIZE:(slot + 1) * SEGMENT_SIZE]
+        magic, _, _, seq, _, crc = SEGMENT_HEADER.unpack_from(segment)
+        if (magic == SEGMENT_MAGIC and seq == first_seq + slot and
+                zlib.crc32(segment[:SEGMENT_HEADER.size - 4]) == crc):
+            yield segment
+
+
+def decode_blocks(data, raw):
+    for version, encoding, base_ts, count, payload in iter_blocks(data):
+        if encoding == ENCODING_PLAIN:
+            yield from decode_plain(payload, base_ts, count, version, raw)
+        elif encoding == ENCODING_SERIES:
+            yield from decode_series(payload, base_ts, count, raw)
+        elif encoding == ENCODING_ROLLUP:
+            yield from decode_rollup(payload, base_ts, count)
+        elif not raw.collecting:
+            print("skipping block with unknown encoding %d" % encoding, file=sys.stderr)
+
+
+def decode(data):
+    # A CAL note may be logged after codes it applies to, so all of them
+    # are collected before anything is converted
+    raw = RawConverter()
+    for _ in decode_blocks(data, raw):
+        pass
+    raw.collecting = False
+    yield from decode_blocks(data, raw)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="binary log file or raw partition dump")
+    parser.add_argument("-o", "--output", help="CSV output file (default: stdout)")
+    args = parser.parse_args()
+
+    with open(args.log, "rb") as f:
+        data = f.read()
+    archive = ARCHIVE_NAME.match(os.path.basename(args.log))
+    if archive:
+        data = b"".join(archive_segments(data, int(archive.group(1), 16) * ARCHIVE_FILE_SEGMENTS))
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    for line in decode(data):
+        out.write(line + "\n")
+
+
+if __name__ == "__main__":
+    main()